@@ -1,3 +1,4 @@
+#include <stdlib.h>
 #include <string.h>
 
 #include "jssp.h"
@@ -27,8 +28,9 @@ static char *JSSP_TYPE[8] =
 #define __skip_char4(base,offset,X,...) X == *((base) + (offset)) || __skip_char3(base,offset,__VA_ARGS__)
 #define __skip_char5(base,offset,X,...) X == *((base) + (offset)) || __skip_char4(base,offset,__VA_ARGS__)
 
-#define jssp_skip_chars(base, offset, ...) do {\
-  while(__skip_chars(__VA_ARGS__,__skip_char5,__skip_char4,__skip_char3,__skip_char2,__skip_char1)(base,offset,__VA_ARGS__)) \
+#define jssp_skip_chars(base, offset, len, ...) do {\
+  while((offset) < (len) && \
+        (__skip_chars(__VA_ARGS__,__skip_char5,__skip_char4,__skip_char3,__skip_char2,__skip_char1)(base,offset,__VA_ARGS__))) \
     { \
       jssp_debug("skipping %d", js[(offset)]); \
       (offset)++; \
@@ -47,120 +49,481 @@ static char *JSSP_TYPE[8] =
 
 #define jssp_valid_utf8data(c) (((c) & 0xC0) == 0x80)
 
+/* Without JSSP_BOUNDED a NUL byte ends the input as well as len does.
+ * With it only len does, and a NUL inside the JSON text is invalid. */
+#ifdef JSSP_BOUNDED
+#define jssp_end_of_input(pos, end) ((pos) >= (end))
+#else
+#define jssp_end_of_input(pos, end) ((pos) >= (end) || *(pos) == '\0')
+#endif
+
+#define JSSP_ONES 0x0101010101010101ULL
+#define JSSP_HIGHS 0x8080808080808080ULL
+#define jssp_haszero(v) (((v) - JSSP_ONES) & ~(v) & JSSP_HIGHS)
+/* Lowest flagged byte is exact, bytes above it may be false positives */
+#define jssp_hasless(v, n) (((v) - JSSP_ONES * (n)) & ~(v) & JSSP_HIGHS)
+/* Exact per byte, no borrow between bytes */
+#define jssp_iszero(v) \
+  (~((((v) & ~JSSP_HIGHS) + ~JSSP_HIGHS) | (v)) & JSSP_HIGHS)
+
+/* States of parser->paused */
+#define JSSP_PAUSED_CALLBACK 1 /* a callback returned JSSP_PAUSE */
+#define JSSP_PAUSED_STOPPED 2 /* the call returned, the next one resumes */
+#define JSSP_PAUSED_BUDGET 3 /* the events of this call's budget are used up */
+
+/* Bits of parser->guards: the caller owned features set, so a parser
+ * without them never touches their pointers */
+#define JSSP_GUARD_BULK 1
+#define JSSP_GUARD_FINGERPRINT 2
+#define JSSP_GUARD_BUDGET 4
+#define JSSP_GUARD_LIMITS 8
+
+#define jssp_set_guard(p, g, on) \
+  ((p)->guards = (on) ? (p)->guards | (g) : (p)->guards & ~(g))
+
 #define jssp_do_callback(p, b, cb, cls) do { \
   __typeof__ (p) _p = (p); \
   __typeof__ (b) _b = (b); \
+  int _r; \
   jssp_debug("Invoke user's callback function. type: %s, depth: %zu, index: %zu, key: %.*s, data: %.*s, offset: %zu", \
              JSSP_TYPE[jssp_get_node(_p->node, _b)->type], \
              _p->node, \
-             jssp_get_node(_p->node -1, _b)->size, \
+             (size_t)jssp_get_node(_p->node -1, _b)->size, \
              (int)_p->key_len, \
              _p->key, \
              (int)_p->len, \
              _p->start, \
              _p->stream_offset + (uint64_t)_p->js_offset); \
-  if((cb)((cls), \
-          jssp_get_node(_p->node, _b)->type, \
-          _p->node, \
-          jssp_get_node(_p->node -1, _b)->size, \
-          _p->key, \
-          _p->key_len, \
-          _p->start, \
-          _p->len, \
-          _p->stream_offset + (uint64_t)_p->js_offset) != 0) \
+  _r = (cb)((cls), \
+            jssp_get_node(_p->node, _b)->type, \
+            _p->node, \
+            jssp_get_node(_p->node -1, _b)->size, \
+            _p->key, \
+            _p->key_len, \
+            _p->start, \
+            _p->len, \
+            _p->stream_offset + (uint64_t)_p->js_offset); \
+  /* the event is finished first, the loop stops before the next one */ \
+  if (JSSP_PAUSE == _r) \
+    _p->paused = JSSP_PAUSED_CALLBACK; \
+  else if (0 != _r) \
     { \
       jssp_debug("Terminated by user's callback function."); \
        _p->last_err = JSSP_TERMINATE; \
        return JSSP_TERMINATE; \
     } \
+  else if ((_p->guards & JSSP_GUARD_BUDGET) && 0 == --_p->budget->events_left \
+    && 0 == _p->paused) \
+    _p->paused = JSSP_PAUSED_BUDGET; \
 } while(0)
 
+/* v breaks a limit of max, 0 being none */
+#define jssp_over_limit(v, max) (0 != (max) && (v) > (max))
+
+/* Fail with JSSP_ERROR_LIMIT when cond holds, see jssp_set_limits */
+#define jssp_check_limit(p, cond, l) do { \
+  if (cond) \
+    { \
+      jssp_debug("Limit %d hit at offset %zu.", (l), (p)->js_offset); \
+      (p)->limits->limit = (l); \
+      (p)->limits->limit_offset = (p)->stream_offset + (uint64_t)(p)->js_offset; \
+      (p)->last_err = JSSP_ERROR_LIMIT; \
+      return JSSP_ERROR_LIMIT; \
+    } \
+} while (0)
+
+/* The container just opened is too deep */
+#define jssp_check_depth(p) \
+  jssp_check_limit(p, ((p)->guards & JSSP_GUARD_LIMITS) \
+                   && jssp_over_limit((p)->node, (p)->limits->max_depth), \
+                   JSSP_LIMIT_DEPTH)
+
+/* The current container's size counts its commas, one less than its
+ * elements so far */
+#define jssp_check_elements(p, b) \
+  jssp_check_limit(p, ((p)->guards & JSSP_GUARD_LIMITS) \
+                   && jssp_over_limit(jssp_get_node((p)->node, (b))->size + 1, \
+                                      (p)->limits->max_elements), \
+                   JSSP_LIMIT_ELEMENTS)
+
+/* Add the current literal fragment to the bytes of its literal, before
+ * it reaches the callback; done resets the count for the next one */
+#define jssp_check_literal(p, done) do { \
+  __typeof__ (p) _q = (p); \
+  if (_q->guards & JSSP_GUARD_LIMITS) \
+    { \
+      jssp_limits *_l = _q->limits; \
+      size_t _s = _l->literal_size + _q->len; \
+      if (JSSP_STRING == _q->literal_type) \
+        jssp_check_limit(_q, jssp_over_limit(_s, _l->max_string), JSSP_LIMIT_STRING); \
+      else \
+        { \
+          /* the first bytes tell true, false and null from numbers */ \
+          if (0 == _l->literal_size && 0 != _q->len) \
+            _l->literal_word = *_q->start == 't' || *_q->start == 'f' || *_q->start == 'n'; \
+          if (!_l->literal_word) \
+            jssp_check_limit(_q, jssp_over_limit(_s, _l->max_number), JSSP_LIMIT_NUMBER); \
+        } \
+      _l->literal_size = (done) ? 0 : _s; \
+    } \
+} while (0)
+
 #define jssp_alloc_node(p, b, bs, t) do { \
   __typeof__ (p) _p = (p); \
-  __typeof__ (b) _b = (b); \
-  __typeof__ (bs) _bs = (bs); \
   __typeof__ (t) _t = (t); \
-  if (NULL == _b || _p->node < 0) \
-    { \
-      jssp_debug("buffer is null or node array is not initialized."); \
-      _p->last_err = JSSP_ERROR_NOMEM; \
-      return JSSP_ERROR_NOMEM; \
-    } \
-  if (sizeof(jsspnode_t) * (_p->node + 2) > _bs) \
+  if (sizeof(jsspnode_t) * (_p->node + 2) + _p->arena > (bs) \
+    && JSSP_SUCCESS != jssp_grow (_p, &(b), &(bs), \
+                                  sizeof(jsspnode_t) * (_p->node + 2) + _p->arena)) \
     { \
       jssp_debug("node length %zu exceed buf size %zu.", \
                  _p->node + 2, \
-                 _bs); \
+                 (bs)); \
       _p->last_err = JSSP_ERROR_NOMEM; \
       return JSSP_ERROR_NOMEM; \
     } \
-    (&((jsspnode_t *) (_b))[++_p->node])->type = _t; \
-    (&((jsspnode_t *) (_b))[_p->node])->size = 0; \
+    jssp_check_limit(_p, (_p->guards & JSSP_GUARD_LIMITS) \
+                     && jssp_over_limit(++_p->limits->tokens, _p->limits->max_tokens), \
+                     JSSP_LIMIT_TOKENS); \
+    (&((jsspnode_t *) (b))[_p->node + 1])->key_end = \
+      (&((jsspnode_t *) (b))[_p->node])->key_end; \
+    (&((jsspnode_t *) (b))[++_p->node])->type = _t; \
+    (&((jsspnode_t *) (b))[_p->node])->size = 0; \
     jssp_debug("Create node[%zu] type is %s", _p->node, JSSP_TYPE[_t]); \
 } while (0)
 
-#define jssp_release_node(p) do { \
+/* Turn the current node into a fresh one of type t, keeping its path key */
+#define jssp_replace_node(p, b, t) do { \
+  __typeof__ (p) _p = (p); \
+  jssp_get_node(_p->node, (b))->type = (t); \
+  jssp_get_node(_p->node, (b))->size = 0; \
+  jssp_debug("Replace node[%zu] type with %s", _p->node, JSSP_TYPE[(t)]); \
+} while (0)
+
+/* Releasing a level also pops its key from the path key stack */
+#define jssp_release_node(p, b) do { \
   __typeof__ (p) _p = (p); \
   jssp_debug("Release node[%zu]", _p->node); \
   _p->node--; \
+  _p->arena = jssp_get_node(_p->node, (b))->key_end; \
 }while(0)
 
-#define jssp_remained_buf(bs, n) \
-  (bs - sizeof(jsspnode_t) * (n + 1))
+/* Hash the current record's bytes of js up to offset n */
+#define jssp_fingerprint_to(p, js, n) do { \
+  jssp_fingerprint *_f = (p)->fingerprint; \
+  size_t _n = (n); \
+  if (_n > _f->from) \
+    jssp_fingerprint_update (_f, (js) + _f->from, _n - _f->from); \
+  _f->from = _n; \
+} while (0)
+
+/* The top level record closes at offset n, before its closing callback;
+ * the next one gets a fresh token limit */
+#define jssp_record_end(p, js, n) do { \
+  if ((p)->guards & JSSP_GUARD_LIMITS) \
+    (p)->limits->tokens = 0; \
+  if ((p)->guards & JSSP_GUARD_FINGERPRINT) \
+    { \
+      jssp_fingerprint_to(p, js, n); \
+      jssp_fingerprint_end ((p)->fingerprint); \
+    } \
+} while (0)
+
+#define jssp_remained_buf(bs, n, a) \
+  (bs - sizeof(jsspnode_t) * (n + 1) - (a))
+
+/* Push the current key on the path key stack, which grows downwards from
+ * the end of the buffer, and point the key at the saved copy. */
+#define jssp_push_path_key(p, b, bs) do { \
+  __typeof__ (p) _p = (p); \
+  char *_k; \
+  if (_p->arena + _p->key_len > JSSP_MAX_PATH_KEYS) \
+    { \
+      jssp_debug("path keys exceed %u bytes.", JSSP_MAX_PATH_KEYS); \
+      _p->last_err = JSSP_ERROR_NOMEM; \
+      return JSSP_ERROR_NOMEM; \
+    } \
+  if (sizeof(jsspnode_t) * (_p->node + 1) + _p->arena + _p->key_len > (bs) \
+    && JSSP_SUCCESS != jssp_grow (_p, &(b), &(bs), \
+                                  sizeof(jsspnode_t) * (_p->node + 1) \
+                                  + _p->arena + _p->key_len)) \
+    { \
+      jssp_debug("path key length %zu exceed buf size %zu.", _p->key_len, (bs)); \
+      _p->last_err = JSSP_ERROR_NOMEM; \
+      return JSSP_ERROR_NOMEM; \
+    } \
+  _p->arena += (uint32_t) _p->key_len; \
+  _k = (char *) (b) + (bs) - _p->arena; \
+  if (_p->key_len > 0) \
+    memmove(_k, _p->key, _p->key_len); \
+  _p->key = _k; \
+  jssp_get_node(_p->node, (b))->key_end = _p->arena; \
+} while (0)
+
+/* The key arena is the free space right above the node stack. Saved keys
+ * are assembled there with key_len as the write cursor, so they are never
+ * NUL terminated and never rescanned. */
+#define jssp_key_arena(b, n) \
+  ((char *) (b) + sizeof(jsspnode_t) * ((n) + 1))
 
 /* 1.NOMEM reenter while saving key in broken key.
  * 1.broken in key (key is null)
  * 3.broken in key success. (key is not null)
  * 2.NOMEM reenter while saving key in broken obj val. (key is not null)
  * 5.broken in obj val. (key is not null)
+ *
+ * A new fragment (start, len) is appended at the arena cursor, a key which
+ * still points into the input is copied in once. Either way each byte is
+ * copied a single time, however many chunks the key is split across.
  * */
-#define jssp_save_key(b, bs, p, mx) do {  \
-  __typeof__ (b) _b = (b); \
-  __typeof__ (bs) _bs = (bs); \
+#define jssp_save_key(b, bs, p, mx) jssp_save_key_at(b, bs, p, mx, (p)->node)
+
+/* As jssp_save_key, for the key of the level below node n */
+#define jssp_save_key_at(b, bs, p, mx, n) do {  \
   __typeof__ (p) _p = (p); \
   __typeof__ (mx) _mx = (mx); \
-  char *k = _b + sizeof(jsspnode_t) * (_p->node + 1); \
-  if (NULL == _p->key) \
+  size_t _nd = (n); \
+  char *k = jssp_key_arena((b), _nd); \
+  const char *_src = _p->start; \
+  size_t _n = _p->len; \
+  size_t _at = 0; \
+  int _frag = 1; \
+  if (k == _p->key) \
+    _at = _p->key_len; \
+  else if (NULL != _p->key) \
     { \
-      if (jssp_min(_p->len, _mx) + 1 > jssp_remained_buf(_bs, _p->node)) \
-        { \
-          _p->last_err = JSSP_ERROR_NOMEM; \
-          return JSSP_ERROR_NOMEM; \
-        } \
-      strncpy(k, _p->start, jssp_min(_p->len, _mx)); \
-      _p->key = k; \
-      _p->key_len = jssp_min(_p->len, _mx); \
-      _p->start = NULL; \
-      _p->len = 0; \
+      _src = _p->key; \
+      _n = _p->key_len; \
+      _frag = 0; \
     } \
-  else if (k == _p->key) \
+  _n = _at < _mx ? jssp_min(_n, _mx - _at) : 0; \
+  if (_at + _n > jssp_remained_buf((bs), _nd, _p->arena)) \
     { \
-      if (jssp_min(_p->len + strlen(k), _mx) + 1 > jssp_remained_buf(_bs, _p->node)) \
+      if (JSSP_SUCCESS != jssp_grow (_p, &(b), &(bs), \
+                                     _at + _n + sizeof(jsspnode_t) * (_nd + 1) \
+                                     + _p->arena)) \
         { \
+          jssp_debug("key length %zu exceed key arena.", _at + _n); \
           _p->last_err = JSSP_ERROR_NOMEM; \
           return JSSP_ERROR_NOMEM; \
         } \
-      strncat(k, _p->start, jssp_min(_p->len, _mx)); \
-      p->key_len = strlen(k); \
-      _p->start = NULL; \
-      _p->len = 0; \
+      k = jssp_key_arena((b), _nd); \
     } \
-  else \
+  if (_n > 0) \
+    memcpy(k + _at, _src, _n); \
+  _p->key = k; \
+  _p->key_len = _at + _n; \
+  if (_frag) \
     { \
-      if (jssp_min(_p->key_len, _mx) + 1 > jssp_remained_buf(_bs, _p->node)) \
-        { \
-          _p->last_err = JSSP_ERROR_NOMEM; \
-          return JSSP_ERROR_NOMEM; \
-        } \
-      strncpy(k, _p->key, jssp_min(_p->key_len, _mx)); \
-      _p->key = k; \
-      _p->key_len = jssp_min(_p->key_len, _mx); \
+      _p->start = NULL; \
+      _p->len = 0; \
     } \
 } while (0)
 
 static unsigned char utf8_bom[] =
     { 0xEF ,0xBB ,0xBF };
 
+static void *
+jssp_libc_realloc (void *cls, void *ptr, size_t size)
+{
+  return realloc (ptr, size);
+}
+
+static void
+jssp_libc_free (void *cls, void *ptr)
+{
+  free (ptr);
+}
+
+const jssp_allocator jssp_default_allocator =
+  { &jssp_libc_realloc, &jssp_libc_free, NULL, 0 };
+
+/* Grow the node buffer to hold at least need bytes. The first growth
+ * moves the caller's buffer into a parser owned one, later ones realloc it.
+ * The path key stack is moved to the new end and a key saved in either
+ * arena is rebased to the new buffer. */
+static jssperr_t
+jssp_grow (jssp_parser *parser,
+           void **buf,
+           size_t *buf_size,
+           size_t need)
+{
+  const jssp_allocator *a = parser->allocator;
+  size_t max = (NULL == a || 0 == a->max_size) ? SIZE_MAX : a->max_size;
+  size_t size = *buf_size < 64 ? 64 : *buf_size;
+  size_t key_offset = SIZE_MAX;
+  int key_in_tail = 0;
+  char *nbuf;
+
+  if (NULL == a || need > max)
+    return JSSP_ERROR_NOMEM;
+
+  while (size < need)
+    size = size > max / 2 ? max : size * 2;
+  if (size > max)
+    size = max;
+
+  if (NULL != *buf && parser->key >= (char *) *buf
+    && parser->key < (char *) *buf + *buf_size)
+    {
+      key_offset = parser->key - (char *) *buf;
+      key_in_tail = key_offset >= *buf_size - parser->arena;
+    }
+
+  if (NULL != parser->heap && *buf == parser->heap)
+    nbuf = a->realloc (a->cls, parser->heap, size);
+  else
+    {
+      nbuf = a->realloc (a->cls, NULL, size);
+      if (NULL != nbuf && NULL != *buf)
+        memcpy (nbuf, *buf, *buf_size);
+    }
+  if (NULL == nbuf)
+    return JSSP_ERROR_NOMEM;
+
+  jssp_debug("Grow buffer from %zu to %zu bytes.", *buf_size, size);
+  if (parser->arena > 0)
+    memmove (nbuf + size - parser->arena,
+             nbuf + *buf_size - parser->arena,
+             parser->arena);
+  if (key_in_tail)
+    parser->key = nbuf + size - (*buf_size - key_offset);
+  else if (SIZE_MAX != key_offset)
+    parser->key = nbuf + key_offset;
+  parser->arena_size = size;
+  parser->buf = nbuf;
+  parser->heap = nbuf;
+  parser->heap_size = size;
+  *buf = nbuf;
+  *buf_size = size;
+  return JSSP_SUCCESS;
+}
+
+/* Skip the plain part of a string body: everything but '"', '\\', NUL
+ * and non-ASCII bytes, eight bytes per step. Returns the first byte the
+ * literal parser has to look at, or end. With JSSP_PADDING the caller
+ * guarantees that many readable bytes after end, so the last word needs
+ * no scalar tail. */
+static const char *
+jssp_scan_string (const char *pos,
+                  const char *end)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t w, m;
+
+#if defined(JSSP_PADDING) && JSSP_PADDING >= 8
+  while (pos < end)
+#else
+  while (pos + 8 <= end)
+#endif
+    {
+      memcpy (&w, pos, 8);
+      m = jssp_haszero(w ^ (JSSP_ONES * '"'))
+        | jssp_haszero(w ^ (JSSP_ONES * '\\'))
+        | jssp_haszero(w)
+        | (w & JSSP_HIGHS);
+      if (0 != m)
+        {
+          pos += __builtin_ctzll (m) / 8;
+          return pos < end ? pos : end;
+        }
+      pos += 8;
+    }
+  if (pos > end)
+    pos = end;
+#endif
+  return pos;
+}
+
+/* Bytes of true, false, null and numbers, none of them ends a literal */
+#define jssp_primitive_char(c) \
+  (((c) >= '0' && (c) <= '9') || ((c) >= 'a' && (c) <= 'z') \
+   || (c) == '.' || (c) == '-' || (c) == '+' || (c) == 'E')
+
+/* Fast path of jssp_parse_literal for a literal that starts at js_offset
+ * with nothing carried over. It runs while each escape, UTF-8 sequence or
+ * delimiter is whole within js and sets start once the literal is done.
+ * Otherwise it returns the first byte the resumable loop has to look at,
+ * always between two characters, so the loop carries on from there. */
+static inline const char *
+jssp_scan_literal (jsspliteral_t type,
+                   const char *js,
+                   size_t len,
+                   size_t *js_offset,
+                   const char **start,
+                   size_t *size)
+{
+  const char *pos = js + *js_offset, *end = js + len;
+  unsigned char c;
+  int n;
+
+  if (JSSP_PRIMITIVE == type)
+    {
+      while (pos < end && jssp_primitive_char(*pos))
+        pos++;
+      if (pos < end && (*pos == ',' || *pos == ']' || *pos == '}' || *pos == ' '
+                        || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+        {
+          *start = js + *js_offset;
+          *size = pos - *start;
+          *js_offset = pos - js;
+        }
+      return pos;
+    }
+
+  for (;;)
+    {
+      pos = jssp_scan_string (pos, end);
+      if (pos >= end)
+        return pos;
+      c = (unsigned char) *pos;
+      if (c == '"')
+        {
+          *start = js + *js_offset;
+          *size = pos - *start;
+          *js_offset = pos - js + 1;
+          return pos;
+        }
+      if (c == '\\')
+        {
+          if (end - pos < 2)
+            return pos;
+          switch (pos[1])
+            {
+            case '"': case '/': case '\\': case 'b':
+            case 'f': case 'r': case 'n': case 't':
+              pos += 2;
+              continue;
+            case 'u':
+              if (end - pos < 6 || !jssp_valid_word(pos[2]) || !jssp_valid_word(pos[3])
+                || !jssp_valid_word(pos[4]) || !jssp_valid_word(pos[5]))
+                return pos;
+              pos += 6;
+              continue;
+            default:
+              return pos;
+            }
+        }
+      /* two to four byte UTF-8 sequences, longer ones go the slow way */
+      if (c >= 0xC0 && c < 0xF8)
+        {
+          n = c < 0xE0 ? 1 : c < 0xF0 ? 2 : 3;
+          if (end - pos <= n || !jssp_valid_utf8data(pos[1])
+            || (n > 1 && !jssp_valid_utf8data(pos[2]))
+            || (n > 2 && !jssp_valid_utf8data(pos[3])))
+            return pos;
+          pos += n + 1;
+          continue;
+        }
+      /* plain bytes only stop jssp_scan_string on big endian hosts */
+      if (c != 0 && c < 0x80)
+        {
+          pos++;
+          continue;
+        }
+      return pos;
+    }
+}
+
 /* calculate how many bytes remained since
  * the pos (included) in the given buffer
  *
@@ -183,7 +546,7 @@ jssp_remained_len (const char *data,
 
   for (i = 0; i < upmost; i++)
     {
-      if (pos + i > data + data_len - 1 || *(pos + i) == '\0')
+      if (jssp_end_of_input(pos + i, data + data_len))
         break;
     }
   return i;
@@ -219,10 +582,23 @@ jssp_parse_literal (jsspliteral_t type,
 
   const char *pos = js + (*js_offset);
 
+  if (0 == reg[0])
+    {
+      pos = jssp_scan_literal (type, js, len, js_offset, start, size);
+      if (NULL != *start)
+        return JSSP_SUCCESS;
+    }
+
   jssp_debug("Parsing data ---%.*s---", (int )(len - *js_offset), pos);
   jssp_debug("Literal type is  %d", type);
-  for (; pos < js + len && *pos != '\0'; pos++)
+  for (; !jssp_end_of_input(pos, js + len); pos++)
     {
+      if (type == JSSP_STRING && NULL == *start && 0 == reg[0])
+        {
+          pos = jssp_scan_string (pos, js + len);
+          if (jssp_end_of_input(pos, js + len))
+            break;
+        }
       char c = *pos;
       jssp_debug("reg[0] is %d.", reg[0]);
       /*check whether in broken status*/
@@ -248,6 +624,11 @@ jssp_parse_literal (jsspliteral_t type,
 
       switch (c)
         {
+#ifdef JSSP_BOUNDED
+        case '\0':
+          jssp_debug("NUL byte inside literal.");
+          return JSSP_ERROR_INVAL;
+#endif
 #ifndef JSSP_STRICT
         /* In strict mode primitive must be followed by "," or "}" or "]" */
         case ':':
@@ -383,8 +764,9 @@ jssp_parse_literal (jsspliteral_t type,
 
               hex_symbols_broken:
 
-              /* i is the length (0~3) of data part of \uXXXX stored in the buffer */
-              i = reg[0] > 0 ? reg[0] - 2 : 0;
+              /* i is the length (0~3) of data part of \uXXXX stored in the buffer,
+               * reg[0] == 1 holds the backslash alone */
+              i = reg[0] > 2 ? reg[0] - 2 : 0;
 
               /* j = [1,4] is the avaible chars to match \uXXXX, i+j must equals 4*/
               j = jssp_remained_len (js, len, pos, 4 - i);
@@ -395,7 +777,7 @@ jssp_parse_literal (jsspliteral_t type,
               if (i + j < 4)
                 {
                   /* We should output chars before \uXXX if we could */
-                  if (pos - 2 - js > *js_offset)
+                  if ((size_t) (pos - js) > *js_offset + 2)
                     {
                       *start = js + *js_offset;
                       *size = pos - 2 - *start;
@@ -429,6 +811,7 @@ jssp_parse_literal (jsspliteral_t type,
               if (reg[0] != 0)
                 {
                   /* prepare output */
+                  reg[2] = 'u';
                   *start = reg + 1;
                   *size = 6;
                   /* clear the broken flag*/
@@ -541,7 +924,7 @@ jssp_parse_literal (jsspliteral_t type,
             {
               jssp_debug("Found broken utf8 char sequence");
               /* Check we should output sth this time ? */
-              if (pos - 1 - js > *js_offset)
+              if ((size_t) (pos - js) > *js_offset + 1)
                 {
                   jssp_debug("output chars before broken utf8");
                   *start = js + *js_offset;
@@ -553,10 +936,11 @@ jssp_parse_literal (jsspliteral_t type,
 
               /* dump utf8 chars and update register buffer */
               j = reg[0] != 0 ? reg[0] - 1 : 0;
-              reg[0] = (char) (j + i + 1);
 
-              /*saving leading char*/
-              reg[1] = *(pos - 1);
+              /*saving leading char, a resumed sequence holds it already*/
+              if (0 == reg[0])
+                reg[1] = *(pos - 1);
+              reg[0] = (char) (j + i + 1);
 
               /*saving data char*/
               for (; i > 0; i--)
@@ -648,6 +1032,295 @@ jssp_parse_literal (jsspliteral_t type,
   return JSSP_ERROR_BROKEN;
 }
 
+const double jssp_pow10[23] =
+  { 1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22 };
+
+#define jssp_is_digit(c) ((c) >= '0' && (c) <= '9')
+#define jssp_is_number_char(c) \
+  (jssp_is_digit(c) || (c) == '-' || (c) == '+' || (c) == '.' || (c) == 'e' || (c) == 'E')
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+/* Eight ASCII digits at p, SWAR: all bytes in '0'..'9' */
+static inline int
+jssp_eight_digits (const char *p)
+{
+  uint64_t v;
+
+  memcpy (&v, p, 8);
+  return 0 == (((v & 0xF0F0F0F0F0F0F0F0ULL)
+                | (((v + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4))
+               ^ 0x3333333333333333ULL);
+}
+
+/* Their value, pairs, then quads, then the whole word */
+static inline uint64_t
+jssp_eight_value (const char *p)
+{
+  uint64_t v;
+
+  memcpy (&v, p, 8);
+  v -= 0x3030303030303030ULL;
+  v = v * 10 + (v >> 8);
+  return ((v & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))
+          + ((v >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32))) >> 32;
+}
+#endif
+
+/* Digits at *pos into *m while it stays below 10^18, eight at a time where
+ * possible. Returns the digits taken. */
+static inline size_t
+jssp_scan_digits (const char **pos,
+                  const char *end,
+                  uint64_t *m)
+{
+  const char *p = *pos, *start = *pos;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  while (end - p >= 8 && *m < 10000000000ULL && jssp_eight_digits (p))
+    {
+      *m = *m * 100000000 + jssp_eight_value (p);
+      p += 8;
+    }
+#endif
+  for (; p < end && jssp_is_digit(*p) && *m < 100000000000000000ULL; p++)
+    *m = *m * 10 + (*p - '0');
+  *pos = p;
+  return p - start;
+}
+
+jssperr_t
+jssp_number_int (const char *s,
+                 size_t len,
+                 int64_t *value)
+{
+  const char *p = s, *end = s + len;
+  uint64_t m = 0, max = INT64_MAX;
+  int neg = 0;
+
+  if (p < end && *p == '-')
+    {
+      neg = 1;
+      max++;
+      p++;
+    }
+  if (p == end)
+    return JSSP_ERROR_INVAL;
+  jssp_scan_digits (&p, end, &m);
+  for (; p < end; p++)
+    {
+      if (!jssp_is_digit(*p) || m > (max - (*p - '0')) / 10)
+        return JSSP_ERROR_INVAL;
+      m = m * 10 + (*p - '0');
+    }
+  *value = neg ? (int64_t) (0 - m) : (int64_t) m;
+  return JSSP_SUCCESS;
+}
+
+/* Integers and short decimals are converted here, m * 10^e being exact
+ * while both factors are; the rest goes to strtod. */
+jssperr_t
+jssp_number_double (const char *s,
+                    size_t len,
+                    double *value)
+{
+  const char *p = s, *end = s + len, *digits;
+  char tmp[JSSP_NUMBER_SIZE], *stop;
+  uint64_t m = 0;
+  long exp = 0, e = 0;
+  int neg = 0, eneg = 0;
+  double d;
+
+  if (p < end && *p == '-')
+    {
+      neg = 1;
+      p++;
+    }
+  digits = p;
+  jssp_scan_digits (&p, end, &m);
+  if (p == digits)
+    return JSSP_ERROR_INVAL;
+  if (p < end && jssp_is_digit(*p))
+    goto slow;
+  if (p < end && *p == '.')
+    {
+      digits = ++p;
+      jssp_scan_digits (&p, end, &m);
+      exp = -(long) (p - digits);
+      if (p == digits || (p < end && jssp_is_digit(*p)))
+        goto slow;
+    }
+  if (p < end && (*p == 'e' || *p == 'E'))
+    {
+      p++;
+      if (p < end && (*p == '-' || *p == '+'))
+        eneg = *p++ == '-';
+      for (digits = p; p < end && jssp_is_digit(*p) && e < 10000; p++)
+        e = e * 10 + (*p - '0');
+      if (p == digits)
+        return JSSP_ERROR_INVAL;
+      exp += eneg ? -e : e;
+    }
+  if (p != end)
+    goto slow;
+  if (m < (UINT64_C(1) << 53) && exp >= -22 && exp <= 22)
+    {
+      d = exp < 0 ? (double) m / jssp_pow10[-exp] : (double) m * jssp_pow10[exp];
+      *value = neg ? -d : d;
+      return JSSP_SUCCESS;
+    }
+
+slow:
+  /* strtod also takes hex, inf and nan, which are no JSON numbers */
+  for (p = s; p < end; p++)
+    if (!jssp_is_number_char(*p))
+      return JSSP_ERROR_INVAL;
+  if (len >= sizeof(tmp))
+    return JSSP_ERROR_INVAL;
+  memcpy (tmp, s, len);
+  tmp[len] = '\0';
+  d = strtod (tmp, &stop);
+  if (stop != tmp + len)
+    return JSSP_ERROR_INVAL;
+  *value = d;
+  return JSSP_SUCCESS;
+}
+
+/* A bulk array element */
+static jssperr_t
+jssp_bulk_store (jssp_bulk *bulk,
+                 const char *s,
+                 size_t n)
+{
+  if (bulk->len >= bulk->cap)
+    {
+      jssp_debug("Bulk array longer than %zu", bulk->cap);
+      return JSSP_ERROR_NOMEM;
+    }
+  if (JSSP_BULK_INT64 == bulk->type)
+    {
+      if (JSSP_SUCCESS != jssp_number_int (s, n, (int64_t *) bulk->out + bulk->len))
+        return JSSP_ERROR_INVAL;
+    }
+  else if (JSSP_SUCCESS != jssp_number_double (s, n, (double *) bulk->out + bulk->len))
+    return JSSP_ERROR_INVAL;
+  bulk->len++;
+  return JSSP_SUCCESS;
+}
+
+/* Bulk array states: which token may come next */
+#define JSSP_BULK_OPENED 0 /* a value, '[' or ']' */
+#define JSSP_BULK_COMMA 1 /* a value or '[' */
+#define JSSP_BULK_VALUE 2 /* ',' or ']' */
+
+/* Fill the bulk array from js without events. Stops at its closing
+ * bracket, leaving it to the parser, or at the end of input or of the
+ * call's quantum, carrying a number cut there over to the next call.
+ * Each number counts against the event budget. */
+static jssperr_t
+jssp_bulk_scan (jssp_parser *parser,
+                const char *js,
+                size_t len)
+{
+  jssp_bulk *bulk = parser->bulk;
+  jssp_budget *budget = parser->budget;
+  const char *pos = js + parser->js_offset, *num;
+  const char *end = js + (NULL != budget && budget->quantum_end < len
+                          ? budget->quantum_end : len);
+  jssperr_t err;
+
+  if (bulk->carry_len > 0)
+    {
+      for (; pos < end && jssp_is_number_char(*pos); pos++)
+        {
+          if (bulk->carry_len >= sizeof(bulk->carry))
+            return JSSP_ERROR_INVAL;
+          bulk->carry[bulk->carry_len++] = *pos;
+        }
+      if (pos == end)
+        {
+          parser->js_offset = end - js;
+          return JSSP_SUCCESS;
+        }
+      err = jssp_bulk_store (bulk, bulk->carry, bulk->carry_len);
+      if (JSSP_SUCCESS != err)
+        return err;
+      bulk->carry_len = 0;
+      bulk->state = JSSP_BULK_VALUE;
+      if (NULL != budget && 0 == --budget->events_left)
+        goto budget;
+    }
+
+  while (pos < end)
+    {
+      switch (*pos)
+        {
+        case ' ': case '\t': case '\r': case '\n':
+          pos++;
+          continue;
+        case ',':
+          if (JSSP_BULK_VALUE != bulk->state)
+            return JSSP_ERROR_INVAL;
+          bulk->state = JSSP_BULK_COMMA;
+          pos++;
+          continue;
+        case '[':
+          if (JSSP_BULK_VALUE == bulk->state)
+            return JSSP_ERROR_INVAL;
+          bulk->depth++;
+          bulk->state = JSSP_BULK_OPENED;
+          pos++;
+          continue;
+        case ']':
+          if (JSSP_BULK_COMMA == bulk->state)
+            return JSSP_ERROR_INVAL;
+          if (0 == bulk->depth)
+            {
+              /* the parser closes the array and reports it */
+              parser->bulk = NULL;
+              jssp_set_guard(parser, JSSP_GUARD_BULK, 0);
+              parser->js_offset = pos - js;
+              return JSSP_SUCCESS;
+            }
+          bulk->depth--;
+          bulk->state = JSSP_BULK_VALUE;
+          pos++;
+          continue;
+        default:
+          if (JSSP_BULK_VALUE == bulk->state
+            || !(jssp_is_digit(*pos) || *pos == '-'))
+            {
+              jssp_debug("Not a number in a bulk array: %c", *pos);
+              return JSSP_ERROR_INVAL;
+            }
+          for (num = pos++; pos < end && jssp_is_number_char(*pos); pos++)
+            ;
+          if (pos == end)
+            {
+              if ((size_t) (pos - num) > sizeof(bulk->carry))
+                return JSSP_ERROR_INVAL;
+              memcpy (bulk->carry, num, pos - num);
+              bulk->carry_len = pos - num;
+              break;
+            }
+          if (JSSP_SUCCESS != (err = jssp_bulk_store (bulk, num, pos - num)))
+            return err;
+          bulk->state = JSSP_BULK_VALUE;
+          if (NULL != budget && 0 == --budget->events_left)
+            goto budget;
+          continue;
+        }
+    }
+  parser->js_offset = end - js;
+  return JSSP_SUCCESS;
+
+budget:
+  /* the parser yields before the next token */
+  parser->paused = JSSP_PAUSED_BUDGET;
+  parser->js_offset = pos - js;
+  return JSSP_SUCCESS;
+}
+
 /* A re-entry function to parser given json string, controller is stored in the parser object */
 jssperr_t
 jssp_parse (jssp_parser *parser,
@@ -660,34 +1333,95 @@ jssp_parse (jssp_parser *parser,
             void *cls)
 {
   if (JSSP_ERROR_INVAL == parser->last_err
-    || JSSP_TERMINATE == parser->last_err)
+    || JSSP_TERMINATE == parser->last_err
+    || JSSP_ERROR_LIMIT == parser->last_err)
     {
       jssp_debug("Wrong status of last exit error type. %d", parser->last_err);
       return parser->last_err;
     }
+  parser->paused = 0;
+  /* the work quantum of this call, see jssp_set_budget */
+  if (parser->guards & JSSP_GUARD_BUDGET)
+    {
+      jssp_budget *budget = parser->budget;
+
+      budget->quantum_end = 0 == budget->max_bytes
+        || budget->max_bytes > SIZE_MAX - parser->js_offset
+        ? SIZE_MAX : parser->js_offset + budget->max_bytes;
+      budget->events_left = 0 == budget->max_events ? SIZE_MAX : budget->max_events;
+    }
+
+  if (NULL != parser->heap)
+    {
+      buf = parser->heap;
+      buf_size = parser->heap_size;
+    }
+
+  /* the caller handed in a resized buffer, move the path key stack along */
+  if (parser->arena > 0 && parser->arena_size != buf_size)
+    memmove ((char *) buf + buf_size - parser->arena,
+             (char *) buf + parser->arena_size - parser->arena,
+             parser->arena);
+  parser->arena_size = buf_size;
+  parser->buf = buf;
 
   /* first we create an array node to wrap the json object */
   if (parser->node == SIZE_MAX)
     {
-      if (sizeof(jsspnode_t) > buf_size)
+      if (sizeof(jsspnode_t) > buf_size
+        && JSSP_SUCCESS != jssp_grow (parser, &buf, &buf_size, sizeof(jsspnode_t)))
         {
           jssp_debug("Can not create initial node. Increase your memory.");
           return JSSP_ERROR_NOMEM;
         }
       jssp_debug("Init jssp parser.");
       jssp_get_node(0, buf)->type = JSSP_ARRAY_OPEN;
+      jssp_get_node(0, buf)->key_end = 0;
       jssp_get_node(0, buf)->size = 0;
       parser->node = 0;
     }
 
-  while (parser->js_offset < len && js[parser->js_offset] != '\0')
+  while (!jssp_end_of_input(js + parser->js_offset, js + len))
     {
-      if (parser->js_offset == 0 && len >= 3 && memcmp (js, utf8_bom, 3) == 0)
+      if (parser->paused || ((parser->guards & JSSP_GUARD_BUDGET)
+                             && parser->js_offset >= parser->budget->quantum_end))
+        {
+          jssperr_t err = JSSP_PAUSED_CALLBACK == parser->paused
+            ? JSSP_PAUSE : JSSP_YIELD;
+
+          jssp_debug("Paused, status %d.", err);
+          parser->paused = JSSP_PAUSED_STOPPED;
+          return err;
+        }
+      if (parser->js_offset == 0 && parser->stream_offset == 0
+        && len >= 3 && memcmp (js, utf8_bom, 3) == 0)
         {
           jssp_debug("Found utf8 bom. skipping 3 bytes.");
           parser->js_offset = 3;
         }
-      jssp_skip_chars(js, parser->js_offset, '\t', '\r', '\n', ' ');
+      /* a string split across calls may continue with whitespace */
+      if (JSSP_STRING != parser->literal_type)
+        jssp_skip_chars(js, parser->js_offset, len, '\t', '\r', '\n', ' ');
+      if (jssp_end_of_input(js + parser->js_offset, js + len))
+        break;
+      if (0 == parser->node && (parser->guards & JSSP_GUARD_FINGERPRINT)
+        && js[parser->js_offset] != ',')
+        {
+          jssp_fingerprint_begin (parser->fingerprint,
+                                  parser->stream_offset + parser->js_offset);
+          parser->fingerprint->from = parser->js_offset;
+        }
+      if ((parser->guards & JSSP_GUARD_BULK) && parser->node == parser->bulk->node)
+        {
+          jssperr_t err = jssp_bulk_scan (parser, js, len);
+
+          if (JSSP_SUCCESS != err)
+            {
+              parser->last_err = err;
+              return err;
+            }
+          continue;
+        }
       switch (jssp_get_node(parser->node, buf)->type)
         {
         case JSSP_ARRAY_OPEN:
@@ -704,22 +1438,29 @@ jssp_parse (jssp_parser *parser,
                   return JSSP_ERROR_INVAL;
                 }
               jssp_get_node(parser->node, buf)->type = JSSP_ARRAY_CLOSE;
+              if (1 == parser->node)
+                jssp_record_end(parser, js, parser->js_offset + 1);
               jssp_do_callback(parser, buf, cb, cls);
-              jssp_release_node(parser);
+              jssp_release_node(parser, buf);
               parser->js_offset++;
               continue;
             case '[': /* ->JSSP_ARRAY */
               jssp_alloc_node(parser, buf, buf_size, JSSP_ARRAY_OPEN);
+              jssp_check_depth(parser);
               jssp_do_callback(parser, buf, cb, cls);
               parser->js_offset++;
               continue;
             case '{': /* ->JSSP_OBJECT */
               jssp_alloc_node(parser, buf, buf_size, JSSP_OBJECT_OPEN);
+              jssp_check_depth(parser);
               jssp_do_callback(parser, buf, cb, cls);
               parser->js_offset++;
               continue;
             case ',':
+              /* size counts the commas, top level values are not limited */
               jssp_get_node(parser->node, buf)->size++;
+              if (0 != parser->node)
+                jssp_check_elements(parser, buf);
               parser->js_offset++;
               continue;
             case '\"':
@@ -762,6 +1503,7 @@ jssp_parse (jssp_parser *parser,
             {
             case JSSP_ERROR_BROKEN:
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+              jssp_check_literal(parser, 0);
               if (parser->start != NULL)
                 jssp_do_callback(parser, buf, cb, cls);
               parser->start = NULL;
@@ -769,11 +1511,14 @@ jssp_parse (jssp_parser *parser,
               continue;
             case JSSP_SUCCESS:
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+              jssp_check_literal(parser, 1);
+              if (1 == parser->node)
+                jssp_record_end(parser, js, parser->js_offset);
               if (parser->start != NULL)
                 jssp_do_callback(parser, buf, cb, cls);
               parser->start = NULL;
               parser->len = 0;
-              jssp_release_node(parser);
+              jssp_release_node(parser, buf);
               parser->literal_type = JSSP_PRIMITIVE;
               continue;
             default:
@@ -793,8 +1538,10 @@ jssp_parse (jssp_parser *parser,
             case '}': /* <-JSSP_OBJECT */
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
               jssp_get_node(parser->node, buf)->type = JSSP_OBJECT_CLOSE;
+              if (1 == parser->node)
+                jssp_record_end(parser, js, parser->js_offset + 1);
               jssp_do_callback(parser, buf, cb, cls);
-              jssp_release_node(parser);
+              jssp_release_node(parser, buf);
               parser->js_offset++;
               continue;
             case ':': /* ->JSSP_OBJECT_COMMA */
@@ -805,6 +1552,7 @@ jssp_parse (jssp_parser *parser,
             case ',':
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
               jssp_get_node(parser->node, buf)->size++;
+              jssp_check_elements(parser, buf);
               parser->js_offset++;
               continue;
             case '\"':
@@ -855,10 +1603,12 @@ jssp_parse (jssp_parser *parser,
             {
             case JSSP_ERROR_BROKEN:
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+              jssp_check_literal(parser, 0);
               jssp_save_key(buf, buf_size, parser, max_key_len);
               continue;
             case JSSP_SUCCESS:
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+              jssp_check_literal(parser, 1);
               if (NULL != parser->key
                 || (jssp_min (parser->len + parser->key_len, max_key_len)
                   + sizeof(jsspnode_t) * (parser->node + 1) > buf_size))
@@ -876,7 +1626,7 @@ jssp_parse (jssp_parser *parser,
               jssp_debug("Found object key: %.*s",
                   (int )parser->key_len,
                   parser->key);
-              jssp_release_node(parser);
+              jssp_release_node(parser, buf);
               parser->literal_type = JSSP_PRIMITIVE;
               continue;
             default:
@@ -894,16 +1644,20 @@ jssp_parse (jssp_parser *parser,
           switch (js[parser->js_offset])
             {
             case '[': /* ->JSSP_ARRAY */
-              jssp_release_node(parser);
-              jssp_alloc_node(parser, buf, buf_size, JSSP_ARRAY_OPEN);
+              if (parser->options & JSSP_OPTION_PATH)
+                jssp_push_path_key(parser, buf, buf_size);
+              jssp_replace_node(parser, buf, JSSP_ARRAY_OPEN);
+              jssp_check_depth(parser);
               jssp_do_callback(parser, buf, cb, cls);
               parser->key = NULL;
               parser->key_len = 0;
               parser->js_offset++;
               continue;
             case '{': /* ->JSSP_OBJECT */
-              jssp_release_node(parser);
-              jssp_alloc_node(parser, buf, buf_size, JSSP_OBJECT_OPEN);
+              if (parser->options & JSSP_OPTION_PATH)
+                jssp_push_path_key(parser, buf, buf_size);
+              jssp_replace_node(parser, buf, JSSP_OBJECT_OPEN);
+              jssp_check_depth(parser);
               jssp_do_callback(parser, buf, cb, cls);
               parser->key = NULL;
               parser->key_len = 0;
@@ -931,8 +1685,9 @@ jssp_parse (jssp_parser *parser,
               break;
 #endif
             }
-          jssp_release_node(parser);
-          jssp_alloc_node(parser, buf, buf_size, JSSP_OBJECT_VAL);
+          if (parser->options & JSSP_OPTION_PATH)
+            jssp_push_path_key(parser, buf, buf_size);
+          jssp_replace_node(parser, buf, JSSP_OBJECT_VAL);
           /* no break */
         case JSSP_OBJECT_VAL:
           /*==================================================================*/
@@ -953,6 +1708,7 @@ jssp_parse (jssp_parser *parser,
             {
             case JSSP_ERROR_BROKEN:
               /*++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++++*/
+              jssp_check_literal(parser, 0);
               if (parser->start != NULL)
                 jssp_do_callback(parser, buf, cb, cls);
 
@@ -961,8 +1717,8 @@ jssp_parse (jssp_parser *parser,
                   (int )parser->key_len,
                   parser->key);
               /* set the data point to the key segment if it is not set before */
-              if (parser->key
-                != buf + sizeof(jsspnode_t) * (parser->node + 1))
+              if (parser->key < (char *) buf
+                || parser->key >= (char *) buf + buf_size)
                 {
                   parser->start = parser->key;
                   parser->len = parser->key_len;
@@ -985,6 +1741,7 @@ jssp_parse (jssp_parser *parser,
                   (int )parser->key_len,
                   parser->key);
 
+              jssp_check_literal(parser, 1);
               if (parser->start != NULL)
                 jssp_do_callback(parser, buf, cb, cls);
 
@@ -992,7 +1749,7 @@ jssp_parse (jssp_parser *parser,
               parser->len = 0;
               parser->key = NULL;
               parser->key_len = 0;
-              jssp_release_node(parser);
+              jssp_release_node(parser, buf);
               parser->literal_type = JSSP_PRIMITIVE;
               continue;
             default:
@@ -1008,8 +1765,19 @@ jssp_parse (jssp_parser *parser,
               jssp_get_node(parser->node, buf)->type);
           return JSSP_ERROR_INVAL;
         } /* end of switch (jssp_get_node(parser->node, buf)->type) */
-    } /* end of while (parser->js_offset < len && js[parser->js_offset] != '\0') */
+    } /* end of while (!jssp_end_of_input(js + parser->js_offset, js + len)) */
 
+  /* paused by the input's last event, resuming only finishes the call;
+   * a used up budget needs no yield here */
+  if (JSSP_PAUSED_CALLBACK == parser->paused)
+    {
+      parser->paused = JSSP_PAUSED_STOPPED;
+      return JSSP_PAUSE;
+    }
+
+  /* the rest of an open record is hashed before the caller drops js */
+  if ((parser->guards & JSSP_GUARD_FINGERPRINT) && parser->node > 0)
+    jssp_fingerprint_to(parser, js, parser->js_offset);
   parser->stream_offset += parser->js_offset;
   if (JSSP_SUCCESS != parser->last_err)
     return parser->last_err;
@@ -1019,6 +1787,45 @@ jssp_parse (jssp_parser *parser,
 
   return JSSP_ERROR_PART;
 }
+jssperr_t
+jssp_parse_chunk (jssp_parser *parser,
+                  const char *js,
+                  size_t len,
+                  void *buf,
+                  size_t buf_size,
+                  size_t max_key_len,
+                  jssp_process_callback cb,
+                  void *cls)
+{
+  jssperr_t err;
+
+  /* a paused call resumes within the same chunk */
+  if (JSSP_PAUSED_STOPPED != parser->paused)
+    {
+      parser->js_offset = 0;
+      if (parser->guards & JSSP_GUARD_FINGERPRINT)
+        parser->fingerprint->from = 0;
+    }
+  err = jssp_parse (parser, js, len, buf, buf_size, max_key_len, cb, cls);
+  if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err)
+    return err;
+
+  /* The caller may drop js now. A key read in this chunk whose value is
+   * still to come is moved into the key arena; between the key and ':'
+   * the arena sits one level higher, above the coming comma node. */
+  buf = parser->buf;
+  buf_size = parser->arena_size;
+  if (NULL != parser->key
+    && (parser->key < (char *) buf || parser->key >= (char *) buf + buf_size))
+    {
+      if (JSSP_OBJECT_OPEN == jssp_get_node(parser->node, buf)->type)
+        jssp_save_key_at(buf, buf_size, parser, max_key_len, parser->node + 1);
+      else
+        jssp_save_key(buf, buf_size, parser, max_key_len);
+    }
+  return err;
+}
+
 /**
  * Creates a new parser based over a given  buffer with an array of tokens
  * available.
@@ -1033,6 +1840,596 @@ jssp_init (jssp_parser *parser)
   parser->key = NULL;
   parser->key_len = 0;
   parser->node = SIZE_MAX;
+  parser->literal_type = JSSP_PRIMITIVE;
   parser->last_err = JSSP_SUCCESS;
+  parser->paused = 0;
+  parser->guards = 0;
+  parser->budget = NULL;
+  parser->limits = NULL;
   parser->reg[0] = 0;
+  parser->allocator = NULL;
+  parser->heap = NULL;
+  parser->heap_size = 0;
+  parser->options = 0;
+  parser->arena = 0;
+  parser->arena_size = 0;
+  parser->buf = NULL;
+  parser->bulk = NULL;
+  parser->fingerprint = NULL;
+}
+
+void
+jssp_set_options (jssp_parser *parser,
+                  unsigned int options)
+{
+  parser->options = options;
+}
+
+void
+jssp_set_budget (jssp_parser *parser,
+                 jssp_budget *budget)
+{
+  parser->budget = budget;
+  jssp_set_guard(parser, JSSP_GUARD_BUDGET, NULL != budget);
+}
+
+void
+jssp_set_limits (jssp_parser *parser,
+                 jssp_limits *limits)
+{
+  parser->limits = limits;
+  jssp_set_guard(parser, JSSP_GUARD_LIMITS, NULL != limits);
+  if (NULL != limits)
+    {
+      limits->tokens = 0;
+      limits->literal_size = 0;
+      limits->literal_word = 0;
+      limits->limit = JSSP_LIMIT_NONE;
+      limits->limit_offset = 0;
+    }
+}
+
+void
+jssp_set_fingerprint (jssp_parser *parser,
+                      jssp_fingerprint *f)
+{
+  parser->fingerprint = f;
+  jssp_set_guard(parser, JSSP_GUARD_FINGERPRINT, NULL != f);
+  if (NULL != f)
+    f->from = parser->js_offset;
+}
+
+jssperr_t
+jssp_bulk_numbers (jssp_parser *parser,
+                   jssp_bulk *bulk,
+                   jsspbulktype_t type,
+                   void *out,
+                   size_t cap)
+{
+  if (NULL == parser->buf || SIZE_MAX == parser->node
+    || JSSP_ARRAY_OPEN != jssp_get_node(parser->node, parser->buf)->type)
+    return JSSP_ERROR_INVAL;
+  bulk->out = out;
+  bulk->cap = cap;
+  bulk->len = 0;
+  bulk->node = parser->node;
+  bulk->depth = 0;
+  bulk->type = type;
+  bulk->state = JSSP_BULK_OPENED;
+  bulk->carry_len = 0;
+  parser->bulk = bulk;
+  jssp_set_guard(parser, JSSP_GUARD_BULK, 1);
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_get_path (const jssp_parser *parser,
+               jssppath_t *path)
+{
+  if (!(parser->options & JSSP_OPTION_PATH) || NULL == parser->buf
+    || SIZE_MAX == parser->node)
+    return JSSP_ERROR_INVAL;
+  path->nodes = (const jsspnode_t *) parser->buf;
+  path->keys = (const char *) parser->buf + parser->arena_size;
+  path->depth = parser->node;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_set_allocator (jssp_parser *parser,
+                    const jssp_allocator *allocator)
+{
+  /* the heap goes back to the allocator it came from */
+  if (NULL != parser->heap && allocator != parser->allocator)
+    {
+      jssp_debug("Allocator swapped while the parser owns a heap.");
+      return JSSP_ERROR_INVAL;
+    }
+  parser->allocator = allocator;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_release (jssp_parser *parser)
+{
+  if (NULL != parser->heap)
+    parser->allocator->free (parser->allocator->cls, parser->heap);
+  parser->heap = NULL;
+  parser->heap_size = 0;
+}
+
+void
+jssp_inline_init (jssp_inline_parser *parser,
+                  const jssp_allocator *allocator)
+{
+  jssp_init (&parser->parser);
+  jssp_set_allocator (&parser->parser, allocator);
+}
+
+jssperr_t
+jssp_inline_parse (jssp_inline_parser *parser,
+                   const char *js,
+                   size_t len,
+                   size_t max_key_len,
+                   jssp_process_callback cb,
+                   void *cls)
+{
+  return jssp_parse (&parser->parser,
+                     js,
+                     len,
+                     parser->inline_buf,
+                     sizeof(parser->inline_buf),
+                     max_key_len,
+                     cb,
+                     cls);
+}
+
+/* Skip whitespace eight bytes per step, returns the first other byte */
+static const char *
+jssp_validate_ws (const char *pos,
+                  const char *end)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t w, m;
+
+  /* minified input has no whitespace at all */
+  if (pos < end && (unsigned char) *pos > ' ')
+    return pos;
+  while (pos + 8 <= end)
+    {
+      memcpy (&w, pos, 8);
+      m = ~(jssp_iszero(w ^ (JSSP_ONES * ' '))
+          | jssp_iszero(w ^ (JSSP_ONES * '\n'))
+          | jssp_iszero(w ^ (JSSP_ONES * '\r'))
+          | jssp_iszero(w ^ (JSSP_ONES * '\t'))) & JSSP_HIGHS;
+      if (0 != m)
+        return pos + __builtin_ctzll (m) / 8;
+      pos += 8;
+    }
+#endif
+  while (pos < end && (*pos == ' ' || *pos == '\n' || *pos == '\r' || *pos == '\t'))
+    pos++;
+  return pos;
+}
+
+/* Validate a string body after the opening quote. Returns the position
+ * after the closing quote, NULL with *pos at the error otherwise. */
+static const char *
+jssp_validate_string (const char **pos,
+                      const char *end)
+{
+  const unsigned char *p = (const unsigned char *) *pos;
+  const unsigned char *e = (const unsigned char *) end;
+  unsigned char c;
+  int i, n;
+
+  for (;;)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint64_t w, m;
+
+      while (p + 8 <= e)
+        {
+          memcpy (&w, p, 8);
+          m = jssp_hasless(w, 0x20)
+            | jssp_haszero(w ^ (JSSP_ONES * '"'))
+            | jssp_haszero(w ^ (JSSP_ONES * '\\'))
+            | (w & JSSP_HIGHS);
+          if (0 != m)
+            {
+              p += __builtin_ctzll (m) / 8;
+              break;
+            }
+          p += 8;
+        }
+#endif
+      if (p >= e)
+        goto part;
+      c = *p;
+      if (c == '"')
+        return (const char *) p + 1;
+      if (c < 0x20)
+        goto inval;
+      if (c == '\\')
+        {
+          if (p + 1 >= e)
+            goto part;
+          switch (p[1])
+            {
+            case '"': case '\\': case '/': case 'b':
+            case 'f': case 'n': case 'r': case 't':
+              p += 2;
+              continue;
+            case 'u':
+              for (i = 2; i < 6; i++)
+                {
+                  if (p + i >= e)
+                    goto part;
+                  if (!jssp_valid_word(p[i]))
+                    {
+                      p += i;
+                      goto inval;
+                    }
+                }
+              p += 6;
+              continue;
+            default:
+              p++;
+              goto inval;
+            }
+        }
+      if (c < 0x80)
+        {
+          p++;
+          continue;
+        }
+      /* UTF-8: no overlong forms, no surrogates, nothing above U+10FFFF */
+      if (c >= 0xC2 && c <= 0xDF)
+        n = 1;
+      else if (c >= 0xE0 && c <= 0xEF)
+        n = 2;
+      else if (c >= 0xF0 && c <= 0xF4)
+        n = 3;
+      else
+        goto inval;
+      if (p + n >= e)
+        goto part;
+      if ((c == 0xE0 && p[1] < 0xA0) || (c == 0xED && p[1] > 0x9F)
+        || (c == 0xF0 && p[1] < 0x90) || (c == 0xF4 && p[1] > 0x8F))
+        {
+          p++;
+          goto inval;
+        }
+      for (i = 1; i <= n; i++)
+        if (!jssp_valid_utf8data(p[i]))
+          {
+            p += i;
+            goto inval;
+          }
+      p += n + 1;
+    }
+
+part:
+  *pos = (const char *) e;
+  return NULL;
+inval:
+  *pos = (const char *) p;
+  return NULL;
+}
+
+#define jssp_bitstack_push(s, d, bit) do { \
+  if ((d) >= JSSP_VALIDATE_DEPTH) \
+    { \
+      err = JSSP_ERROR_NOMEM; \
+      goto done; \
+    } \
+  if (bit) \
+    (s)[(d) / 64] |= (uint64_t) 1 << ((d) % 64); \
+  else \
+    (s)[(d) / 64] &= ~((uint64_t) 1 << ((d) % 64)); \
+  (d)++; \
+} while (0)
+
+#define jssp_bitstack_top(s, d) (((s)[((d) - 1) / 64] >> (((d) - 1) % 64)) & 1)
+
+jssperr_t
+jssp_validate (const char *js,
+               size_t len,
+               size_t *err_offset)
+{
+  uint64_t stack[(JSSP_VALIDATE_DEPTH + 63) / 64]; /* 1: object, 0: array */
+  const char *pos = js, *end = js + len, *t;
+  size_t depth = 0;
+  jssperr_t err = JSSP_SUCCESS;
+
+  if (len >= 3 && memcmp (js, utf8_bom, 3) == 0)
+    pos += 3;
+
+  for (;;)
+    {
+      pos = jssp_validate_ws (pos, end);
+      if (pos >= end)
+        break;
+
+      value:
+      switch (*pos)
+        {
+        case '{':
+          jssp_bitstack_push(stack, depth, 1);
+          pos = jssp_validate_ws (pos + 1, end);
+          if (pos < end && *pos == '}')
+            {
+              depth--;
+              pos++;
+              goto after;
+            }
+          goto key;
+        case '[':
+          jssp_bitstack_push(stack, depth, 0);
+          pos = jssp_validate_ws (pos + 1, end);
+          if (pos < end && *pos == ']')
+            {
+              depth--;
+              pos++;
+              goto after;
+            }
+          if (pos >= end)
+            goto part;
+          goto value;
+        case '"':
+          pos++;
+          t = jssp_validate_string (&pos, end);
+          if (NULL == t)
+            goto string_error;
+          pos = t;
+          goto after;
+        case 't':
+          t = "true";
+          goto word;
+        case 'f':
+          t = "false";
+          goto word;
+        case 'n':
+          t = "null";
+          word:
+          for (; *t != '\0'; t++, pos++)
+            {
+              if (pos >= end)
+                goto part;
+              if (*pos != *t)
+                goto inval;
+            }
+          goto after;
+        case '-':
+        case '0': case '1': case '2': case '3': case '4':
+        case '5': case '6': case '7': case '8': case '9':
+          if (*pos == '-' && ++pos >= end)
+            goto part;
+          if (*pos == '0')
+            pos++;
+          else if (*pos >= '1' && *pos <= '9')
+            while (pos < end && *pos >= '0' && *pos <= '9')
+              pos++;
+          else
+            goto inval;
+          if (pos < end && *pos == '.')
+            {
+              if (++pos >= end)
+                goto part;
+              if (*pos < '0' || *pos > '9')
+                goto inval;
+              while (pos < end && *pos >= '0' && *pos <= '9')
+                pos++;
+            }
+          if (pos < end && (*pos == 'e' || *pos == 'E'))
+            {
+              if (++pos < end && (*pos == '+' || *pos == '-'))
+                pos++;
+              if (pos >= end)
+                goto part;
+              if (*pos < '0' || *pos > '9')
+                goto inval;
+              while (pos < end && *pos >= '0' && *pos <= '9')
+                pos++;
+            }
+          goto after;
+        default:
+          goto inval;
+        }
+
+      after:
+      if (0 == depth)
+        {
+          /* top level values need whitespace between them */
+          if (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\n' && *pos != '\r')
+            goto inval;
+          continue;
+        }
+      pos = jssp_validate_ws (pos, end);
+      if (pos >= end)
+        goto part;
+      switch (*pos)
+        {
+        case ',':
+          pos = jssp_validate_ws (pos + 1, end);
+          if (pos >= end)
+            goto part;
+          if (jssp_bitstack_top(stack, depth))
+            goto key;
+          goto value;
+        case ']':
+          if (jssp_bitstack_top(stack, depth))
+            goto inval;
+          depth--;
+          pos++;
+          goto after;
+        case '}':
+          if (!jssp_bitstack_top(stack, depth))
+            goto inval;
+          depth--;
+          pos++;
+          goto after;
+        default:
+          goto inval;
+        }
+
+      key:
+      if (pos >= end)
+        goto part;
+      if (*pos != '"')
+        goto inval;
+      pos++;
+      t = jssp_validate_string (&pos, end);
+      if (NULL == t)
+        goto string_error;
+      pos = jssp_validate_ws (t, end);
+      if (pos >= end)
+        goto part;
+      if (*pos != ':')
+        goto inval;
+      pos = jssp_validate_ws (pos + 1, end);
+      if (pos >= end)
+        goto part;
+      goto value;
+    }
+
+  if (0 != depth)
+    goto part;
+  goto done;
+
+string_error:
+  if (pos < end)
+    goto inval;
+part:
+  err = JSSP_ERROR_PART;
+  goto done;
+inval:
+  err = JSSP_ERROR_INVAL;
+done:
+  if (NULL != err_offset)
+    *err_offset = pos - js;
+  return err;
+}
+
+/* Four hex digits at p */
+static int
+jssp_hex4 (const char *p,
+           const char *end,
+           uint32_t *cp)
+{
+  int i;
+
+  if (end - p < 4)
+    return 0;
+  for (*cp = 0, i = 0; i < 4; i++)
+    {
+      *cp <<= 4;
+      if (p[i] >= '0' && p[i] <= '9')
+        *cp |= p[i] - '0';
+      else if ((p[i] | 0x20) >= 'a' && (p[i] | 0x20) <= 'f')
+        *cp |= (p[i] | 0x20) - 'a' + 10;
+      else
+        return 0;
+    }
+  return 1;
+}
+
+size_t
+jssp_unescape_part (char *out,
+                    size_t size,
+                    const char **s,
+                    const char *end)
+{
+  const char *p = *s, *bs, *next;
+  unsigned char *o = (unsigned char *) out;
+  uint32_t cp, lo;
+  size_t n = 0, k;
+
+  while (p < end && n < size)
+    {
+      bs = memchr (p, '\\', end - p);
+      if (NULL == bs)
+        bs = end;
+      if ((size_t) (bs - p) > size - n)
+        bs = p + (size - n);
+      if (NULL != o)
+        memcpy (o + n, p, bs - p);
+      n += bs - p;
+      p = bs;
+      if (p >= end || n == size)
+        break;
+      if (p + 1 >= end)
+        {
+          /* a trailing backslash is dropped */
+          p = end;
+          break;
+        }
+      next = p + 2;
+      switch (p[1])
+        {
+        case 'b': cp = '\b'; break;
+        case 'f': cp = '\f'; break;
+        case 'n': cp = '\n'; break;
+        case 'r': cp = '\r'; break;
+        case 't': cp = '\t'; break;
+        case 'u':
+          /* a broken escape keeps its u, so out never outgrows s */
+          if (!jssp_hex4 (next, end, &cp))
+            {
+              cp = 'u';
+              break;
+            }
+          next += 4;
+          if (cp >= 0xD800 && cp < 0xDC00 && end - next >= 6 && next[0] == '\\' && next[1] == 'u'
+            && jssp_hex4 (next + 2, end, &lo) && lo >= 0xDC00 && lo < 0xE000)
+            {
+              cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+              next += 6;
+            }
+          else if (cp >= 0xD800 && cp < 0xE000)
+            cp = 0xFFFD;
+          break;
+        default:
+          /* \" \\ \/ */
+          cp = (unsigned char) p[1];
+          break;
+        }
+      k = cp < 0x80 ? 1 : cp < 0x800 ? 2 : cp < 0x10000 ? 3 : 4;
+      if (k > size - n)
+        break;
+      if (NULL != o)
+        switch (k)
+          {
+          case 1:
+            o[n] = (unsigned char) cp;
+            break;
+          case 2:
+            o[n] = 0xC0 | cp >> 6;
+            o[n + 1] = 0x80 | (cp & 0x3F);
+            break;
+          case 3:
+            o[n] = 0xE0 | cp >> 12;
+            o[n + 1] = 0x80 | (cp >> 6 & 0x3F);
+            o[n + 2] = 0x80 | (cp & 0x3F);
+            break;
+          default:
+            o[n] = 0xF0 | cp >> 18;
+            o[n + 1] = 0x80 | (cp >> 12 & 0x3F);
+            o[n + 2] = 0x80 | (cp >> 6 & 0x3F);
+            o[n + 3] = 0x80 | (cp & 0x3F);
+            break;
+          }
+      n += k;
+      p = next;
+    }
+  *s = p;
+  return n;
+}
+
+size_t
+jssp_unescape (char *out,
+               const char *s,
+               size_t len)
+{
+  return jssp_unescape_part (out, SIZE_MAX, &s, s + len);
 }
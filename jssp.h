@@ -5,6 +5,15 @@
 #include <stdint.h>
 
 
+/*
+ * Build options:
+ *   JSSP_STRICT    reject primitives not followed by ',', '}' or ']'
+ *   JSSP_BOUNDED   only len ends the input; a NUL byte is invalid JSON
+ *                  instead of an end marker, so binary input is safe
+ *   JSSP_PADDING   n >= 8 readable bytes follow js + len in every call,
+ *                  letting word-wise scans skip their scalar tail
+ */
+
 #ifdef __cplusplus
 extern "C"
 {
@@ -46,34 +55,292 @@ extern "C"
     JSSP_ERROR_INVAL,
     /* The string is not a full JSON packet, more bytes expected */
     JSSP_ERROR_PART,
-    JSSP_ERROR_BROKEN
+    JSSP_ERROR_BROKEN,
+    /* Returned by a callback: stop after this event, resumable */
+    JSSP_PAUSE,
+    /* The call used up its budget, see jssp_set_budget; resumable */
+    JSSP_YIELD,
+    /* The input broke a limit, see jssp_set_limits */
+    JSSP_ERROR_LIMIT
   } jssperr_t;
 
-  /* The node type includes JSSP_ARRAY, JSSP_OBJECT, JSSP_OBJECT_KEY_INC, and JSSP_OBJECT_KEY*/
+  typedef enum
+  {
+    /* Keep the key of every open level, see jssp_get_path */
+    JSSP_OPTION_PATH = 0x01
+  } jsspoption_t;
+
+  /* Upper bound of the path key stack, it shares a word with the type */
+#define JSSP_MAX_PATH_KEYS ((1U << 29) - 1)
+
+  /* The node type includes JSSP_ARRAY, JSSP_OBJECT, JSSP_OBJECT_KEY_INC, and JSSP_OBJECT_KEY.
+   * Packed to 8 bytes per level, the element counter wraps at 2^32. */
   typedef struct
   {
-    jssptype_t type;
-    size_t size;
+    uint32_t type : 3; /* jssptype_t */
+    uint32_t key_end : 29; /* path key stack cursor after this level's key */
+    uint32_t size;
   } jsspnode_t;
 
+  /**
+   * View of the path from the root to the current event. Level 1 is the
+   * top level value, level depth is the current one. Keys are raw (still
+   * escaped) bytes and are empty for array elements. The view is valid
+   * until the callback returns.
+   */
+  typedef struct
+  {
+    const jsspnode_t *nodes;
+    const char *keys; /* end of the key stack */
+    size_t depth;
+  } jssppath_t;
+
+/* Key of the value at level d, its length, and its index in the parent */
+#define jssp_path_key(path, d) ((path)->keys - (path)->nodes[(d)].key_end)
+#define jssp_path_key_len(path, d) \
+  ((size_t) ((path)->nodes[(d)].key_end - (path)->nodes[(d) - 1].key_end))
+#define jssp_path_index(path, d) ((path)->nodes[(d) - 1].size)
+
+  /**
+   * Allocator hooks used to grow the node/key buffer on demand. realloc is
+   * called with ptr NULL to allocate a fresh block. max_size is the ceiling
+   * the buffer may grow to, 0 means no ceiling.
+   */
+  typedef struct
+  {
+    void *
+    (*realloc) (void *cls, void *ptr, size_t size);
+    void
+    (*free) (void *cls, void *ptr);
+    void *cls;
+    size_t max_size;
+  } jssp_allocator;
+
+  /* malloc/realloc/free from libc, without ceiling */
+  extern const jssp_allocator jssp_default_allocator;
+
+  /**
+   * Streaming 64 bit hash, XXH64. Not for untrusted keys of hash tables
+   * an attacker may flood.
+   */
+  typedef struct
+  {
+    uint64_t v[4];
+    uint64_t seed;
+    uint64_t total;
+    unsigned char mem[32]; /* tail short of a stripe */
+    uint32_t mem_len;
+  } jssp_hash;
+
+  void
+  jssp_hash_init (jssp_hash *h,
+                  uint64_t seed);
+
+  void
+  jssp_hash_update (jssp_hash *h,
+                    const void *data,
+                    size_t len);
+
+  uint64_t
+  jssp_hash_digest (const jssp_hash *h);
+
+  typedef enum
+  {
+    /* every byte of the record */
+    JSSP_FINGERPRINT_RAW = 0,
+    /* whitespace between tokens left out, strings kept as written */
+    JSSP_FINGERPRINT_TOKENS = 1
+  } jsspfingerprint_t;
+
+  /**
+   * Fingerprint of a top level record, kept by the parser while it scans,
+   * see jssp_set_fingerprint. start and end are stream offsets, end one
+   * past the record's last byte.
+   */
+  typedef struct
+  {
+    jssp_hash hash;
+    uint64_t seed;
+    uint64_t start;
+    uint64_t end;
+    uint64_t digest; /* valid in the record's closing callback */
+    uint8_t mode; /* jsspfingerprint_t */
+    uint8_t in_string;
+    uint8_t escape;
+    size_t from; /* first byte of the parser's input not hashed yet */
+  } jssp_fingerprint;
+
+  void
+  jssp_fingerprint_init (jssp_fingerprint *f,
+                         jsspfingerprint_t mode,
+                         uint64_t seed);
+
+  /* Start a record at the given stream offset */
+  void
+  jssp_fingerprint_begin (jssp_fingerprint *f,
+                          uint64_t offset);
+
+  void
+  jssp_fingerprint_update (jssp_fingerprint *f,
+                           const char *data,
+                           size_t len);
+
+  void
+  jssp_fingerprint_end (jssp_fingerprint *f);
+
+  typedef enum
+  {
+    JSSP_LIMIT_NONE = 0,
+    JSSP_LIMIT_DEPTH = 1,
+    JSSP_LIMIT_STRING = 2,
+    JSSP_LIMIT_NUMBER = 3,
+    JSSP_LIMIT_TOKENS = 4,
+    JSSP_LIMIT_ELEMENTS = 5
+  } jssplimit_t;
+
+  /**
+   * Hard limits for untrusted input, 0 for none. A top level container is
+   * at depth 1. Strings, keys included, and numbers are counted in bytes
+   * as passed to the callback; true, false and null are not limited.
+   * Tokens are the keys and values of one top level value, elements the
+   * values of one array or object. The parser keeps its counters in the
+   * struct, so each parser needs its own.
+   */
+  typedef struct
+  {
+    size_t max_depth;
+    size_t max_string;
+    size_t max_number;
+    uint64_t max_tokens;
+    size_t max_elements;
+    /* kept by the parser */
+    uint64_t tokens; /* of the current top level value */
+    size_t literal_size; /* bytes of the literal's earlier fragments */
+    uint8_t literal_word; /* the primitive is true, false or null */
+    uint8_t limit; /* jssplimit_t hit */
+    uint64_t limit_offset; /* stream offset JSSP_ERROR_LIMIT was hit at */
+  } jssp_limits;
+
+  /**
+   * Work bound of each jssp_parse call, 0 for none, see jssp_set_budget.
+   */
+  typedef struct
+  {
+    size_t max_bytes;
+    size_t max_events;
+    /* kept by the parser */
+    size_t quantum_end; /* js_offset the running call yields at */
+    size_t events_left;
+  } jssp_budget;
+
+  /* Longest number text, in bytes, that the bulk decoder, the encoder and
+   * the columnizer convert; longer ones are JSSP_ERROR_INVAL. At most 255,
+   * and every translation unit must see the same value. */
+#ifndef JSSP_NUMBER_SIZE
+#define JSSP_NUMBER_SIZE 128
+#endif
+
+  typedef enum
+  {
+    JSSP_BULK_DOUBLE = 0, /* double[] */
+    JSSP_BULK_INT64 = 1 /* int64_t[], integers only */
+  } jsspbulktype_t;
+
+  /**
+   * Numeric array decoded without events, see jssp_bulk_numbers.
+   */
+  typedef struct
+  {
+    void *out;
+    size_t cap;
+    size_t len; /* numbers stored */
+    size_t node;
+    size_t depth; /* nested arrays open inside it */
+    uint8_t type; /* jsspbulktype_t */
+    uint8_t state;
+    uint8_t carry_len;
+    char carry[JSSP_NUMBER_SIZE]; /* number cut by the end of the input */
+  } jssp_bulk;
+
   /**
    * JSON parser. Contains an array of token blocks available. Also stores
    * the string being parsed now and current position in that string
    */
   typedef struct
   {
+    /* state touched for every token, kept within one cache line */
     size_t js_offset;
     size_t node; /* current working node offset in buffer */
     const char *key;
     size_t key_len;
     const char *start; /* start point of string/primitive in buffer */
     size_t len;
-    jsspliteral_t literal_type;
     char reg[8]; /* store the partial escaped string */
-    jssperr_t last_err;
+    uint32_t arena; /* bytes used by the path key stack at the buffer tail */
+    uint8_t literal_type; /* jsspliteral_t */
+    uint8_t last_err; /* jssperr_t */
+    uint8_t paused; /* JSSP_PAUSED_* state, see jssp.c */
+    uint8_t guards; /* JSSP_GUARD_* features in use, see jssp.c */
+    /* cold state */
+    unsigned int options;
     uint64_t stream_offset;
+    const jssp_allocator *allocator;
+    void *heap; /* parser owned buffer once grown beyond the caller's one */
+    size_t heap_size;
+    size_t arena_size; /* buffer size the key stack was laid out for */
+    void *buf; /* buffer of the running jssp_parse call */
+    /* caller owned feature state, NULL when unused */
+    jssp_bulk *bulk; /* open until its array closes */
+    jssp_fingerprint *fingerprint;
+    jssp_budget *budget;
+    jssp_limits *limits;
   } jssp_parser;
 
+  /* Bytes of node/key buffer embedded in a jssp_inline_parser. The default
+   * holds four levels with path keys and a 48 byte key. Every translation
+   * unit must see the same value. */
+#ifndef JSSP_INLINE_SIZE
+#define JSSP_INLINE_SIZE 96
+#endif
+
+  /**
+   * Parser carrying its own small node/key buffer, so shallow documents
+   * need no buffer from the caller. It spills to the allocator once the
+   * inline buffer is exceeded.
+   */
+  typedef struct
+  {
+    jssp_parser parser;
+    jsspnode_t inline_buf[JSSP_INLINE_SIZE / sizeof(jsspnode_t)];
+  } jssp_inline_parser;
+
+  typedef enum
+  {
+    JSSP_ENCODING_AUTO = 0,
+    JSSP_ENCODING_UTF8 = 1,
+    JSSP_ENCODING_UTF16LE = 2,
+    JSSP_ENCODING_UTF16BE = 3,
+    JSSP_ENCODING_UTF32LE = 4,
+    JSSP_ENCODING_UTF32BE = 5
+  } jsspencoding_t;
+
+  /* Bytes of UTF-8 produced per jssp_parse call by jssp_parse_encoded */
+#ifndef JSSP_TRANSCODE_BLOCK
+#define JSSP_TRANSCODE_BLOCK 4096
+#endif
+
+  /**
+   * UTF-16/UTF-32 to UTF-8 transcoder. Carries a code unit or a surrogate
+   * pair split across chunks.
+   */
+  typedef struct
+  {
+    jsspencoding_t encoding;
+    uint32_t surrogate; /* high surrogate waiting for its pair */
+    unsigned char unit[4]; /* bytes of a split code unit */
+    uint8_t unit_len;
+  } jssp_transcoder;
+
   typedef int
   (*jssp_process_callback) (void *cls,
                             jssptype_t type,
@@ -86,14 +353,101 @@ extern "C"
                             uint64_t stream_offset);
 
   /**
-   * Initial a JSON parser
+   * Initial a JSON parser. A parser that grew a heap must be released
+   * with jssp_release first, its heap would leak otherwise.
    */
   void
   jssp_init (jssp_parser *parser);
 
+  /**
+   * Let the parser grow its node/key buffer with the given allocator
+   * instead of failing with JSSP_ERROR_NOMEM. The caller's buffer is used
+   * until it is exhausted, so a small one avoids allocation for shallow
+   * documents. Pass NULL to restore the fixed buffer behaviour. Returns
+   * JSSP_ERROR_INVAL while the parser owns a heap from another allocator,
+   * call jssp_release first.
+   */
+  jssperr_t
+  jssp_set_allocator (jssp_parser *parser,
+                      const jssp_allocator *allocator);
+
+  /**
+   * Enable jsspoption_t flags. Call before the first jssp_parse.
+   */
+  void
+  jssp_set_options (jssp_parser *parser,
+                    unsigned int options);
+
+  /**
+   * Called from the JSSP_ARRAY_OPEN callback: decode the array's numbers
+   * straight into out, up to cap of them, without an event per element.
+   * Nested arrays are flattened in order, e.g. GeoJSON coordinates. The
+   * JSSP_ARRAY_CLOSE callback follows as usual and jssp_bulk_count gives
+   * the numbers stored. Anything else in the array is JSSP_ERROR_INVAL,
+   * more than cap numbers JSSP_ERROR_NOMEM. bulk holds the decoder's
+   * state until then.
+   */
+  jssperr_t
+  jssp_bulk_numbers (jssp_parser *parser,
+                     jssp_bulk *bulk,
+                     jsspbulktype_t type,
+                     void *out,
+                     size_t cap);
+
+#define jssp_bulk_count(bulk) ((bulk)->len)
+
+  /**
+   * Bound the work of each jssp_parse or jssp_parse_chunk call to about
+   * budget->max_bytes of input or budget->max_events callbacks. Numbers
+   * stored by jssp_bulk_numbers count as events. A call over budget
+   * returns JSSP_YIELD between two tokens; calling again with the same
+   * input resumes, as after JSSP_PAUSE. budget must outlive the parser,
+   * NULL removes it.
+   */
+  void
+  jssp_set_budget (jssp_parser *parser,
+                   jssp_budget *budget);
+
+  /**
+   * Fail with JSSP_ERROR_LIMIT, before the callback sees the offending
+   * token, once the input breaks one of limits; limits->limit and
+   * limits->limit_offset tell which one and where. limits must outlive
+   * the parser, NULL removes them.
+   */
+  void
+  jssp_set_limits (jssp_parser *parser,
+                   jssp_limits *limits);
+
+  /**
+   * Hash each top level record into f while parsing. When a record
+   * closes, f holds its digest and byte range during the closing
+   * callback: JSSP_ARRAY_CLOSE or JSSP_OBJECT_CLOSE at depth 1, or the
+   * last JSSP_ARRAY_VAL fragment of a scalar record. NULL turns it off.
+   */
+  void
+  jssp_set_fingerprint (jssp_parser *parser,
+                        jssp_fingerprint *f);
+
+  /**
+   * Fill a view of the current path. Only valid inside a callback of a
+   * parser with JSSP_OPTION_PATH, returns JSSP_ERROR_INVAL otherwise.
+   */
+  jssperr_t
+  jssp_get_path (const jssp_parser *parser,
+                 jssppath_t *path);
+
+  /**
+   * Release the buffer the parser allocated for itself, if any.
+   */
+  void
+  jssp_release (jssp_parser *parser);
+
   /**
    * Run JSON parser. It parses a JSON data string sequence json objects,
-   * and make callback.
+   * and make callback. Once the parser grew its own buffer, buf and
+   * buf_size are ignored. A callback returning JSSP_PAUSE makes the call
+   * return JSSP_PAUSE right after that event, calling again with the same
+   * js resumes; any other non-zero return terminates the parser.
    */
   jssperr_t
   jssp_parse (jssp_parser *parser,
@@ -105,6 +459,1136 @@ extern "C"
               jssp_process_callback,
               void *cls);
 
+  /**
+   * Run JSON parser on the next chunk of a stream. Where jssp_parse takes
+   * js as all text received so far, here js holds only the new bytes and
+   * may be reused by the caller once the call returns; partial literals
+   * and keys are carried over by the parser. To retry a chunk after
+   * JSSP_ERROR_NOMEM call jssp_parse with the same chunk instead. After
+   * JSSP_PAUSE or JSSP_YIELD the chunk is still in use, pass it again to
+   * resume.
+   */
+  jssperr_t
+  jssp_parse_chunk (jssp_parser *parser,
+                    const char *js,
+                    size_t len,
+                    void *buf,
+                    size_t buf_size,
+                    size_t max_buffered_key_size,
+                    jssp_process_callback,
+                    void *cls);
+
+  /* Deepest nesting jssp_validate accepts, one bit of stack per level */
+#ifndef JSSP_VALIDATE_DEPTH
+#define JSSP_VALIDATE_DEPTH 1024
+#endif
+
+  /**
+   * Check that js holds well-formed JSON without any callback. The strict
+   * RFC 8259 grammar is applied, including UTF-8 validation of strings;
+   * several whitespace separated top level values are allowed, so NDJSON
+   * validates too. Returns JSSP_SUCCESS, JSSP_ERROR_INVAL, JSSP_ERROR_PART
+   * for truncated input or JSSP_ERROR_NOMEM when nested deeper than
+   * JSSP_VALIDATE_DEPTH. err_offset (may be NULL) is set to the offset of
+   * the offending byte.
+   */
+  jssperr_t
+  jssp_validate (const char *js,
+                 size_t len,
+                 size_t *err_offset);
+
+  /**
+   * Initial a parser with an inline buffer. allocator may be NULL, then
+   * documents exceeding the inline buffer fail with JSSP_ERROR_NOMEM.
+   */
+  void
+  jssp_inline_init (jssp_inline_parser *parser,
+                    const jssp_allocator *allocator);
+
+  /**
+   * jssp_parse using the inline buffer, see jssp_parse.
+   */
+  jssperr_t
+  jssp_inline_parse (jssp_inline_parser *parser,
+                     const char *js,
+                     size_t len,
+                     size_t max_buffered_key_size,
+                     jssp_process_callback,
+                     void *cls);
+
+  /**
+   * Detect the encoding of a JSON text from its BOM or, without one, from
+   * the NUL pattern of the first four bytes. bom_len (may be NULL) is set
+   * to the length of the BOM found.
+   */
+  jsspencoding_t
+  jssp_detect_encoding (const char *data,
+                        size_t len,
+                        size_t *bom_len);
+
+  /**
+   * Initial a transcoder. JSSP_ENCODING_AUTO detects the encoding from
+   * the first four bytes passed to jssp_parse_encoded, so shorter
+   * documents need an explicit encoding.
+   */
+  void
+  jssp_transcoder_init (jssp_transcoder *t,
+                        jsspencoding_t encoding);
+
+  /**
+   * Transcode *in_len bytes of in to UTF-8. On return *in_len holds the
+   * bytes consumed and *out_len the bytes written. Stops early when out
+   * is full. Unpaired surrogates and invalid code points give
+   * JSSP_ERROR_INVAL.
+   */
+  jssperr_t
+  jssp_transcode (jssp_transcoder *t,
+                  const char *in,
+                  size_t *in_len,
+                  char *out,
+                  size_t *out_len);
+
+  /**
+   * jssp_parse_chunk for UTF-8, UTF-16 or UTF-32 input. Non UTF-8 chunks
+   * are transcoded in JSSP_TRANSCODE_BLOCK sized blocks, so callback data
+   * only lives until the callback returns. JSSP_PAUSE and JSSP_YIELD are
+   * resumable for UTF-8 input only.
+   */
+  jssperr_t
+  jssp_parse_encoded (jssp_parser *parser,
+                      jssp_transcoder *t,
+                      const char *js,
+                      size_t len,
+                      void *buf,
+                      size_t buf_size,
+                      size_t max_buffered_key_size,
+                      jssp_process_callback,
+                      void *cls);
+
+  /**
+   * Decode the escapes of a raw JSON string into out, which needs room
+   * for len bytes; with out NULL only the length is computed. Lone
+   * surrogates become U+FFFD and a \u without four hex digits keeps
+   * its u. Returns the length written, never more than len.
+   */
+  size_t
+  jssp_unescape (char *out,
+                 const char *s,
+                 size_t len);
+
+  /**
+   * Like jssp_unescape, for the bytes from *s to end, but writes at
+   * most size bytes and never splits an escape. *s is moved past what
+   * was decoded. Returns the length written.
+   */
+  size_t
+  jssp_unescape_part (char *out,
+                      size_t size,
+                      const char **s,
+                      const char *end);
+
+  /* Powers of ten a double holds exactly, 1e0 to 1e22 */
+  extern const double jssp_pow10[23];
+
+  /**
+   * Integer of the whole number text s, JSSP_ERROR_INVAL when it is none
+   * or does not fit.
+   */
+  jssperr_t
+  jssp_number_int (const char *s,
+                   size_t len,
+                   int64_t *value);
+
+  /**
+   * Double of the number text s. Up to 18 digits with a power of ten up to
+   * 22 convert exactly without strtod; longer ones must stay below
+   * JSSP_NUMBER_SIZE bytes. JSSP_ERROR_INVAL when s is no number.
+   */
+  jssperr_t
+  jssp_number_double (const char *s,
+                      size_t len,
+                      double *value);
+
+  /* Deepest nesting a jssp_writer accepts, one bit of stack per level */
+#ifndef JSSP_WRITE_DEPTH
+#define JSSP_WRITE_DEPTH 256
+#endif
+
+  /* Receives the writer's buffer when it is full, non-zero aborts */
+  typedef int
+  (*jssp_flush_callback) (void *cls,
+                          const char *data,
+                          size_t len);
+
+  /**
+   * Streaming JSON writer. Output goes to the caller's buffer and is
+   * handed to the flush callback whenever the buffer fills up.
+   */
+  typedef struct
+  {
+    char *buf;
+    size_t size;
+    size_t len; /* bytes pending in buf */
+    jssp_flush_callback flush;
+    void *cls;
+    size_t depth;
+    uint64_t stack[(JSSP_WRITE_DEPTH + 63) / 64]; /* 1: object, 0: array */
+    uint8_t first; /* nothing written yet at this level */
+    uint8_t after_key; /* a key waits for its value */
+    uint8_t in_value; /* jssp_write_event is inside a split value */
+    uint8_t last_err; /* jssperr_t */
+  } jssp_writer;
+
+  /**
+   * Initial a writer on buf. flush may be NULL when the whole document
+   * fits the buffer, a full buffer gives JSSP_ERROR_NOMEM then. Several
+   * top level values are written one per line.
+   */
+  void
+  jssp_writer_init (jssp_writer *w,
+                    char *buf,
+                    size_t size,
+                    jssp_flush_callback flush,
+                    void *cls);
+
+  /**
+   * Hand the pending bytes to the flush callback. Call once done writing;
+   * without a callback the document is left in buf, len bytes of it.
+   */
+  jssperr_t
+  jssp_writer_flush (jssp_writer *w);
+
+  jssperr_t
+  jssp_write_begin_object (jssp_writer *w);
+
+  jssperr_t
+  jssp_write_end_object (jssp_writer *w);
+
+  jssperr_t
+  jssp_write_begin_array (jssp_writer *w);
+
+  jssperr_t
+  jssp_write_end_array (jssp_writer *w);
+
+  /**
+   * Write an object key, escaping it. Keys and values must alternate
+   * inside objects, JSSP_ERROR_INVAL otherwise.
+   */
+  jssperr_t
+  jssp_write_key (jssp_writer *w,
+                  const char *key,
+                  size_t len);
+
+  jssperr_t
+  jssp_write_string (jssp_writer *w,
+                     const char *s,
+                     size_t len);
+
+  /**
+   * Key and string taken as already escaped, e.g. from parser events.
+   */
+  jssperr_t
+  jssp_write_raw_key (jssp_writer *w,
+                      const char *key,
+                      size_t len);
+
+  jssperr_t
+  jssp_write_raw_string (jssp_writer *w,
+                         const char *s,
+                         size_t len);
+
+  /**
+   * Write a value verbatim, e.g. a number or literal from parser events.
+   */
+  jssperr_t
+  jssp_write_raw (jssp_writer *w,
+                  const char *data,
+                  size_t len);
+
+  jssperr_t
+  jssp_write_int (jssp_writer *w,
+                  int64_t value);
+
+  /**
+   * Write a double with the fewest digits that read back to the same
+   * value. NaN and infinity have no JSON form and give JSSP_ERROR_INVAL.
+   */
+  jssperr_t
+  jssp_write_double (jssp_writer *w,
+                     double value);
+
+  jssperr_t
+  jssp_write_bool (jssp_writer *w,
+                   int value);
+
+  jssperr_t
+  jssp_write_null (jssp_writer *w);
+
+  /**
+   * Re-emit a jssp_parse event, called from the parser callback with the
+   * parser itself. Keys, strings and numbers are copied as they were
+   * read, values split across chunks are joined again.
+   */
+  jssperr_t
+  jssp_write_event (jssp_writer *w,
+                    const jssp_parser *parser,
+                    jssptype_t type,
+                    const char *key,
+                    size_t key_len,
+                    const char *data,
+                    size_t data_size);
+
+  typedef enum
+  {
+    JSSP_TRANSFORM_KEEP = 0,
+    JSSP_TRANSFORM_REPLACE = 1,
+    JSSP_TRANSFORM_DROP = 2
+  } jssptransform_t;
+
+  /**
+   * Parse-filter-reemit pipeline. Every byte range the callback leaves
+   * alone reaches the writer's output as is, large ranges are handed to
+   * the flush callback without any copy.
+   */
+  typedef struct
+  {
+    jssp_parser parser;
+    jssp_writer *writer;
+    jssp_process_callback cb;
+    void *cls; /* caller's state, the callback gets the transformer */
+    const char *js;
+    size_t copied; /* input before this offset is emitted or dropped */
+    size_t prev_end; /* end of the previous value or of '[' / '{' */
+    size_t skip_depth; /* replaced or dropped container, 0 if none */
+    size_t skip_index;
+    size_t skip_start;
+    const char *data; /* replacement */
+    size_t data_len;
+    const char *insert;
+    size_t insert_len;
+    jssptype_t type; /* event being handled */
+    uint8_t action; /* jssptransform_t */
+    uint8_t drop_comma; /* a dropped first element owes its comma */
+    uint8_t finish; /* copy the rest without parsing */
+  } jssp_transformer;
+
+  /**
+   * Initial a transformer writing to writer. cb is called for every
+   * event with the transformer as cls and may call the jssp_transform_*
+   * functions on it; a container replaced or dropped on its open event
+   * delivers no events for its content.
+   */
+  void
+  jssp_transformer_init (jssp_transformer *t,
+                         jssp_writer *writer,
+                         jssp_process_callback cb,
+                         void *cls);
+
+  /**
+   * Transform a whole document, see jssp_parse for the buffer. The output
+   * is flushed when done.
+   */
+  jssperr_t
+  jssp_transform (jssp_transformer *t,
+                  const char *js,
+                  size_t len,
+                  void *buf,
+                  size_t buf_size,
+                  size_t max_buffered_key_size);
+
+  /**
+   * Replace the current value, or container on its open event, by json.
+   * json must stay valid until the value ends.
+   */
+  jssperr_t
+  jssp_transform_replace (jssp_transformer *t,
+                          const char *json,
+                          size_t len);
+
+  /**
+   * Drop the current value with its key and separating comma.
+   */
+  jssperr_t
+  jssp_transform_drop (jssp_transformer *t);
+
+  /**
+   * Insert json after the current value or closed container, a member
+   * such as "key":1 inside objects. json must stay valid until the
+   * callback returns.
+   */
+  jssperr_t
+  jssp_transform_insert (jssp_transformer *t,
+                         const char *json,
+                         size_t len);
+
+  /**
+   * Nothing more to change: once the current value is done the rest of
+   * the input is copied without parsing it, at memcpy speed.
+   */
+  void
+  jssp_transform_finish (jssp_transformer *t);
+
+  /**
+   * Single pass minifier / pretty printer. Strings are copied untouched,
+   * so the input is expected to be valid JSON (see jssp_validate); only
+   * unbalanced closing brackets are caught.
+   */
+  typedef struct
+  {
+    jssp_writer *writer;
+    unsigned int indent; /* spaces per level, 0 minifies */
+    size_t depth;
+    uint8_t in_string;
+    uint8_t escape; /* a backslash ended the last chunk */
+    uint8_t open; /* line break after '[' or '{' is pending */
+    uint8_t top; /* a top level value was written */
+    uint8_t sep; /* top level values were separated by whitespace */
+  } jssp_reformatter;
+
+  void
+  jssp_reformatter_init (jssp_reformatter *r,
+                         jssp_writer *writer,
+                         unsigned int indent);
+
+  /**
+   * Reformat the next chunk of input. Returns JSSP_ERROR_PART while
+   * inside a container or string, JSSP_SUCCESS between top level values.
+   * Flush the writer once done.
+   */
+  jssperr_t
+  jssp_reformat (jssp_reformatter *r,
+                 const char *js,
+                 size_t len);
+
+  typedef enum
+  {
+    JSSP_TAPE_ARRAY = 1, /* payload: index past the matching end */
+    JSSP_TAPE_OBJECT = 2, /* members are a key string and a value */
+    JSSP_TAPE_END = 3, /* payload: element count, saturates at 2^24-1 */
+    JSSP_TAPE_STRING = 4, /* payload: byte length, raw bytes follow */
+    JSSP_TAPE_NUMBER = 5, /* as a string, the number as written */
+    JSSP_TAPE_TRUE = 6,
+    JSSP_TAPE_FALSE = 7,
+    JSSP_TAPE_NULL = 8
+  } jssptapetype_t;
+
+  /* Type flag of a string or number referenced in the source: the payload
+   * holds its offset in the upper 32 bits and its length in the lower 24 */
+#define JSSP_TAPE_REF 0x80
+
+  /**
+   * Compact document built from parser events: one 64-bit word per value
+   * with the type in the top byte, strings and numbers inline after their
+   * word, all in a single arena. Up to 2^32 words.
+   */
+  typedef struct
+  {
+    uint64_t *words;
+    size_t cap;
+    size_t len; /* words in use, the first top level value is at 0 */
+    size_t open; /* innermost open container while building */
+    size_t text; /* string or number being built */
+    const jssp_parser *parser;
+    const char *source; /* text referenced in place, see jssp_tape_set_source */
+    size_t source_len;
+    const jssp_allocator *allocator;
+    uint8_t heap; /* words came from the allocator */
+    uint8_t in_value; /* inside a value split across chunks */
+    uint8_t last_err; /* jssperr_t */
+  } jssp_tape;
+
+#define JSSP_TAPE_PAYLOAD ((UINT64_C(1) << 56) - 1)
+#define jssp_tape_type(t, i) ((jssptapetype_t) ((t)->words[(i)] >> 56 & ~JSSP_TAPE_REF))
+  /* Elements of the container at i */
+#define jssp_tape_size(t, i) \
+  ((size_t) ((t)->words[((t)->words[(i)] & JSSP_TAPE_PAYLOAD) - 1] & JSSP_TAPE_PAYLOAD))
+
+  /**
+   * Initial a tape on buf for the events of parser. allocator may be NULL,
+   * then a full buffer gives JSSP_ERROR_NOMEM.
+   */
+  void
+  jssp_tape_init (jssp_tape *t,
+                  const jssp_parser *parser,
+                  void *buf,
+                  size_t size,
+                  const jssp_allocator *allocator);
+
+  /**
+   * Declare the buffer holding the whole input, as passed to jssp_parse.
+   * Strings, keys and numbers inside it are then referenced instead of
+   * copied, so it must stay in place while the tape is used. Only the
+   * first 4 GB are referenced.
+   */
+  void
+  jssp_tape_set_source (jssp_tape *t,
+                        const char *js,
+                        size_t len);
+
+  /**
+   * Raw (still escaped) bytes of the string or number at i.
+   */
+  const char *
+  jssp_tape_string (const jssp_tape *t,
+                    size_t i,
+                    size_t *len);
+
+  /**
+   * Release the words the tape allocated for itself, if any.
+   */
+  void
+  jssp_tape_release (jssp_tape *t);
+
+  /**
+   * Add a parser event to the tape, values split across chunks are
+   * joined again.
+   */
+  jssperr_t
+  jssp_tape_event (jssp_tape *t,
+                   jssptype_t type,
+                   const char *key,
+                   size_t key_len,
+                   const char *data,
+                   size_t data_size);
+
+  /**
+   * jssp_process_callback taking the tape as cls. On failure the parser
+   * returns JSSP_TERMINATE and the tape's last_err tells why.
+   */
+  int
+  jssp_tape_callback (void *cls,
+                      jssptype_t type,
+                      size_t depth,
+                      size_t index,
+                      const char *key,
+                      size_t key_len,
+                      const char *data,
+                      size_t data_size,
+                      uint64_t stream_offset);
+
+  /**
+   * Index of the value after the one at i, skipping containers whole.
+   */
+  size_t
+  jssp_tape_next (const jssp_tape *t,
+                  size_t i);
+
+  /**
+   * Element index of the array at i, or member key of the object at i.
+   * Return the value's tape index, SIZE_MAX if there is none.
+   */
+  size_t
+  jssp_tape_at (const jssp_tape *t,
+                size_t array,
+                size_t index);
+
+  size_t
+  jssp_tape_find (const jssp_tape *t,
+                  size_t object,
+                  const char *key,
+                  size_t key_len);
+
+  /**
+   * Number at i converted, JSSP_ERROR_INVAL if it is not one or does not
+   * fit the type.
+   */
+  jssperr_t
+  jssp_tape_int (const jssp_tape *t,
+                 size_t i,
+                 int64_t *value);
+
+  jssperr_t
+  jssp_tape_double (const jssp_tape *t,
+                    size_t i,
+                    double *value);
+
+  /* One value, key or closing bracket of an index */
+  typedef struct
+  {
+    uint64_t offset; /* first byte in the input */
+    uint64_t next; /* entry after the value, past a container's end */
+  } jsspindexentry_t;
+
+  /**
+   * Structural index of a document for on demand lookups: one entry per
+   * value, object key and closing bracket in document order, nothing
+   * decoded. Object members are a key entry followed by the value.
+   */
+  typedef struct
+  {
+    jsspindexentry_t *entries;
+    size_t cap;
+    size_t len;
+    const char *js;
+    size_t js_len;
+    const jssp_allocator *allocator;
+    void *map; /* cache file the entries are read from, see jssp_index_load */
+    size_t map_size;
+    void
+    (*unmap) (void *map, size_t size);
+    uint8_t heap; /* entries came from the allocator */
+  } jssp_index;
+
+  /**
+   * Initial an index on buf. allocator may be NULL, then a full buffer
+   * gives JSSP_ERROR_NOMEM.
+   */
+  void
+  jssp_index_init (jssp_index *idx,
+                   void *buf,
+                   size_t size,
+                   const jssp_allocator *allocator);
+
+  /**
+   * Index js in one scan. Only the structure is checked, unbalanced
+   * brackets give JSSP_ERROR_INVAL and truncated input JSSP_ERROR_PART;
+   * run jssp_validate first for untrusted input. js must stay in place
+   * while the index is used.
+   */
+  jssperr_t
+  jssp_index_build (jssp_index *idx,
+                    const char *js,
+                    size_t len);
+
+  /**
+   * Find a value by JSON Pointer (RFC 6901), e.g. "/items/0/name"; ""
+   * is the first top level value. Keys are compared raw. Returns the
+   * value's text, quotes and brackets included, and sets its length and
+   * type, or returns NULL when there is no such value. The value always
+   * lies within js.
+   */
+  const char *
+  jssp_index_lookup (const jssp_index *idx,
+                     const char *pointer,
+                     size_t *value_len,
+                     jssptapetype_t *type);
+
+  /**
+   * Release the entries the index allocated for itself, if any.
+   */
+  void
+  jssp_index_release (jssp_index *idx);
+
+  typedef enum
+  {
+    JSSP_BIN_CBOR = 0, /* RFC 8949, containers of indefinite length */
+    JSSP_BIN_MSGPACK = 1
+  } jsspbinformat_t;
+
+  /**
+   * Transcoder from parser events to CBOR or MessagePack. Strings are
+   * unescaped, integers take their shortest form and other numbers the
+   * narrowest float that holds them exactly. Output goes to the caller's
+   * buffer and the flush callback like jssp_writer's. A MessagePack
+   * container is counted once it closes, so an open top level container
+   * must fit the buffer.
+   */
+  typedef struct
+  {
+    char *buf;
+    size_t size;
+    size_t len; /* bytes pending in buf */
+    jssp_flush_callback flush;
+    void *cls;
+    const jssp_parser *parser;
+    char *scratch; /* values split across chunks are joined here */
+    size_t scratch_size;
+    size_t scratch_len;
+    size_t depth;
+    uint64_t stack[(JSSP_WRITE_DEPTH + 63) / 64]; /* 1: object, 0: array */
+    size_t header[JSSP_WRITE_DEPTH]; /* MessagePack: where the count goes */
+    uint32_t count[JSSP_WRITE_DEPTH]; /* MessagePack: elements so far */
+    uint8_t format; /* jsspbinformat_t */
+    uint8_t in_value; /* inside a value split across chunks */
+    uint8_t last_err; /* jssperr_t */
+  } jssp_encoder;
+
+  /**
+   * Initial an encoder for the events of parser. flush may be NULL when
+   * the whole output fits the buffer.
+   */
+  void
+  jssp_encoder_init (jssp_encoder *e,
+                     const jssp_parser *parser,
+                     jsspbinformat_t format,
+                     char *buf,
+                     size_t size,
+                     jssp_flush_callback flush,
+                     void *cls);
+
+  /**
+   * Room to join a string or number split across input chunks, whose
+   * length must be known before its bytes are written. Without it such
+   * a value gives JSSP_ERROR_NOMEM.
+   */
+  void
+  jssp_encoder_set_scratch (jssp_encoder *e,
+                            char *scratch,
+                            size_t size);
+
+  /**
+   * Hand the pending bytes to the flush callback. Call once done.
+   */
+  jssperr_t
+  jssp_encoder_flush (jssp_encoder *e);
+
+  jssperr_t
+  jssp_encoder_event (jssp_encoder *e,
+                      jssptype_t type,
+                      const char *key,
+                      size_t key_len,
+                      const char *data,
+                      size_t data_size);
+
+  /**
+   * jssp_process_callback taking the encoder as cls. On failure the
+   * parser returns JSSP_TERMINATE and the encoder's last_err tells why.
+   */
+  int
+  jssp_encoder_callback (void *cls,
+                         jssptype_t type,
+                         size_t depth,
+                         size_t index,
+                         const char *key,
+                         size_t key_len,
+                         const char *data,
+                         size_t data_size,
+                         uint64_t stream_offset);
+
+  typedef enum
+  {
+    JSSP_COLUMN_INT64 = 0, /* values: int64_t per row */
+    JSSP_COLUMN_DOUBLE = 1, /* values: double per row */
+    JSSP_COLUMN_BOOL = 2, /* values: bitmap like validity */
+    JSSP_COLUMN_STRING = 3 /* values: rows + 1 int32_t offsets into data */
+  } jsspcolumntype_t;
+
+  /* Deepest column path, in segments */
+#ifndef JSSP_COLUMN_DEPTH
+#define JSSP_COLUMN_DEPTH 8
+#endif
+
+  /* Columns per jssp_columnizer, one bit each in its masks */
+#define JSSP_COLUMN_MAX 64
+
+  /**
+   * Projected field and its buffers in Arrow layout, provided by the
+   * caller for the batch capacity. Bitmaps have a bit per row, least
+   * significant first, validity is set for rows holding a value.
+   */
+  typedef struct
+  {
+    const char *path; /* RFC 6901 pointer into each record, e.g. "/user/id" */
+    jsspcolumntype_t type;
+    uint8_t *validity;
+    void *values;
+    char *data; /* unescaped string bytes */
+    size_t data_size;
+    size_t data_len;
+    size_t null_count;
+    /* path segments, set up by jssp_columnizer_init */
+    char keys[64];
+    uint8_t key_end[JSSP_COLUMN_DEPTH];
+    uint8_t segments;
+  } jssp_column;
+
+  /* Receives every full batch, non-zero aborts */
+  typedef int
+  (*jssp_batch_callback) (void *cls,
+                          const jssp_column *columns,
+                          size_t ncolumns,
+                          size_t rows);
+
+  /**
+   * Fills columns from the events of an NDJSON stream, one row per top
+   * level object. Fields no column asks for are passed over without key
+   * comparisons. A value of another type than its column's, or a path
+   * through an array, leaves the row null.
+   */
+  typedef struct
+  {
+    jssp_column *columns;
+    size_t ncolumns;
+    size_t rows; /* rows in the batch so far */
+    size_t capacity;
+    jssp_batch_callback batch;
+    void *cls;
+    const jssp_parser *parser;
+    char *scratch; /* projected values split across chunks are joined here */
+    size_t scratch_size;
+    size_t scratch_len;
+    uint64_t match[JSSP_COLUMN_DEPTH + 1]; /* columns reaching into each open level */
+    uint64_t arrays; /* open levels that are arrays */
+    uint64_t set; /* columns with a value in the current row */
+    uint64_t pending; /* columns the split value goes to */
+    size_t skip; /* level of a container being passed over, 0 if none */
+    uint8_t in_row;
+    uint8_t in_value;
+    uint8_t last_err; /* jssperr_t */
+  } jssp_columnizer;
+
+  /**
+   * Initial a columnizer for the events of parser, batches of capacity
+   * rows go to batch. JSSP_ERROR_INVAL for a bad path or more than
+   * JSSP_COLUMN_MAX columns.
+   */
+  jssperr_t
+  jssp_columnizer_init (jssp_columnizer *c,
+                        const jssp_parser *parser,
+                        jssp_column *columns,
+                        size_t ncolumns,
+                        size_t capacity,
+                        jssp_batch_callback batch,
+                        void *cls);
+
+  /**
+   * Room to join a projected value split across input chunks. Without
+   * it such a value gives JSSP_ERROR_NOMEM.
+   */
+  void
+  jssp_columnizer_set_scratch (jssp_columnizer *c,
+                               char *scratch,
+                               size_t size);
+
+  /**
+   * Hand the rows of the last, partial batch to the batch callback.
+   */
+  jssperr_t
+  jssp_columnizer_flush (jssp_columnizer *c);
+
+  jssperr_t
+  jssp_columnizer_event (jssp_columnizer *c,
+                         jssptype_t type,
+                         size_t depth,
+                         const char *key,
+                         size_t key_len,
+                         const char *data,
+                         size_t data_size);
+
+  /**
+   * jssp_process_callback taking the columnizer as cls. On failure the
+   * parser returns JSSP_TERMINATE and the columnizer's last_err tells
+   * why.
+   */
+  int
+  jssp_columnizer_callback (void *cls,
+                            jssptype_t type,
+                            size_t depth,
+                            size_t index,
+                            const char *key,
+                            size_t key_len,
+                            const char *data,
+                            size_t data_size,
+                            uint64_t stream_offset);
+
+  /**
+   * Streaming base64 decoder for a string value arriving in fragments.
+   * Decoded bytes collect in the caller's buffer and go to the flush
+   * callback whenever it fills up. Standard and URL safe alphabets are
+   * both accepted, padding is optional.
+   */
+  typedef struct
+  {
+    char *buf;
+    size_t size;
+    size_t len; /* bytes pending in buf */
+    jssp_flush_callback flush;
+    void *cls;
+    uint64_t total; /* bytes decoded since the last reset */
+    uint32_t bits; /* sextets of the partial quad */
+    uint8_t count; /* sextets in bits */
+    uint8_t pad; /* '=' seen */
+    uint8_t escape; /* a fragment ended in a backslash */
+    uint8_t last_err; /* jssperr_t */
+  } jssp_base64;
+
+  /**
+   * Initial a decoder on buf, which takes at least 6 bytes. flush may be
+   * NULL when the decoded value fits the buffer.
+   */
+  void
+  jssp_base64_init (jssp_base64 *b,
+                    char *buf,
+                    size_t size,
+                    jssp_flush_callback flush,
+                    void *cls);
+
+  /**
+   * Ready for the next value, keeping pending output.
+   */
+  void
+  jssp_base64_reset (jssp_base64 *b);
+
+  /**
+   * Decode a fragment as it appears in the JSON text. The escapes a
+   * writer may put in base64, \/ and the escaped line breaks, are
+   * handled, anything else not in the alphabet gives JSSP_ERROR_INVAL.
+   */
+  jssperr_t
+  jssp_base64_update (jssp_base64 *b,
+                      const char *data,
+                      size_t len);
+
+  /**
+   * Decode the last partial quad and flush, if there is a flush
+   * callback. JSSP_ERROR_INVAL when the value ended mid byte.
+   */
+  jssperr_t
+  jssp_base64_finish (jssp_base64 *b);
+
+  jssperr_t
+  jssp_base64_flush (jssp_base64 *b);
+
+  /**
+   * Feed the string fragment of a callback to the decoder, finishing it
+   * with the value's last fragment. A callback that picks a value by its
+   * key calls this for each fragment of that value.
+   */
+  jssperr_t
+  jssp_base64_event (jssp_base64 *b,
+                     const jssp_parser *parser,
+                     const char *data,
+                     size_t data_size);
+
+  /* Needles per jssp_filter */
+#define JSSP_FILTER_NEEDLES 8
+
+  /* Receives a record, without its delimiter, non-zero aborts */
+  typedef int
+  (*jssp_record_callback) (void *cls,
+                           const char *record,
+                           size_t len,
+                           uint64_t offset);
+
+  /**
+   * Prefilter for delimited records, e.g. NDJSON. Only records holding
+   * one of the needles' bytes are candidates, the others are skipped
+   * without being tokenized. A candidate goes to the parser set with
+   * jssp_filter_set_parser, if any, and then to the record callback,
+   * which can confirm the match from what the parser's events found.
+   */
+  typedef struct
+  {
+    const char *needle[JSSP_FILTER_NEEDLES];
+    size_t needle_len[JSSP_FILTER_NEEDLES];
+    size_t pivot[JSSP_FILTER_NEEDLES]; /* rarest byte, searched for first */
+    size_t count;
+    char delimiter;
+    char *carry; /* record split across chunks */
+    size_t carry_size;
+    size_t carry_len;
+    uint64_t offset; /* stream offset of the next byte fed */
+    jssp_parser *parser;
+    void *buf;
+    size_t buf_size;
+    size_t max_key_len;
+    jssp_process_callback cb;
+    void *cls;
+    jssp_record_callback record;
+    void *record_cls;
+    uint64_t candidates;
+    uint8_t last_err; /* jssperr_t */
+  } jssp_filter;
+
+  /**
+   * Initial a filter for count NUL terminated needles, which must stay
+   * valid. carry holds a record split across chunks, so it is as large
+   * as the longest record. JSSP_ERROR_INVAL for no needles, more than
+   * JSSP_FILTER_NEEDLES or an empty one.
+   */
+  jssperr_t
+  jssp_filter_init (jssp_filter *f,
+                    const char *const *needles,
+                    size_t count,
+                    char delimiter,
+                    char *carry,
+                    size_t carry_size,
+                    jssp_record_callback record,
+                    void *cls);
+
+  /**
+   * Parse the candidate records with parser, one jssp_parse_chunk call
+   * each. The parser's stream offsets count candidate bytes only, the
+   * record callback has the offsets in the input.
+   */
+  void
+  jssp_filter_set_parser (jssp_filter *f,
+                          jssp_parser *parser,
+                          void *buf,
+                          size_t buf_size,
+                          size_t max_key_len,
+                          jssp_process_callback cb,
+                          void *cls);
+
+  /**
+   * Feed the next chunk of input, which may be reused once the call
+   * returns. A candidate that does not parse stops the filter with the
+   * parser's error.
+   */
+  jssperr_t
+  jssp_filter_feed (jssp_filter *f,
+                    const char *data,
+                    size_t len);
+
+  /**
+   * Pass on the last record if the input did not end in a delimiter.
+   */
+  jssperr_t
+  jssp_filter_finish (jssp_filter *f);
+
+  typedef enum
+  {
+    JSSP_SAMPLE_STRIDE = 0, /* the first record and every stride-th after */
+    JSSP_SAMPLE_RATE = 1, /* each record with the same probability */
+    JSSP_SAMPLE_RESERVOIR = 2 /* k records chosen uniformly */
+  } jsspsample_t;
+
+  /**
+   * Sampling driver for delimited records. Only the records in the
+   * sample reach the parser, the others cost a delimiter scan. A record
+   * that does not parse or breaks the parser's limits is counted in
+   * errors and the parser starts over with the next one.
+   */
+  typedef struct
+  {
+    uint8_t mode; /* jsspsample_t */
+    char delimiter; /* '\n' unless changed after init */
+    uint64_t stride;
+    uint64_t threshold; /* a draw below it takes the record */
+    uint64_t rng;
+    char *slots; /* k + 1 reservoir slots */
+    size_t slot_size;
+    size_t k;
+    size_t spare; /* slot the incoming record is copied to */
+    size_t victim; /* slot it replaces */
+    uint64_t records;
+    uint64_t selected;
+    uint64_t errors;
+    uint64_t skipped; /* records too large for a reservoir slot */
+    uint64_t offset; /* stream offset of the next byte fed */
+    uint64_t record_offset;
+    uint8_t in_record;
+    uint8_t take; /* the current record is in the sample */
+    jssp_parser *parser;
+    void *buf;
+    size_t buf_size;
+    size_t max_key_len;
+    jssp_process_callback cb;
+    void *cls;
+    uint8_t last_err; /* jssperr_t */
+  } jssp_sampler;
+
+  /**
+   * Initial a sampler passing every record to parser. The parser must
+   * not be shared, it is reset after a record that does not parse.
+   */
+  void
+  jssp_sampler_init (jssp_sampler *s,
+                     jssp_parser *parser,
+                     void *buf,
+                     size_t buf_size,
+                     size_t max_key_len,
+                     jssp_process_callback cb,
+                     void *cls);
+
+  jssperr_t
+  jssp_sampler_set_stride (jssp_sampler *s,
+                           uint64_t stride);
+
+  /**
+   * Take each record with probability rate, 0 to 1. The seed makes runs
+   * reproducible.
+   */
+  jssperr_t
+  jssp_sampler_set_rate (jssp_sampler *s,
+                         double rate,
+                         uint64_t seed);
+
+  /**
+   * Keep a uniform sample of k records in storage, aligned like a
+   * uint64_t and split into k + 1 slots. The sample is parsed by
+   * jssp_sampler_finish, in no particular order. A record larger than a
+   * slot is left out of the sample and counted in skipped.
+   */
+  jssperr_t
+  jssp_sampler_set_reservoir (jssp_sampler *s,
+                              size_t k,
+                              void *storage,
+                              size_t size,
+                              uint64_t seed);
+
+  /**
+   * Feed the next chunk of input, which may be reused once the call
+   * returns.
+   */
+  jssperr_t
+  jssp_sampler_feed (jssp_sampler *s,
+                     const char *data,
+                     size_t len);
+
+  /**
+   * End the last record and parse the reservoir, if any.
+   */
+  jssperr_t
+  jssp_sampler_finish (jssp_sampler *s);
+
+  /**
+   * Identity of an input file. A cache is only used for the same device,
+   * inode, size and modification time, and the same hash of the first
+   * and last 64 KB.
+   */
+  typedef struct
+  {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t hash;
+  } jssp_file_id;
+
+  /* The on-disk cache needs POSIX files and mmap */
+#if defined(__unix__) || defined(__APPLE__)
+  jssperr_t
+  jssp_file_id_get (const char *path,
+                    jssp_file_id *id);
+
+  /**
+   * Store the index of the file identified by id at cache_path. The file
+   * is written aside and renamed into place. An entry table jssp_index_build
+   * could not have produced gives JSSP_ERROR_INVAL.
+   */
+  jssperr_t
+  jssp_index_save (const jssp_index *idx,
+                   const char *cache_path,
+                   const jssp_file_id *id);
+
+  /**
+   * Map the index stored at cache_path for js, the contents of the file
+   * identified by id. JSSP_ERROR_INVAL when there is no cache or it was
+   * written for another version of the file. The entries are not read
+   * here; a lookup in a damaged table returns NULL rather than leave js.
+   * jssp_index_release unmaps.
+   */
+  jssperr_t
+  jssp_index_load (jssp_index *idx,
+                   const char *cache_path,
+                   const jssp_file_id *id,
+                   const char *js,
+                   size_t len);
+
+  /**
+   * jssp_index_load, or jssp_index_build and jssp_index_save when the
+   * cache is missing or stale.
+   */
+  jssperr_t
+  jssp_index_build_cached (jssp_index *idx,
+                           const char *js,
+                           size_t len,
+                           const char *cache_path,
+                           const jssp_file_id *id);
+#endif
+
 #ifdef __cplusplus
 }
 #endif
@@ -0,0 +1,243 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_base64_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_base64_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+/* Sextet of each char, -1 for none. Both the standard and the URL safe
+ * alphabet are accepted. */
+static const int8_t jssp_base64_table[256] =
+  {
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 62, -1, 62, -1, 63,
+    52, 53, 54, 55, 56, 57, 58, 59, 60, 61, -1, -1, -1, -1, -1, -1,
+    -1,  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14,
+    15, 16, 17, 18, 19, 20, 21, 22, 23, 24, 25, -1, -1, -1, -1, 63,
+    -1, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35, 36, 37, 38, 39, 40,
+    41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1
+  };
+
+/* Room for n bytes, flushing first if needed */
+static jssperr_t
+jssp_base64_reserve (jssp_base64 *b,
+                     size_t n)
+{
+  if (b->size - b->len >= n)
+    return JSSP_SUCCESS;
+  if (JSSP_SUCCESS != jssp_base64_flush (b))
+    return b->last_err;
+  if (b->size < n)
+    {
+      b->last_err = JSSP_ERROR_NOMEM;
+      return JSSP_ERROR_NOMEM;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* The bytes of the sextets gathered so far, n of them */
+static jssperr_t
+jssp_base64_emit (jssp_base64 *b,
+                  size_t n)
+{
+  uint32_t v = b->bits << (6 * (4 - b->count));
+
+  if (JSSP_SUCCESS != jssp_base64_reserve (b, n))
+    return b->last_err;
+  b->buf[b->len++] = (char) (v >> 16);
+  if (n > 1)
+    b->buf[b->len++] = (char) (v >> 8);
+  if (n > 2)
+    b->buf[b->len++] = (char) v;
+  b->total += n;
+  b->bits = 0;
+  b->count = 0;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_base64_init (jssp_base64 *b,
+                  char *buf,
+                  size_t size,
+                  jssp_flush_callback flush,
+                  void *cls)
+{
+  b->buf = buf;
+  b->size = size;
+  b->len = 0;
+  b->flush = flush;
+  b->cls = cls;
+  jssp_base64_reset (b);
+}
+
+void
+jssp_base64_reset (jssp_base64 *b)
+{
+  b->total = 0;
+  b->bits = 0;
+  b->count = 0;
+  b->pad = 0;
+  b->escape = 0;
+  b->last_err = JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_base64_flush (jssp_base64 *b)
+{
+  if (0 == b->len)
+    return JSSP_SUCCESS;
+  if (NULL == b->flush)
+    {
+      jssp_base64_debug("%zu decoded bytes fill the buffer.", b->len);
+      b->last_err = JSSP_ERROR_NOMEM;
+      return JSSP_ERROR_NOMEM;
+    }
+  if (0 != b->flush (b->cls, b->buf, b->len))
+    {
+      b->last_err = JSSP_TERMINATE;
+      return JSSP_TERMINATE;
+    }
+  b->len = 0;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_base64_update (jssp_base64 *b,
+                    const char *data,
+                    size_t len)
+{
+  const unsigned char *p = (const unsigned char *) data, *end = p + len;
+  const int8_t *t = jssp_base64_table;
+  uint32_t hi, lo;
+  unsigned char *o;
+  int8_t v;
+
+  if (JSSP_SUCCESS != b->last_err)
+    return b->last_err;
+  while (p < end)
+    {
+      /* eight chars to six bytes while nothing is pending */
+      if (0 == b->count && 0 == b->pad && !b->escape)
+        while (end - p >= 8)
+          {
+            if ((t[p[0]] | t[p[1]] | t[p[2]] | t[p[3]]
+                 | t[p[4]] | t[p[5]] | t[p[6]] | t[p[7]]) < 0)
+              break;
+            if (b->size - b->len < 6 && JSSP_SUCCESS != jssp_base64_reserve (b, 6))
+              return b->last_err;
+            hi = (uint32_t) t[p[0]] << 18 | (uint32_t) t[p[1]] << 12
+              | (uint32_t) t[p[2]] << 6 | (uint32_t) t[p[3]];
+            lo = (uint32_t) t[p[4]] << 18 | (uint32_t) t[p[5]] << 12
+              | (uint32_t) t[p[6]] << 6 | (uint32_t) t[p[7]];
+            o = (unsigned char *) b->buf + b->len;
+            o[0] = hi >> 16;
+            o[1] = hi >> 8;
+            o[2] = hi;
+            o[3] = lo >> 16;
+            o[4] = lo >> 8;
+            o[5] = lo;
+            b->len += 6;
+            b->total += 6;
+            p += 8;
+          }
+      if (p == end)
+        break;
+
+      /* one char at a time around escapes, padding and the chunk edges */
+      if (b->escape)
+        {
+          b->escape = 0;
+          /* "\/" is a '/', escaped line breaks are skipped */
+          if (*p == 'n' || *p == 'r' || *p == 't')
+            {
+              p++;
+              continue;
+            }
+          if (*p != '/')
+            goto inval;
+        }
+      else if (*p == '\\')
+        {
+          b->escape = 1;
+          p++;
+          continue;
+        }
+      else if (*p == ' ')
+        {
+          p++;
+          continue;
+        }
+      else if (*p == '=')
+        {
+          if (b->count + b->pad < 2 || b->count + b->pad >= 4)
+            goto inval;
+          b->pad++;
+          p++;
+          continue;
+        }
+      v = t[*p++];
+      if (v < 0 || b->pad > 0)
+        goto inval;
+      b->bits = b->bits << 6 | (uint32_t) v;
+      if (4 == ++b->count && JSSP_SUCCESS != jssp_base64_emit (b, 3))
+        return b->last_err;
+    }
+  return JSSP_SUCCESS;
+
+inval:
+  jssp_base64_debug("Not base64: %c", *p);
+  b->last_err = JSSP_ERROR_INVAL;
+  return JSSP_ERROR_INVAL;
+}
+
+jssperr_t
+jssp_base64_finish (jssp_base64 *b)
+{
+  if (JSSP_SUCCESS != b->last_err)
+    return b->last_err;
+  /* padding is optional, a lone char is not a byte */
+  if (1 == b->count || b->escape)
+    {
+      b->last_err = JSSP_ERROR_INVAL;
+      return JSSP_ERROR_INVAL;
+    }
+  if (b->count > 1 && JSSP_SUCCESS != jssp_base64_emit (b, b->count - 1))
+    return b->last_err;
+  b->pad = 0;
+  /* without a callback the value stays in buf */
+  if (NULL == b->flush)
+    return JSSP_SUCCESS;
+  return jssp_base64_flush (b);
+}
+
+jssperr_t
+jssp_base64_event (jssp_base64 *b,
+                   const jssp_parser *parser,
+                   const char *data,
+                   size_t data_size)
+{
+  if (JSSP_STRING != parser->literal_type)
+    {
+      b->last_err = JSSP_ERROR_INVAL;
+      return JSSP_ERROR_INVAL;
+    }
+  if (JSSP_SUCCESS != jssp_base64_update (b, data, data_size))
+    return b->last_err;
+  /* the parser reports BROKEN while more fragments follow */
+  if (JSSP_SUCCESS == parser->last_err)
+    return jssp_base64_finish (b);
+  return JSSP_SUCCESS;
+}
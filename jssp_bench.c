@@ -0,0 +1,1046 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "jssp.h"
+
+/* Build with optimization for meaningful numbers, e.g.
+ *   make bench CFLAGS="-I. -O2 -DJSSP_STRICT -DJSSP_NODEBUG" */
+
+#define BENCH_DOC "{\"jsonrpc\":\"2.0\",\"method\":\"update\",\"params\":" \
+  "{\"id\":42,\"tags\":[\"a\",\"b\",\"c\"],\"pos\":{\"x\":1.5,\"y\":-2}},\"id\":7}"
+
+static double
+bench_now ()
+{
+  struct timespec ts;
+  clock_gettime (CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int
+bench_count_cb (void *cls,
+                jssptype_t type,
+                size_t depth,
+                size_t index,
+                const char *key,
+                size_t key_len,
+                const char *data,
+                size_t data_size,
+                uint64_t stream_offset)
+{
+  (*(size_t *) cls)++;
+  return 0;
+}
+
+/* Bytes a connection needs for the parser and a node buffer deep enough
+ * for the given document depth and key size */
+static void
+bench_memory ()
+{
+  size_t depths[] =
+    { 4, 32, 256 };
+  size_t i;
+
+  printf ("sizeof(jssp_parser) %zu, sizeof(jsspnode_t) %zu\n",
+          sizeof(jssp_parser),
+          sizeof(jsspnode_t));
+  for (i = 0; i < sizeof(depths) / sizeof(depths[0]); i++)
+    printf ("depth %3zu, 32 byte keys: %6zu bytes/connection, "
+            "%zu MB for 50k connections\n",
+            depths[i],
+            sizeof(jssp_parser) + sizeof(jsspnode_t) * (depths[i] + 2) + 32,
+            (sizeof(jssp_parser) + sizeof(jsspnode_t) * (depths[i] + 2) + 32)
+              * 50000 / (1024 * 1024));
+}
+
+/* Feed the same document in small chunks round-robin to many parsers,
+ * as an event loop serving many connections does. Once the parsers and
+ * their buffers no longer fit in cache every call starts with misses. */
+static void
+bench_connections (size_t conns)
+{
+  const char *js = BENCH_DOC;
+  size_t len = strlen (js);
+  size_t buf_size = sizeof(jsspnode_t) * 8 + 32;
+  jssp_parser *parsers = malloc (sizeof(jssp_parser) * conns);
+  char *bufs = malloc (buf_size * conns);
+  size_t rounds = 200000 / conns + 1;
+  size_t events = 0, calls = 0, i, b, r;
+  double t;
+
+  t = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      for (i = 0; i < conns; i++)
+        jssp_init (&parsers[i]);
+      for (b = 16; b < len + 16; b += 16)
+        for (i = 0; i < conns; i++, calls++)
+          jssp_parse (&parsers[i],
+                      js,
+                      b < len ? b : len,
+                      bufs + buf_size * i,
+                      buf_size,
+                      32,
+                      &bench_count_cb,
+                      &events);
+    }
+  t = bench_now () - t;
+
+  printf ("%6zu connections: %7.1f ns/call, %7.1f MB/s\n",
+          conns,
+          t * 1e9 / calls,
+          len * conns * rounds / t / (1024 * 1024));
+  free (parsers);
+  free (bufs);
+}
+
+/* Minified document of about size bytes: an array of records */
+static char *
+bench_document (size_t size, size_t *len)
+{
+  char *js = malloc (size + 256);
+  size_t n = 0, i = 0;
+
+  js[n++] = '[';
+  while (n < size)
+    n += sprintf (js + n,
+                  "%s{\"id\":%zu,\"name\":\"user %zu\",\"score\":%zu.25,"
+                  "\"tags\":[\"a\",\"b\"],\"active\":true,\"ref\":null}",
+                  i ? "," : "", i, i, i * 7), i++;
+  js[n++] = ']';
+  js[n] = '\0';
+  *len = n;
+  return js;
+}
+
+/* Throughput of the callback-free validator against a full parse */
+static void
+bench_validate ()
+{
+  size_t len, events = 0, r, rounds = 20;
+  char *js = bench_document (1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jssp_parser p;
+  double t;
+
+  t = bench_now ();
+  for (r = 0; r < rounds; r++)
+    if (JSSP_SUCCESS != jssp_validate (js, len, NULL))
+      printf ("validate failed\n");
+  t = bench_now () - t;
+  printf ("validate: %7.1f MB/s\n", len * rounds / t / (1024 * 1024));
+
+  t = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_parse (&p, js, len, buf, sizeof(buf), 32, &bench_count_cb, &events);
+    }
+  t = bench_now () - t;
+  printf ("parse:    %7.1f MB/s\n", len * rounds / t / (1024 * 1024));
+  free (js);
+}
+
+static int
+bench_sink_cb (void *cls,
+               const char *data,
+               size_t len)
+{
+  *(size_t *) cls += len;
+  return 0;
+}
+
+/* Records like bench_document written with jssp_writer and, for
+ * comparison, with snprintf into the same sized buffer */
+static void
+bench_write ()
+{
+  size_t records = 1000000, bytes = 0, n = 0, i;
+  static char out[65536];
+  jssp_writer w;
+  double t;
+
+  t = bench_now ();
+  jssp_writer_init (&w, out, sizeof(out), &bench_sink_cb, &bytes);
+  jssp_write_begin_array (&w);
+  for (i = 0; i < records; i++)
+    {
+      jssp_write_begin_object (&w);
+      jssp_write_key (&w, "id", 2);
+      jssp_write_int (&w, i);
+      jssp_write_key (&w, "name", 4);
+      jssp_write_string (&w, "user \"x\"", 8);
+      jssp_write_key (&w, "score", 5);
+      jssp_write_double (&w, i * 7 + 0.25);
+      jssp_write_key (&w, "active", 6);
+      jssp_write_bool (&w, 1);
+      jssp_write_end_object (&w);
+    }
+  jssp_write_end_array (&w);
+  jssp_writer_flush (&w);
+  t = bench_now () - t;
+  printf ("write:    %7.1f MB/s\n", bytes / t / (1024 * 1024));
+
+  bytes = 0;
+  t = bench_now ();
+  for (i = 0; i < records; i++)
+    {
+      if (n + 128 > sizeof(out))
+        {
+          bench_sink_cb (&bytes, out, n);
+          n = 0;
+        }
+      n += snprintf (out + n, sizeof(out) - n,
+                     "%s{\"id\":%zu,\"name\":\"user \\\"x\\\"\",\"score\":%.17g,"
+                     "\"active\":true}",
+                     i ? "," : "[", i, i * 7 + 0.25);
+    }
+  bench_sink_cb (&bytes, out, n);
+  t = bench_now () - t;
+  printf ("snprintf: %7.1f MB/s\n", bytes / t / (1024 * 1024));
+}
+
+/* Sink copying its input like a send to a socket would */
+static int
+bench_copy_cb (void *cls,
+               const char *data,
+               size_t len)
+{
+  char **dst = cls;
+
+  memcpy (*dst, data, len);
+  *dst += len;
+  return 0;
+}
+
+/* Replace the first "ref" value, keep everything else. With done set
+ * to -1 the rest passes through unparsed once it is replaced. */
+static int
+bench_transform_cb (void *cls,
+                    jssptype_t type,
+                    size_t depth,
+                    size_t index,
+                    const char *key,
+                    size_t key_len,
+                    const char *data,
+                    size_t data_size,
+                    uint64_t stream_offset)
+{
+  jssp_transformer *t = cls;
+  int *done = t->cls;
+
+  if (*done <= 0 && NULL != data && 3 == key_len && 0 == memcmp (key, "ref", 3))
+    {
+      jssp_transform_replace (t, "\"changed\"", 9);
+      if (*done)
+        jssp_transform_finish (t);
+      *done = 1;
+    }
+  return 0;
+}
+
+/* One field changed in a 1 MB body, against a plain parse and memcpy */
+static void
+bench_transform ()
+{
+  size_t len, events = 0, r, rounds = 20;
+  char *js = bench_document (1024 * 1024, &len);
+  char *copy = malloc (len + 64), *dst;
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  static char out[65536];
+  jssp_transformer t;
+  jssp_writer w;
+  jssp_parser p;
+  int done, finish;
+  double tm;
+
+  for (finish = 0; finish >= -1; finish--)
+    {
+      tm = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          dst = copy;
+          done = finish;
+          jssp_writer_init (&w, out, sizeof(out), &bench_copy_cb, &dst);
+          jssp_transformer_init (&t, &w, &bench_transform_cb, &done);
+          jssp_transform (&t, js, len, buf, sizeof(buf), 32);
+        }
+      tm = bench_now () - tm;
+      printf ("transform%s: %7.1f MB/s\n",
+              finish ? " + finish" : "         ",
+              len * rounds / tm / (1024 * 1024));
+    }
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_parse (&p, js, len, buf, sizeof(buf), 32, &bench_count_cb, &events);
+    }
+  tm = bench_now () - tm;
+  printf ("parse:              %7.1f MB/s\n", len * rounds / tm / (1024 * 1024));
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      memcpy (copy, js, len);
+      __asm__ __volatile__ ("" : : "r" (copy) : "memory");
+    }
+  tm = bench_now () - tm;
+  printf ("memcpy:             %7.1f MB/s\n", len * rounds / tm / (1024 * 1024));
+  free (copy);
+  free (js);
+}
+
+typedef struct
+{
+  jssp_parser parser;
+  jssp_writer *writer;
+} bench_reemit_t;
+
+static int
+bench_reemit_cb (void *cls,
+                 jssptype_t type,
+                 size_t depth,
+                 size_t index,
+                 const char *key,
+                 size_t key_len,
+                 const char *data,
+                 size_t data_size,
+                 uint64_t stream_offset)
+{
+  bench_reemit_t *t = cls;
+
+  return JSSP_SUCCESS != jssp_write_event (t->writer, &t->parser, type, key,
+                                           key_len, data, data_size);
+}
+
+/* Minify an indented 1 MB document, against parse-then-write */
+static void
+bench_reformat ()
+{
+  size_t len, plen = 0, bytes, r, rounds = 20;
+  char *js = bench_document (1024 * 1024, &len);
+  char *pretty = malloc (len * 4);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  static char out[65536];
+  jssp_reformatter rf;
+  bench_reemit_t t;
+  double tm;
+
+  {
+    jssp_writer w;
+    char *dst = pretty;
+
+    jssp_writer_init (&w, out, sizeof(out), &bench_copy_cb, &dst);
+    jssp_reformatter_init (&rf, &w, 2);
+    jssp_reformat (&rf, js, len);
+    jssp_writer_flush (&w);
+    plen = dst - pretty;
+  }
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_writer w;
+
+      bytes = 0;
+      jssp_writer_init (&w, out, sizeof(out), &bench_sink_cb, &bytes);
+      jssp_reformatter_init (&rf, &w, 0);
+      jssp_reformat (&rf, pretty, plen);
+      jssp_writer_flush (&w);
+    }
+  tm = bench_now () - tm;
+  printf ("minify:             %7.1f MB/s\n", plen * rounds / tm / (1024 * 1024));
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_writer w;
+
+      bytes = 0;
+      jssp_writer_init (&w, out, sizeof(out), &bench_sink_cb, &bytes);
+      t.writer = &w;
+      jssp_init (&t.parser);
+      jssp_parse (&t.parser, pretty, plen, buf, sizeof(buf), 32, &bench_reemit_cb, &t);
+      jssp_writer_flush (&w);
+    }
+  tm = bench_now () - tm;
+  printf ("parse + write:      %7.1f MB/s\n", plen * rounds / tm / (1024 * 1024));
+  free (pretty);
+  free (js);
+}
+
+/* Cost of building a tape on top of the parse */
+static void
+bench_tape ()
+{
+  size_t len, r, rounds = 20;
+  char *js = bench_document (1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  void *words = malloc (len * 4);
+  jssp_parser p;
+  jssp_tape t;
+  double tm;
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_tape_init (&t, &p, words, len * 4, NULL);
+      jssp_tape_set_source (&t, js, len);
+      if (JSSP_SUCCESS != jssp_parse (&p, js, len, buf, sizeof(buf), 32,
+                                      &jssp_tape_callback, &t))
+        printf ("tape failed\n");
+    }
+  tm = bench_now () - tm;
+  printf ("parse + tape:       %7.1f MB/s, %zu bytes of tape\n",
+          len * rounds / tm / (1024 * 1024), t.len * sizeof(uint64_t));
+  free (words);
+  free (js);
+}
+
+/* Five fields out of a 100 KB document: index and look up, against a
+ * full parse, and lookups alone on an index reused */
+static void
+bench_index ()
+{
+  const char *paths[] =
+    { "/0/name", "/100/score", "/500/tags/1", "/900/id", "/1000/active" };
+  size_t len, vlen, found = 0, events = 0, r, k, rounds = 2000;
+  char *js = bench_document (100 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jsspindexentry_t *entries = malloc (len * sizeof(jsspindexentry_t) / 2);
+  jssp_index idx;
+  jssp_parser p;
+  double tm;
+
+  jssp_index_init (&idx, entries, len * sizeof(jsspindexentry_t) / 2, NULL);
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      if (JSSP_SUCCESS != jssp_index_build (&idx, js, len))
+        printf ("index failed\n");
+      for (k = 0; k < sizeof(paths) / sizeof(paths[0]); k++)
+        found += NULL != jssp_index_lookup (&idx, paths[k], &vlen, NULL);
+    }
+  tm = bench_now () - tm;
+  printf ("index + 5 lookups:  %7.1f us/document\n", tm * 1e6 / rounds);
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    for (k = 0; k < sizeof(paths) / sizeof(paths[0]); k++)
+      found += NULL != jssp_index_lookup (&idx, paths[k], &vlen, NULL);
+  tm = bench_now () - tm;
+  printf ("5 lookups, reused:  %7.1f us/document\n", tm * 1e6 / rounds);
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_parse (&p, js, len, buf, sizeof(buf), 32, &bench_count_cb, &events);
+    }
+  tm = bench_now () - tm;
+  printf ("parse:              %7.1f us/document (%zu found)\n",
+          tm * 1e6 / rounds, found / (rounds * 2));
+  free (entries);
+  free (js);
+}
+
+static void
+bench_cache ()
+{
+  const char *path = "/tmp/jssp_bench.json", *cache_path = "/tmp/jssp_bench.json.idx";
+  size_t len, vlen, found = 0, r, rounds = 200;
+  char *js = bench_document (8 * 1024 * 1024, &len);
+  jssp_file_id id;
+  jssp_index idx;
+  FILE *f;
+  double tm;
+
+  f = fopen (path, "w");
+  if (NULL == f)
+    return;
+  fwrite (js, 1, len, f);
+  fclose (f);
+  jssp_index_init (&idx, NULL, 0, &jssp_default_allocator);
+
+  tm = bench_now ();
+  for (r = 0; r < rounds / 20; r++)
+    {
+      unlink (cache_path);
+      jssp_file_id_get (path, &id);
+      jssp_index_build_cached (&idx, js, len, cache_path, &id);
+      found += NULL != jssp_index_lookup (&idx, "/100/score", &vlen, NULL);
+      jssp_index_release (&idx);
+    }
+  tm = bench_now () - tm;
+  printf ("index, cold cache:  %7.1f ms/8 MB\n", tm * 1e3 / (rounds / 20));
+
+  tm = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_file_id_get (path, &id);
+      jssp_index_build_cached (&idx, js, len, cache_path, &id);
+      found += NULL != jssp_index_lookup (&idx, "/100/score", &vlen, NULL);
+      jssp_index_release (&idx);
+    }
+  tm = bench_now () - tm;
+  printf ("index, warm cache:  %7.1f ms/8 MB (%zu found)\n",
+          tm * 1e3 / rounds, found);
+  unlink (cache_path);
+  unlink (path);
+  free (js);
+}
+
+/* bench_document transcoded to CBOR and MessagePack, against parsing alone */
+static void
+bench_binary ()
+{
+  const char *names[] = { "cbor:    ", "msgpack: " };
+  size_t len, bytes, events = 0, r, f, rounds = 20;
+  char *js = bench_document (16 * 1024 * 1024, &len);
+  char *out = malloc (len), scratch[256];
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jssp_encoder e;
+  jssp_parser p;
+  double t;
+
+  t = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_parse (&p, js, len, buf, sizeof(buf), 32, &bench_count_cb, &events);
+    }
+  t = bench_now () - t;
+  printf ("parse:    %7.1f MB/s\n", len * rounds / t / (1024 * 1024));
+
+  /* MessagePack holds the top level array back until it is counted */
+  for (f = 0; f < 2; f++)
+    {
+      bytes = 0;
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          jssp_init (&p);
+          jssp_encoder_init (&e, &p, f ? JSSP_BIN_MSGPACK : JSSP_BIN_CBOR, out,
+                             f ? len : 65536, &bench_sink_cb, &bytes);
+          jssp_encoder_set_scratch (&e, scratch, sizeof(scratch));
+          if (JSSP_SUCCESS != jssp_parse (&p, js, len, buf, sizeof(buf), 32,
+                                          &jssp_encoder_callback, &e)
+            || JSSP_SUCCESS != jssp_encoder_flush (&e))
+            printf ("encode failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s of JSON, %.0f%% of its size\n", names[f],
+              len * rounds / t / (1024 * 1024), 100.0 * bytes / rounds / len);
+    }
+  free (out);
+  free (js);
+}
+
+static int
+bench_batch_cb (void *cls,
+                const jssp_column *columns,
+                size_t ncolumns,
+                size_t rows)
+{
+  *(size_t *) cls += rows;
+  return 0;
+}
+
+/* bench_document into 4096 row batches of two projected columns */
+static void
+bench_columns ()
+{
+  enum { ROWS = 4096 };
+  static int64_t ids[ROWS];
+  static int32_t offsets[ROWS + 1];
+  static uint8_t validity[2][ROWS / 8];
+  static char data[ROWS * 32];
+  size_t len, rows = 0, r, rounds = 20;
+  char *js = bench_document (16 * 1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32], scratch[256];
+  jssp_column cols[2];
+  jssp_columnizer c;
+  jssp_parser p;
+  double t;
+
+  memset (cols, 0, sizeof(cols));
+  cols[0].path = "/id";
+  cols[0].type = JSSP_COLUMN_INT64;
+  cols[0].values = ids;
+  cols[0].validity = validity[0];
+  cols[1].path = "/name";
+  cols[1].type = JSSP_COLUMN_STRING;
+  cols[1].values = offsets;
+  cols[1].validity = validity[1];
+  cols[1].data = data;
+  cols[1].data_size = sizeof(data);
+
+  /* the document is one array, its elements are the records */
+  t = bench_now ();
+  for (r = 0; r < rounds; r++)
+    {
+      jssp_init (&p);
+      jssp_columnizer_init (&c, &p, cols, 2, ROWS, &bench_batch_cb, &rows);
+      jssp_columnizer_set_scratch (&c, scratch, sizeof(scratch));
+      if (JSSP_SUCCESS != jssp_parse (&p, js + 1, len - 2, buf, sizeof(buf), 32,
+                                      &jssp_columnizer_callback, &c)
+        || JSSP_SUCCESS != jssp_columnizer_flush (&c))
+        printf ("columns failed\n");
+    }
+  t = bench_now () - t;
+  printf ("columns:  %7.1f MB/s, %zu rows/document\n",
+          len * rounds / t / (1024 * 1024), rows / rounds);
+  free (js);
+}
+
+typedef struct
+{
+  jssp_parser *parser;
+  double *out;
+  size_t cap;
+  size_t n;
+  int bulk;
+  jssp_bulk state;
+} bench_bulk_t;
+
+static int
+bench_bulk_cb (void *cls,
+               jssptype_t type,
+               size_t depth,
+               size_t index,
+               const char *key,
+               size_t key_len,
+               const char *data,
+               size_t data_size,
+               uint64_t stream_offset)
+{
+  bench_bulk_t *b = cls;
+  char tmp[64];
+
+  if (JSSP_ARRAY_OPEN == type && b->bulk)
+    return JSSP_SUCCESS != jssp_bulk_numbers (b->parser, &b->state, JSSP_BULK_DOUBLE, b->out, b->cap);
+  if (JSSP_ARRAY_CLOSE == type && b->bulk)
+    b->n = jssp_bulk_count (&b->state);
+  if (JSSP_ARRAY_VAL == type && data_size < sizeof(tmp) && b->n < b->cap)
+    {
+      memcpy (tmp, data, data_size);
+      tmp[data_size] = '\0';
+      b->out[b->n++] = strtod (tmp, NULL);
+    }
+  return 0;
+}
+
+/* An embedding dump: one array of doubles, per element events and strtod
+ * against jssp_bulk_numbers */
+static void
+bench_bulk ()
+{
+  size_t len = 0, count = 4 * 1024 * 1024, i, r, rounds = 5;
+  char *js = malloc (count * 24 + 16);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  bench_bulk_t b;
+  jssp_parser p;
+  double t;
+
+  js[len++] = '[';
+  for (i = 0; i < count; i++)
+    len += sprintf (js + len, "%s%.9f", i ? "," : "", (double) (i % 1000003) / 1000003 - 0.5);
+  js[len++] = ']';
+  b.parser = &p;
+  b.cap = count;
+  b.out = malloc (count * sizeof(double));
+
+  for (b.bulk = 0; b.bulk < 2; b.bulk++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          b.n = 0;
+          jssp_init (&p);
+          if (JSSP_SUCCESS != jssp_parse (&p, js, len, buf, sizeof(buf), 32, &bench_bulk_cb, &b)
+            || count != b.n)
+            printf ("bulk failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s\n", b.bulk ? "bulk:    " : "strtod:  ",
+              len * rounds / t / (1024 * 1024));
+    }
+  free (b.out);
+  free (js);
+}
+
+typedef struct
+{
+  jssp_base64 b;
+  jssp_parser *parser;
+  int decode;
+  size_t n; /* string bytes seen */
+} bench_base64_t;
+
+static int
+bench_base64_sink (void *cls,
+                   const char *data,
+                   size_t len)
+{
+  return 0;
+}
+
+static int
+bench_base64_cb (void *cls,
+                 jssptype_t type,
+                 size_t depth,
+                 size_t index,
+                 const char *key,
+                 size_t key_len,
+                 const char *data,
+                 size_t data_size,
+                 uint64_t stream_offset)
+{
+  bench_base64_t *b = cls;
+
+  if (JSSP_OBJECT_VAL != type || 4 != key_len || 0 != memcmp (key, "blob", 4))
+    return 0;
+  b->n += data_size;
+  if (b->decode)
+    return JSSP_SUCCESS != jssp_base64_event (&b->b, b->parser, data, data_size);
+  return 0;
+}
+
+/* A 16 MB blob read in 64 KB chunks, skipped versus decoded */
+static void
+bench_base64 ()
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  size_t len = 0, count = 16 * 1024 * 1024, chunk = 65536, i, l, k, r, rounds = 5;
+  char *js = malloc (count + 64);
+  char buf[sizeof(jsspnode_t) * 8 + 32], out[4096];
+  bench_base64_t b;
+  jssp_parser p;
+  double t;
+
+  len = sprintf (js, "{\"id\": 1, \"blob\": \"");
+  for (i = 0; i < count; i++)
+    js[len++] = alphabet[(i * 2654435761u >> 7) & 63];
+  len += sprintf (js + len, "\"}");
+  b.parser = &p;
+
+  for (b.decode = 0; b.decode < 2; b.decode++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          b.n = 0;
+          jssp_base64_init (&b.b, out, sizeof(out), &bench_base64_sink, NULL);
+          jssp_init (&p);
+          for (l = 0; l < len; l += k)
+            {
+              k = len - l < chunk ? len - l : chunk;
+              jssp_parse_chunk (&p, js + l, k, buf, sizeof(buf), 32, &bench_base64_cb, &b);
+            }
+          if (count != b.n || (b.decode && count / 4 * 3 != b.b.total))
+            printf ("base64 failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s\n", b.decode ? "base64:  " : "skip:    ",
+              len * rounds / t / (1024 * 1024));
+    }
+  free (js);
+}
+
+typedef struct
+{
+  const char *js;
+  uint64_t from; /* end of the last record */
+  size_t n;
+} bench_record_t;
+
+/* Hash each record again once it closed */
+static int
+bench_record_cb (void *cls,
+                 jssptype_t type,
+                 size_t depth,
+                 size_t index,
+                 const char *key,
+                 size_t key_len,
+                 const char *data,
+                 size_t data_size,
+                 uint64_t stream_offset)
+{
+  bench_record_t *b = cls;
+  jssp_hash h;
+
+  b->n++;
+  if (1 != depth || JSSP_OBJECT_CLOSE != type)
+    return 0;
+  jssp_hash_init (&h, 0);
+  jssp_hash_update (&h, b->js + b->from, stream_offset + 1 - b->from);
+  b->n += jssp_hash_digest (&h) & 1;
+  b->from = stream_offset + 1;
+  return 0;
+}
+
+/* The records of bench_document: events only, then with a fingerprint
+ * per record, against hashing each record in a second pass */
+static void
+bench_fingerprint ()
+{
+  const char *names[] = { "events:  ", "raw:     ", "tokens:  ", "2 pass:  " };
+  size_t len, r, rounds = 10, mode;
+  char *js = bench_document (16 * 1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jssp_fingerprint f;
+  bench_record_t b;
+  jssp_parser p;
+  double t;
+
+  b.js = js + 1;
+  for (mode = 0; mode < 4; mode++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          b.from = 0;
+          jssp_init (&p);
+          if (1 == mode || 2 == mode)
+            {
+              jssp_fingerprint_init (&f, 1 == mode ? JSSP_FINGERPRINT_RAW
+                                     : JSSP_FINGERPRINT_TOKENS, 0);
+              jssp_set_fingerprint (&p, &f);
+            }
+          if (JSSP_SUCCESS != jssp_parse (&p, js + 1, len - 2, buf, sizeof(buf), 32,
+                                          3 == mode ? &bench_record_cb : &bench_count_cb,
+                                          3 == mode ? (void *) &b : (void *) &b.n))
+            printf ("fingerprint failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s\n", names[mode], len * rounds / t / (1024 * 1024));
+    }
+  free (js);
+}
+
+/* Log records, one line each, one in 128 from the payments service */
+static char *
+bench_ndjson (size_t size,
+              size_t *len)
+{
+  char *js = malloc (size + 256);
+  size_t i;
+
+  for (i = 0, *len = 0; *len < size; i++)
+    *len += sprintf (js + *len, "{\"id\":%zu,\"service\":\"%s\",\"latency\":%zu.%zu,"
+                     "\"path\":\"/api/v1/items/%zu\",\"tags\":[\"a\",\"b\"]}\n",
+                     i, i % 128 ? "search" : "payments", i % 997, i % 10, i * 31);
+  return js;
+}
+
+/* Every record parsed, against only the prefilter's candidates */
+static void
+bench_filter ()
+{
+  const char *needles[] = { "\"payments\"" };
+  size_t len, chunk = 65536, l, k, r, rounds = 5, n;
+  char *js = bench_ndjson (16 * 1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32], carry[4096];
+  jssp_filter f;
+  jssp_parser p;
+  double t;
+  int filter;
+
+  for (filter = 0; filter < 2; filter++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          n = 0;
+          jssp_init (&p);
+          jssp_filter_init (&f, needles, 1, '\n', carry, sizeof(carry), NULL, NULL);
+          jssp_filter_set_parser (&f, &p, buf, sizeof(buf), 32, &bench_count_cb, &n);
+          for (l = 0; l < len; l += k)
+            {
+              k = len - l < chunk ? len - l : chunk;
+              if (filter)
+                jssp_filter_feed (&f, js + l, k);
+              else
+                jssp_parse_chunk (&p, js + l, k, buf, sizeof(buf), 32, &bench_count_cb, &n);
+            }
+          if (filter && JSSP_SUCCESS != jssp_filter_finish (&f))
+            printf ("filter failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s, %zu events\n", filter ? "filter:  " : "parse:   ",
+              len * rounds / t / (1024 * 1024), n);
+    }
+  free (js);
+}
+
+/* Every record parsed, against samples of about one in 100 */
+static void
+bench_sample ()
+{
+  const char *names[] = { "all:     ", "stride:  ", "rate:    ", "reservoir:" };
+  static uint64_t storage[1001 * 32];
+  size_t len, chunk = 65536, l, k, r, rounds = 5, n, mode;
+  char *js = bench_ndjson (16 * 1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jssp_sampler s;
+  jssp_parser p;
+  double t;
+
+  for (mode = 0; mode < 4; mode++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          n = 0;
+          jssp_init (&p);
+          jssp_sampler_init (&s, &p, buf, sizeof(buf), 32, &bench_count_cb, &n);
+          if (1 == mode)
+            jssp_sampler_set_stride (&s, 100);
+          else if (2 == mode)
+            jssp_sampler_set_rate (&s, 0.01, r);
+          else if (3 == mode)
+            jssp_sampler_set_reservoir (&s, 1000, storage, sizeof(storage), r);
+          for (l = 0; l < len; l += k)
+            {
+              k = len - l < chunk ? len - l : chunk;
+              jssp_sampler_feed (&s, js + l, k);
+            }
+          if (JSSP_SUCCESS != jssp_sampler_finish (&s))
+            printf ("sample failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s, %llu of %llu records\n", names[mode],
+              len * rounds / t / (1024 * 1024), (unsigned long long) s.selected,
+              (unsigned long long) s.records);
+    }
+  free (js);
+}
+
+static int
+bench_cmp_double (const void *a, const void *b)
+{
+  double x = *(const double *) a, y = *(const double *) b;
+
+  return x < y ? -1 : x > y;
+}
+
+/* Tail latency of small messages sharing one thread with a large one: each
+ * round gives the large message one parse call, then parses 100 small ones,
+ * timing each from the start of the round */
+static void
+bench_latency ()
+{
+  const size_t budgets[] = { 0, 64 * 1024 };
+  size_t len, small_len, events = 0, r, rounds = 256, m, smalls = 100, i, done;
+  char *js = bench_document (8 * 1024 * 1024, &len);
+  char *small = bench_document (512, &small_len);
+  char buf[sizeof(jsspnode_t) * 8 + 32], small_buf[sizeof(buf)];
+  double *lat = malloc (rounds * smalls * sizeof(double));
+  double t, start, large, large_start;
+  jssp_parser big, p;
+  jssp_budget budget = { 0 };
+  jssperr_t err;
+
+  for (i = 0; i < sizeof(budgets) / sizeof(budgets[0]); i++)
+    {
+      budget.max_bytes = budgets[i];
+      jssp_init (&big);
+      jssp_set_budget (&big, &budget);
+      done = 0;
+      large = 0;
+      large_start = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          start = bench_now ();
+          err = jssp_parse (&big, js, len, buf, sizeof(buf), 32, &bench_count_cb, &events);
+          if (JSSP_YIELD != err)
+            {
+              if (JSSP_SUCCESS != err)
+                printf ("latency parse failed\n");
+              t = bench_now ();
+              large += t - large_start;
+              large_start = t;
+              done++;
+              jssp_init (&big);
+              jssp_set_budget (&big, &budget);
+            }
+          for (m = 0; m < smalls; m++)
+            {
+              jssp_init (&p);
+              jssp_parse (&p, small, small_len, small_buf, sizeof(small_buf), 32, &bench_count_cb, &events);
+              lat[r * smalls + m] = bench_now () - start;
+            }
+        }
+      qsort (lat, rounds * smalls, sizeof(double), &bench_cmp_double);
+      m = rounds * smalls;
+      printf ("latency, budget %6zu: p50 %8.1f us, p99 %8.1f us, p99.9 %8.1f us, max %8.1f us,"
+              " large in %6.1f ms\n", budgets[i], lat[m / 2] * 1e6, lat[m * 99 / 100] * 1e6,
+              lat[m * 999 / 1000] * 1e6, lat[m - 1] * 1e6, done ? large / done * 1e3 : 0.0);
+    }
+  free (lat);
+  free (small);
+  free (js);
+}
+
+/* Parse throughput with limits the input stays within */
+static void
+bench_limits ()
+{
+  jssp_limits limits = { 64, 1 << 20, 64, 1 << 24, 1 << 20 };
+  size_t len, events = 0, r, rounds = 20, i;
+  char *js = bench_document (1024 * 1024, &len);
+  char buf[sizeof(jsspnode_t) * 8 + 32];
+  jssp_parser p;
+  double t;
+
+  for (i = 0; i < 2; i++)
+    {
+      t = bench_now ();
+      for (r = 0; r < rounds; r++)
+        {
+          jssp_init (&p);
+          if (i)
+            jssp_set_limits (&p, &limits);
+          if (JSSP_SUCCESS != jssp_parse (&p, js, len, buf, sizeof(buf), 32,
+                                          &bench_count_cb, &events))
+            printf ("limits parse failed\n");
+        }
+      t = bench_now () - t;
+      printf ("%s %7.1f MB/s\n", i ? "limits:   " : "no limits:",
+              len * rounds / t / (1024 * 1024));
+    }
+  free (js);
+}
+
+int
+main ()
+{
+  bench_memory ();
+  bench_connections (1);
+  bench_connections (1000);
+  bench_connections (50000);
+  bench_validate ();
+  bench_write ();
+  bench_transform ();
+  bench_reformat ();
+  bench_tape ();
+  bench_index ();
+  bench_cache ();
+  bench_binary ();
+  bench_columns ();
+  bench_bulk ();
+  bench_base64 ();
+  bench_fingerprint ();
+  bench_filter ();
+  bench_sample ();
+  bench_latency ();
+  bench_limits ();
+  return 0;
+}
@@ -0,0 +1,494 @@
+#include <float.h>
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_bin_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_bin_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+#define jssp_bin_is_object(e) \
+  ((e)->depth > 0 && ((e)->stack[((e)->depth - 1) / 64] >> (((e)->depth - 1) % 64) & 1))
+
+#define jssp_bin_cbor(e) (JSSP_BIN_CBOR == (e)->format)
+
+/* Hand over everything before the outermost open MessagePack container,
+ * whose header still waits for its count */
+static jssperr_t
+jssp_bin_drain (jssp_encoder *e)
+{
+  size_t n = e->len, i;
+
+  if (!jssp_bin_cbor(e) && e->depth > 0)
+    n = e->header[0];
+  if (0 == n || NULL == e->flush)
+    {
+      jssp_bin_debug("%zu bytes pending do not fit the %zu byte buffer", e->len, e->size);
+      return JSSP_ERROR_NOMEM;
+    }
+  if (0 != e->flush (e->cls, e->buf, n))
+    return JSSP_TERMINATE;
+  memmove (e->buf, e->buf + n, e->len - n);
+  e->len -= n;
+  if (!jssp_bin_cbor(e))
+    for (i = 0; i < e->depth; i++)
+      e->header[i] -= n;
+  return JSSP_SUCCESS;
+}
+
+/* Room for n contiguous bytes */
+static jssperr_t
+jssp_bin_reserve (jssp_encoder *e,
+                  size_t n)
+{
+  jssperr_t err;
+
+  while (e->size - e->len < n)
+    if (JSSP_SUCCESS != (err = jssp_bin_drain (e)))
+      {
+        e->last_err = err;
+        return err;
+      }
+  return JSSP_SUCCESS;
+}
+
+/* Copy bytes of any length, flushing as the buffer fills */
+static jssperr_t
+jssp_bin_bytes (jssp_encoder *e,
+                const char *data,
+                size_t len)
+{
+  size_t n;
+
+  while (len > 0)
+    {
+      if (e->len == e->size && JSSP_SUCCESS != jssp_bin_reserve (e, 1))
+        return e->last_err;
+      n = len < e->size - e->len ? len : e->size - e->len;
+      memcpy (e->buf + e->len, data, n);
+      e->len += n;
+      data += n;
+      len -= n;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* prefix followed by the low n bytes of v, big endian */
+static jssperr_t
+jssp_bin_put (jssp_encoder *e,
+              unsigned char prefix,
+              uint64_t v,
+              size_t n)
+{
+  unsigned char *p;
+  size_t i;
+
+  if (JSSP_SUCCESS != jssp_bin_reserve (e, 1 + n))
+    return e->last_err;
+  p = (unsigned char *) e->buf + e->len;
+  p[0] = prefix;
+  for (i = n; i > 0; i--, v >>= 8)
+    p[i] = (unsigned char) v;
+  e->len += 1 + n;
+  return JSSP_SUCCESS;
+}
+
+/* CBOR initial byte and argument in the shortest form */
+static jssperr_t
+jssp_bin_cbor_head (jssp_encoder *e,
+                    unsigned char major,
+                    uint64_t v)
+{
+  major <<= 5;
+  if (v < 24)
+    return jssp_bin_put (e, major | (unsigned char) v, 0, 0);
+  if (v <= 0xFF)
+    return jssp_bin_put (e, major | 24, v, 1);
+  if (v <= 0xFFFF)
+    return jssp_bin_put (e, major | 25, v, 2);
+  if (v <= 0xFFFFFFFFU)
+    return jssp_bin_put (e, major | 26, v, 4);
+  return jssp_bin_put (e, major | 27, v, 8);
+}
+
+/* -m if neg, m otherwise; MessagePack needs m <= 2^63 when negative */
+static jssperr_t
+jssp_bin_int (jssp_encoder *e,
+              int neg,
+              uint64_t m)
+{
+  uint64_t u = (uint64_t) 0 - m; /* two's complement of -m */
+
+  if (jssp_bin_cbor(e))
+    return neg ? jssp_bin_cbor_head (e, 1, m - 1) : jssp_bin_cbor_head (e, 0, m);
+  if (!neg)
+    {
+      if (m < 0x80)
+        return jssp_bin_put (e, (unsigned char) m, 0, 0);
+      if (m <= 0xFF)
+        return jssp_bin_put (e, 0xcc, m, 1);
+      if (m <= 0xFFFF)
+        return jssp_bin_put (e, 0xcd, m, 2);
+      if (m <= 0xFFFFFFFFU)
+        return jssp_bin_put (e, 0xce, m, 4);
+      return jssp_bin_put (e, 0xcf, m, 8);
+    }
+  if (m <= 32)
+    return jssp_bin_put (e, (unsigned char) u, 0, 0);
+  if (m <= 0x80)
+    return jssp_bin_put (e, 0xd0, u, 1);
+  if (m <= 0x8000)
+    return jssp_bin_put (e, 0xd1, u, 2);
+  if (m <= 0x80000000U)
+    return jssp_bin_put (e, 0xd2, u, 4);
+  return jssp_bin_put (e, 0xd3, u, 8);
+}
+
+/* Single precision when exact, and CBOR half precision for normal halves */
+static jssperr_t
+jssp_bin_double (jssp_encoder *e,
+                 double d)
+{
+  uint64_t bits;
+  uint32_t fbits, exp;
+  float f;
+
+  if (d >= -FLT_MAX && d <= FLT_MAX && (double) (f = (float) d) == d)
+    {
+      memcpy (&fbits, &f, 4);
+      exp = fbits >> 23 & 0xFF;
+      if (jssp_bin_cbor(e) && (0 == (fbits & 0x7FFFFFFFU)
+                               || (exp >= 113 && exp <= 142 && 0 == (fbits & 0x1FFF))))
+        return jssp_bin_put (e, 0xf9,
+                             (fbits >> 16 & 0x8000)
+                             | (0 == (fbits & 0x7FFFFFFFU) ? 0
+                                : (exp - 112) << 10 | (fbits >> 13 & 0x3FF)), 2);
+      return jssp_bin_put (e, jssp_bin_cbor(e) ? 0xfa : 0xca, fbits, 4);
+    }
+  memcpy (&bits, &d, 8);
+  return jssp_bin_put (e, jssp_bin_cbor(e) ? 0xfb : 0xcb, bits, 8);
+}
+
+/* Integers that fit go out as integers, everything else as a float */
+static jssperr_t
+jssp_bin_number (jssp_encoder *e,
+                 const char *s,
+                 size_t len)
+{
+  const char *p = s, *end = s + len;
+  uint64_t m = 0;
+  int neg = 0;
+  double d;
+
+  if (p < end && *p == '-')
+    {
+      neg = 1;
+      p++;
+    }
+  if (p == end || *p < '0' || *p > '9')
+    goto inval;
+  for (; p < end && *p >= '0' && *p <= '9'; p++)
+    {
+      if (m > (UINT64_MAX - (*p - '0')) / 10)
+        break;
+      m = m * 10 + (*p - '0');
+    }
+  /* -0 keeps its sign as a float */
+  if (p == end && !(neg && 0 == m)
+    && (jssp_bin_cbor(e) || !neg || m <= UINT64_C(1) << 63))
+    return jssp_bin_int (e, neg, m);
+
+  if (JSSP_SUCCESS == jssp_number_double (s, len, &d))
+    return jssp_bin_double (e, d);
+inval:
+  jssp_bin_debug("Not a number: %.*s", (int) len, s);
+  e->last_err = JSSP_ERROR_INVAL;
+  return JSSP_ERROR_INVAL;
+}
+
+/* Unescape s straight into the buffer, flushing as it fills */
+static jssperr_t
+jssp_bin_unescape (jssp_encoder *e,
+                   const char *s,
+                   size_t len)
+{
+  const char *end = s + len;
+
+  while (s < end)
+    {
+      /* any single escape decodes to at most four bytes */
+      if (e->size - e->len < 4 && JSSP_SUCCESS != jssp_bin_reserve (e, 4))
+        return e->last_err;
+      e->len += jssp_unescape_part (e->buf + e->len, e->size - e->len, &s, end);
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Text string from the raw JSON bytes, copied as is unless escaped */
+static jssperr_t
+jssp_bin_string (jssp_encoder *e,
+                 const char *s,
+                 size_t len)
+{
+  int escaped = 0 != len && NULL != memchr (s, '\\', len);
+  size_t n = escaped ? jssp_unescape (NULL, s, len) : len;
+  jssperr_t err;
+
+  if (jssp_bin_cbor(e))
+    err = jssp_bin_cbor_head (e, 3, n);
+  else if (n < 32)
+    err = jssp_bin_put (e, 0xa0 | (unsigned char) n, 0, 0);
+  else if (n <= 0xFF)
+    err = jssp_bin_put (e, 0xd9, n, 1);
+  else if (n <= 0xFFFF)
+    err = jssp_bin_put (e, 0xda, n, 2);
+  else if (n <= 0xFFFFFFFFU)
+    err = jssp_bin_put (e, 0xdb, n, 4);
+  else
+    err = e->last_err = JSSP_ERROR_NOMEM;
+  if (JSSP_SUCCESS != err)
+    return err;
+  if (!escaped)
+    return jssp_bin_bytes (e, s, len);
+  return jssp_bin_unescape (e, s, len);
+}
+
+static jssperr_t
+jssp_bin_value (jssp_encoder *e,
+                int string,
+                const char *s,
+                size_t len)
+{
+  if (string)
+    return jssp_bin_string (e, s, len);
+  if (4 == len && 0 == memcmp (s, "true", 4))
+    return jssp_bin_put (e, jssp_bin_cbor(e) ? 0xf5 : 0xc3, 0, 0);
+  if (5 == len && 0 == memcmp (s, "false", 5))
+    return jssp_bin_put (e, jssp_bin_cbor(e) ? 0xf4 : 0xc2, 0, 0);
+  if (4 == len && 0 == memcmp (s, "null", 4))
+    return jssp_bin_put (e, jssp_bin_cbor(e) ? 0xf6 : 0xc0, 0, 0);
+  return jssp_bin_number (e, s, len);
+}
+
+/* One more element at the current level, a member starts with its key */
+static jssperr_t
+jssp_bin_element (jssp_encoder *e,
+                  const char *key,
+                  size_t key_len)
+{
+  if (0 == e->depth)
+    return JSSP_SUCCESS;
+  e->count[e->depth - 1]++;
+  if (jssp_bin_is_object(e))
+    return jssp_bin_string (e, key, key_len);
+  return JSSP_SUCCESS;
+}
+
+static jssperr_t
+jssp_bin_open (jssp_encoder *e,
+               int object,
+               const char *key,
+               size_t key_len)
+{
+  jssperr_t err;
+
+  if (e->depth >= JSSP_WRITE_DEPTH)
+    {
+      jssp_bin_debug("Nesting deeper than %d", JSSP_WRITE_DEPTH);
+      return JSSP_ERROR_NOMEM;
+    }
+  if (JSSP_SUCCESS != (err = jssp_bin_element (e, key, key_len)))
+    return err;
+  if (jssp_bin_cbor(e))
+    err = jssp_bin_put (e, object ? 0xbf : 0x9f, 0, 0);
+  else
+    {
+      /* 32-bit count for now, shrunk once known */
+      if (JSSP_SUCCESS != (err = jssp_bin_reserve (e, 5)))
+        return err;
+      e->header[e->depth] = e->len;
+      e->count[e->depth] = 0;
+      err = jssp_bin_put (e, object ? 0xdf : 0xdd, 0, 4);
+    }
+  if (JSSP_SUCCESS != err)
+    return err;
+  if (object)
+    e->stack[e->depth / 64] |= UINT64_C(1) << (e->depth % 64);
+  else
+    e->stack[e->depth / 64] &= ~(UINT64_C(1) << (e->depth % 64));
+  e->depth++;
+  return JSSP_SUCCESS;
+}
+
+static jssperr_t
+jssp_bin_close (jssp_encoder *e)
+{
+  unsigned char *p;
+  size_t shift;
+  uint32_t count;
+  int object;
+
+  if (0 == e->depth)
+    return JSSP_ERROR_INVAL;
+  if (jssp_bin_cbor(e))
+    {
+      e->depth--;
+      return jssp_bin_put (e, 0xff, 0, 0);
+    }
+  object = jssp_bin_is_object(e);
+  e->depth--;
+  p = (unsigned char *) e->buf + e->header[e->depth];
+  count = e->count[e->depth];
+  if (count < 16)
+    {
+      p[0] = (object ? 0x80 : 0x90) | count;
+      shift = 4;
+    }
+  else if (count <= 0xFFFF)
+    {
+      p[0] = object ? 0xde : 0xdc;
+      p[1] = count >> 8;
+      p[2] = count;
+      shift = 2;
+    }
+  else
+    {
+      p[1] = count >> 24;
+      p[2] = count >> 16;
+      p[3] = count >> 8;
+      p[4] = count;
+      shift = 0;
+    }
+  if (0 != shift)
+    {
+      memmove (p + 5 - shift, p + 5, e->len - e->header[e->depth] - 5);
+      e->len -= shift;
+    }
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_encoder_init (jssp_encoder *e,
+                   const jssp_parser *parser,
+                   jsspbinformat_t format,
+                   char *buf,
+                   size_t size,
+                   jssp_flush_callback flush,
+                   void *cls)
+{
+  e->buf = buf;
+  e->size = size;
+  e->len = 0;
+  e->flush = flush;
+  e->cls = cls;
+  e->parser = parser;
+  e->scratch = NULL;
+  e->scratch_size = 0;
+  e->scratch_len = 0;
+  e->depth = 0;
+  e->format = format;
+  e->in_value = 0;
+  e->last_err = JSSP_SUCCESS;
+}
+
+void
+jssp_encoder_set_scratch (jssp_encoder *e,
+                          char *scratch,
+                          size_t size)
+{
+  e->scratch = scratch;
+  e->scratch_size = size;
+}
+
+jssperr_t
+jssp_encoder_flush (jssp_encoder *e)
+{
+  jssperr_t err;
+
+  if (0 == e->len)
+    return JSSP_SUCCESS;
+  if (NULL == e->flush)
+    return JSSP_SUCCESS;
+  if (JSSP_SUCCESS != (err = jssp_bin_drain (e)))
+    e->last_err = err;
+  return err;
+}
+
+jssperr_t
+jssp_encoder_event (jssp_encoder *e,
+                    jssptype_t type,
+                    const char *key,
+                    size_t key_len,
+                    const char *data,
+                    size_t data_size)
+{
+  int string = JSSP_STRING == e->parser->literal_type;
+  int complete = JSSP_SUCCESS == e->parser->last_err;
+  jssperr_t err;
+
+  switch (type)
+    {
+    case JSSP_ARRAY_OPEN:
+    case JSSP_OBJECT_OPEN:
+      err = jssp_bin_open (e, JSSP_OBJECT_OPEN == type, key, key_len);
+      break;
+    case JSSP_ARRAY_CLOSE:
+    case JSSP_OBJECT_CLOSE:
+      err = jssp_bin_close (e);
+      break;
+    case JSSP_ARRAY_VAL:
+    case JSSP_OBJECT_VAL:
+      if (!e->in_value)
+        {
+          if (JSSP_SUCCESS != (err = jssp_bin_element (e, key, key_len)))
+            break;
+          /* the usual case, the whole value in one event */
+          if (complete)
+            {
+              err = jssp_bin_value (e, string, data, data_size);
+              break;
+            }
+          e->scratch_len = 0;
+          e->in_value = 1;
+        }
+      /* a value split across chunks is joined first, its length comes first */
+      if (data_size > e->scratch_size - e->scratch_len)
+        {
+          jssp_bin_debug("Split value longer than %zu bytes", e->scratch_size);
+          err = JSSP_ERROR_NOMEM;
+          break;
+        }
+      if (0 != data_size)
+        memcpy (e->scratch + e->scratch_len, data, data_size);
+      e->scratch_len += data_size;
+      err = JSSP_SUCCESS;
+      if (complete)
+        {
+          e->in_value = 0;
+          err = jssp_bin_value (e, string, e->scratch, e->scratch_len);
+        }
+      break;
+    default:
+      err = JSSP_ERROR_INVAL;
+    }
+  if (JSSP_SUCCESS != err)
+    e->last_err = err;
+  return err;
+}
+
+int
+jssp_encoder_callback (void *cls,
+                       jssptype_t type,
+                       size_t depth,
+                       size_t index,
+                       const char *key,
+                       size_t key_len,
+                       const char *data,
+                       size_t data_size,
+                       uint64_t stream_offset)
+{
+  return JSSP_SUCCESS != jssp_encoder_event (cls, type, key, key_len, data, data_size);
+}
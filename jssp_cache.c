@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jssp.h"
+
+#if defined(__unix__) || defined(__APPLE__)
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifndef JSSP_DEBUG
+#define jssp_cache_debug(M, ...)
+#else
+#define jssp_cache_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+/* Bytes hashed at each end of the file */
+#define JSSP_CACHE_SAMPLE 65536
+
+static const char jssp_cache_magic[8] = "JSSPIDX1";
+
+/* Layout of a cache file, the entries follow */
+typedef struct
+{
+  char magic[8];
+  uint32_t entry_size; /* also catches a cache written by another layout */
+  uint32_t order; /* 1 in the writer's byte order */
+  jssp_file_id id;
+  uint64_t js_len;
+  uint64_t count;
+} jssp_cache_header;
+
+/* FNV-1a, the sample is small */
+static uint64_t
+jssp_cache_hash (uint64_t h,
+                 const unsigned char *data,
+                 size_t len)
+{
+  size_t i;
+
+  for (i = 0; i < len; i++)
+    h = (h ^ data[i]) * UINT64_C(0x100000001b3);
+  return h;
+}
+
+static void
+jssp_cache_unmap (void *map,
+                  size_t size)
+{
+  munmap (map, size);
+}
+
+jssperr_t
+jssp_file_id_get (const char *path,
+                  jssp_file_id *id)
+{
+  unsigned char sample[JSSP_CACHE_SAMPLE];
+  struct stat st;
+  ssize_t n;
+  int fd;
+
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return JSSP_ERROR_INVAL;
+  if (0 != fstat (fd, &st))
+    {
+      close (fd);
+      return JSSP_ERROR_INVAL;
+    }
+  memset (id, 0, sizeof(*id));
+  id->dev = st.st_dev;
+  id->ino = st.st_ino;
+  id->size = st.st_size;
+#if defined(__APPLE__)
+  id->mtime_sec = st.st_mtimespec.tv_sec;
+  id->mtime_nsec = st.st_mtimespec.tv_nsec;
+#else
+  id->mtime_sec = st.st_mtim.tv_sec;
+  id->mtime_nsec = st.st_mtim.tv_nsec;
+#endif
+  /* head and tail catch rewrites that keep size and mtime */
+  id->hash = UINT64_C(0xcbf29ce484222325);
+  n = pread (fd, sample, sizeof(sample), 0);
+  if (n > 0)
+    id->hash = jssp_cache_hash (id->hash, sample, n);
+  if (st.st_size > JSSP_CACHE_SAMPLE)
+    {
+      n = pread (fd, sample, sizeof(sample), st.st_size - JSSP_CACHE_SAMPLE);
+      if (n > 0)
+        id->hash = jssp_cache_hash (id->hash, sample, n);
+    }
+  close (fd);
+  return JSSP_SUCCESS;
+}
+
+/* A table as jssp_index_build leaves it: offsets inside js and rising,
+ * each next link forward and at most one past the end */
+static int
+jssp_cache_entries_valid (const jsspindexentry_t *entries,
+                          size_t count,
+                          size_t js_len)
+{
+  size_t i;
+
+  for (i = 0; i < count; i++)
+    if (entries[i].offset >= js_len || entries[i].next <= i || entries[i].next > count
+      || (i > 0 && entries[i].offset <= entries[i - 1].offset))
+      return 0;
+  return 1;
+}
+
+jssperr_t
+jssp_index_save (const jssp_index *idx,
+                 const char *cache_path,
+                 const jssp_file_id *id)
+{
+  jssp_cache_header h;
+  char tmp[4096];
+  const char *p;
+  size_t left;
+  ssize_t n;
+  int fd;
+
+  /* checked once here, lookups only bounds check what they follow */
+  if (!jssp_cache_entries_valid (idx->entries, idx->len, idx->js_len))
+    {
+      jssp_cache_debug("Index of %zu entries is damaged.", idx->len);
+      return JSSP_ERROR_INVAL;
+    }
+  memset (&h, 0, sizeof(h));
+  memcpy (h.magic, jssp_cache_magic, sizeof(h.magic));
+  h.entry_size = sizeof(jsspindexentry_t);
+  h.order = 1;
+  h.id = *id;
+  h.js_len = idx->js_len;
+  h.count = idx->len;
+
+  /* readers never see a half written file */
+  if ((size_t) snprintf (tmp, sizeof(tmp), "%s.%ld.tmp", cache_path, (long) getpid ())
+    >= sizeof(tmp))
+    return JSSP_ERROR_NOMEM;
+  fd = open (tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0)
+    return JSSP_ERROR_INVAL;
+  for (p = (const char *) &h, left = sizeof(h); left > 0; p += n, left -= n)
+    if ((n = write (fd, p, left)) <= 0)
+      goto fail;
+  for (p = (const char *) idx->entries, left = idx->len * sizeof(jsspindexentry_t);
+       left > 0; p += n, left -= n)
+    if ((n = write (fd, p, left)) <= 0)
+      goto fail;
+  if (0 != close (fd))
+    {
+      unlink (tmp);
+      return JSSP_ERROR_INVAL;
+    }
+  if (0 != rename (tmp, cache_path))
+    {
+      unlink (tmp);
+      return JSSP_ERROR_INVAL;
+    }
+  return JSSP_SUCCESS;
+
+fail:
+  jssp_cache_debug("Writing %s failed.", tmp);
+  close (fd);
+  unlink (tmp);
+  return JSSP_ERROR_INVAL;
+}
+
+jssperr_t
+jssp_index_load (jssp_index *idx,
+                 const char *cache_path,
+                 const jssp_file_id *id,
+                 const char *js,
+                 size_t len)
+{
+  const jssp_cache_header *h;
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open (cache_path, O_RDONLY);
+  if (fd < 0)
+    return JSSP_ERROR_INVAL;
+  if (0 != fstat (fd, &st) || (size_t) st.st_size < sizeof(jssp_cache_header))
+    {
+      close (fd);
+      return JSSP_ERROR_INVAL;
+    }
+  map = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (MAP_FAILED == map)
+    return JSSP_ERROR_INVAL;
+
+  h = map;
+  if (0 != memcmp (h->magic, jssp_cache_magic, sizeof(h->magic))
+    || sizeof(jsspindexentry_t) != h->entry_size || 1 != h->order
+    || 0 != memcmp (&h->id, id, sizeof(*id)) || len != h->js_len
+    || (uint64_t) st.st_size != sizeof(*h) + h->count * sizeof(jsspindexentry_t))
+    {
+      jssp_cache_debug("Cache %s is stale.", cache_path);
+      munmap (map, st.st_size);
+      return JSSP_ERROR_INVAL;
+    }
+
+  jssp_index_release (idx);
+  idx->entries = (jsspindexentry_t *) (h + 1);
+  idx->cap = 0; /* read only, building again allocates */
+  idx->len = h->count;
+  idx->js = js;
+  idx->js_len = len;
+  idx->map = map;
+  idx->map_size = st.st_size;
+  idx->unmap = &jssp_cache_unmap;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_index_build_cached (jssp_index *idx,
+                         const char *js,
+                         size_t len,
+                         const char *cache_path,
+                         const jssp_file_id *id)
+{
+  jssperr_t err;
+
+  if (JSSP_SUCCESS == jssp_index_load (idx, cache_path, id, js, len))
+    return JSSP_SUCCESS;
+  err = jssp_index_build (idx, js, len);
+  if (JSSP_SUCCESS != err)
+    return err;
+  /* a cache that cannot be written only costs the next run a build */
+  if (JSSP_SUCCESS != jssp_index_save (idx, cache_path, id))
+    {
+      jssp_cache_debug("Cache %s not written.", cache_path);
+    }
+  return JSSP_SUCCESS;
+}
+
+#endif
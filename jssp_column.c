@@ -0,0 +1,439 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_column_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_column_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+/* Arrow bitmaps: bit i of the batch is bit i % 8 of byte i / 8 */
+#define jssp_column_bit_set(bits, i) ((bits)[(i) / 8] |= (uint8_t) (1U << ((i) % 8)))
+#define jssp_column_bit_clear(bits, i) ((bits)[(i) / 8] &= (uint8_t) ~(1U << ((i) % 8)))
+#define jssp_column_bit(bits, i) ((bits)[(i) / 8] >> ((i) % 8) & 1)
+
+#define jssp_column_key(col, s) \
+  ((col)->keys + ((s) > 0 ? (col)->key_end[(s) - 1] : 0))
+#define jssp_column_key_len(col, s) \
+  ((size_t) ((col)->key_end[(s)] - ((s) > 0 ? (col)->key_end[(s) - 1] : 0)))
+
+#define jssp_column_offsets(col) ((int32_t *) (col)->values)
+
+/* Split an RFC 6901 pointer into unescaped segments */
+static jssperr_t
+jssp_column_path (jssp_column *col)
+{
+  const char *p = col->path;
+  size_t n = 0;
+
+  col->segments = 0;
+  if (NULL == p || *p != '/')
+    return JSSP_ERROR_INVAL;
+  while (*p == '/')
+    {
+      if (col->segments >= JSSP_COLUMN_DEPTH)
+        return JSSP_ERROR_INVAL;
+      for (p++; *p != '\0' && *p != '/'; p++, n++)
+        {
+          if (n >= sizeof(col->keys))
+            return JSSP_ERROR_INVAL;
+          col->keys[n] = *p;
+          if (*p == '~' && (p[1] == '0' || p[1] == '1'))
+            col->keys[n] = *++p == '0' ? '~' : '/';
+        }
+      col->key_end[col->segments++] = (uint8_t) n;
+    }
+  return *p == '\0' ? JSSP_SUCCESS : JSSP_ERROR_INVAL;
+}
+
+/* Columns whose path continues with key below the container at level
+ * depth - 1: the ones ending there when leaf, the others when not */
+static uint64_t
+jssp_column_members (const jssp_columnizer *c,
+                     size_t depth,
+                     const char *key,
+                     size_t key_len,
+                     int leaf)
+{
+  char unescaped[sizeof(c->columns[0].keys)];
+  uint64_t cand, m = 0;
+  const jssp_column *col;
+  size_t seg = depth - 2, i;
+
+  if (c->arrays >> (depth - 1) & 1)
+    return 0;
+  cand = c->match[depth - 1];
+  if (0 == cand)
+    return 0;
+  if (0 != key_len && NULL != memchr (key, '\\', key_len))
+    {
+      if (key_len > sizeof(unescaped))
+        return 0;
+      key_len = jssp_unescape (unescaped, key, key_len);
+      key = unescaped;
+    }
+  for (; 0 != cand; cand &= cand - 1)
+    {
+      i = __builtin_ctzll (cand);
+      col = c->columns + i;
+      if ((leaf ? col->segments == seg + 1 : col->segments > seg + 1)
+        && jssp_column_key_len(col, seg) == key_len
+        && 0 == memcmp (jssp_column_key(col, seg), key, key_len))
+        m |= UINT64_C(1) << i;
+    }
+  return m;
+}
+
+/* Hand the finished rows to the batch callback, a row being filled moves
+ * to the front */
+static jssperr_t
+jssp_column_emit (jssp_columnizer *c)
+{
+  jssp_column *col;
+  size_t i, row = c->rows, start, n;
+  int set;
+
+  if (0 == row)
+    return JSSP_SUCCESS;
+  if (0 != c->batch (c->cls, c->columns, c->ncolumns, row))
+    return JSSP_TERMINATE;
+  for (i = 0; i < c->ncolumns; i++)
+    {
+      col = c->columns + i;
+      set = c->in_row && (c->set >> i & 1);
+      col->null_count = 0;
+      if (set)
+        jssp_column_bit_set(col->validity, 0);
+      switch (col->type)
+        {
+        case JSSP_COLUMN_INT64:
+          if (set)
+            ((int64_t *) col->values)[0] = ((int64_t *) col->values)[row];
+          break;
+        case JSSP_COLUMN_DOUBLE:
+          if (set)
+            ((double *) col->values)[0] = ((double *) col->values)[row];
+          break;
+        case JSSP_COLUMN_BOOL:
+          if (set && jssp_column_bit((uint8_t *) col->values, row))
+            jssp_column_bit_set((uint8_t *) col->values, 0);
+          else
+            jssp_column_bit_clear((uint8_t *) col->values, 0);
+          break;
+        case JSSP_COLUMN_STRING:
+          start = jssp_column_offsets(col)[row];
+          n = set ? jssp_column_offsets(col)[row + 1] - start : 0;
+          memmove (col->data, col->data + start, n);
+          jssp_column_offsets(col)[0] = 0;
+          jssp_column_offsets(col)[1] = (int32_t) n;
+          col->data_len = n;
+          break;
+        }
+    }
+  c->rows = 0;
+  return JSSP_SUCCESS;
+}
+
+/* Value of column i in the current row. A value of another type leaves
+ * the row null. */
+static jssperr_t
+jssp_column_store (jssp_columnizer *c,
+                   size_t i,
+                   int string,
+                   const char *s,
+                   size_t len)
+{
+  jssp_column *col = c->columns + i;
+  size_t row = c->rows, n;
+  jssperr_t err;
+  int ok = 0, escaped;
+
+  switch (col->type)
+    {
+    case JSSP_COLUMN_INT64:
+      ok = !string && JSSP_SUCCESS == jssp_number_int (s, len, (int64_t *) col->values + row);
+      break;
+    case JSSP_COLUMN_DOUBLE:
+      ok = !string && JSSP_SUCCESS == jssp_number_double (s, len, (double *) col->values + row);
+      break;
+    case JSSP_COLUMN_BOOL:
+      if (string)
+        break;
+      if (4 == len && 0 == memcmp (s, "true", 4))
+        {
+          jssp_column_bit_set((uint8_t *) col->values, row);
+          ok = 1;
+        }
+      else if (5 == len && 0 == memcmp (s, "false", 5))
+        {
+          jssp_column_bit_clear((uint8_t *) col->values, row);
+          ok = 1;
+        }
+      break;
+    case JSSP_COLUMN_STRING:
+      if (!string)
+        break;
+      escaped = NULL != memchr (s, '\\', len);
+      n = escaped ? jssp_unescape (NULL, s, len) : len;
+      if (n > col->data_size - col->data_len)
+        {
+          if (JSSP_SUCCESS != (err = jssp_column_emit (c)))
+            return err;
+          row = c->rows;
+          if (n > col->data_size - col->data_len)
+            {
+              jssp_column_debug("String of %zu bytes does not fit %s", n, col->path);
+              return JSSP_ERROR_NOMEM;
+            }
+        }
+      if (col->data_len + n > INT32_MAX)
+        return JSSP_ERROR_NOMEM;
+      if (escaped)
+        jssp_unescape (col->data + col->data_len, s, len);
+      else
+        memcpy (col->data + col->data_len, s, len);
+      col->data_len += n;
+      jssp_column_offsets(col)[row + 1] = (int32_t) col->data_len;
+      ok = 1;
+      break;
+    }
+  if (ok)
+    {
+      jssp_column_bit_set(col->validity, row);
+      c->set |= UINT64_C(1) << i;
+    }
+  return JSSP_SUCCESS;
+}
+
+static jssperr_t
+jssp_column_store_all (jssp_columnizer *c,
+                       uint64_t m,
+                       const char *s,
+                       size_t len)
+{
+  int string = JSSP_STRING == c->parser->literal_type;
+  jssperr_t err;
+
+  for (; 0 != m; m &= m - 1)
+    if (JSSP_SUCCESS != (err = jssp_column_store (c, __builtin_ctzll (m), string, s, len)))
+      return err;
+  return JSSP_SUCCESS;
+}
+
+/* Columns without a value in the record are null */
+static jssperr_t
+jssp_column_end_row (jssp_columnizer *c)
+{
+  jssp_column *col;
+  size_t i, row = c->rows;
+
+  for (i = 0; i < c->ncolumns; i++)
+    {
+      if (c->set >> i & 1)
+        continue;
+      col = c->columns + i;
+      jssp_column_bit_clear(col->validity, row);
+      col->null_count++;
+      switch (col->type)
+        {
+        case JSSP_COLUMN_INT64:
+          ((int64_t *) col->values)[row] = 0;
+          break;
+        case JSSP_COLUMN_DOUBLE:
+          ((double *) col->values)[row] = 0;
+          break;
+        case JSSP_COLUMN_BOOL:
+          jssp_column_bit_clear((uint8_t *) col->values, row);
+          break;
+        case JSSP_COLUMN_STRING:
+          jssp_column_offsets(col)[row + 1] = jssp_column_offsets(col)[row];
+          break;
+        }
+    }
+  c->in_row = 0;
+  c->rows++;
+  return c->rows == c->capacity ? jssp_column_emit (c) : JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_columnizer_init (jssp_columnizer *c,
+                      const jssp_parser *parser,
+                      jssp_column *columns,
+                      size_t ncolumns,
+                      size_t capacity,
+                      jssp_batch_callback batch,
+                      void *cls)
+{
+  size_t i;
+
+  if (ncolumns > JSSP_COLUMN_MAX || 0 == capacity)
+    return JSSP_ERROR_INVAL;
+  for (i = 0; i < ncolumns; i++)
+    {
+      if (JSSP_SUCCESS != jssp_column_path (columns + i))
+        {
+          jssp_column_debug("Bad column path %s", columns[i].path);
+          return JSSP_ERROR_INVAL;
+        }
+      columns[i].data_len = 0;
+      columns[i].null_count = 0;
+      if (JSSP_COLUMN_STRING == columns[i].type)
+        jssp_column_offsets(columns + i)[0] = 0;
+    }
+  c->columns = columns;
+  c->ncolumns = ncolumns;
+  c->rows = 0;
+  c->capacity = capacity;
+  c->batch = batch;
+  c->cls = cls;
+  c->parser = parser;
+  c->scratch = NULL;
+  c->scratch_size = 0;
+  c->scratch_len = 0;
+  c->arrays = 0;
+  c->set = 0;
+  c->pending = 0;
+  c->skip = 0;
+  c->in_row = 0;
+  c->in_value = 0;
+  c->last_err = JSSP_SUCCESS;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_columnizer_set_scratch (jssp_columnizer *c,
+                             char *scratch,
+                             size_t size)
+{
+  c->scratch = scratch;
+  c->scratch_size = size;
+}
+
+jssperr_t
+jssp_columnizer_flush (jssp_columnizer *c)
+{
+  jssperr_t err = jssp_column_emit (c);
+
+  if (JSSP_SUCCESS != err)
+    c->last_err = err;
+  return err;
+}
+
+jssperr_t
+jssp_columnizer_event (jssp_columnizer *c,
+                       jssptype_t type,
+                       size_t depth,
+                       const char *key,
+                       size_t key_len,
+                       const char *data,
+                       size_t data_size)
+{
+  jssperr_t err = JSSP_SUCCESS;
+  uint64_t m;
+
+  /* nothing below a container no column reaches into is looked at */
+  if (0 != c->skip)
+    {
+      if (depth == c->skip)
+        c->skip = 0;
+      return JSSP_SUCCESS;
+    }
+
+  switch (type)
+    {
+    case JSSP_ARRAY_OPEN:
+    case JSSP_OBJECT_OPEN:
+      if (1 == depth)
+        {
+          /* one row per top level object */
+          if (JSSP_ARRAY_OPEN == type)
+            {
+              err = JSSP_ERROR_INVAL;
+              break;
+            }
+          c->in_row = 1;
+          c->set = 0;
+          c->arrays = 0;
+          c->match[1] = 0 == c->ncolumns ? 0 : UINT64_MAX >> (64 - c->ncolumns);
+          break;
+        }
+      m = depth <= JSSP_COLUMN_DEPTH
+        ? jssp_column_members (c, depth, key, key_len, 0) : 0;
+      if (0 == m)
+        {
+          c->skip = depth;
+          break;
+        }
+      c->match[depth] = m;
+      if (JSSP_ARRAY_OPEN == type)
+        c->arrays |= UINT64_C(1) << depth;
+      else
+        c->arrays &= ~(UINT64_C(1) << depth);
+      break;
+    case JSSP_ARRAY_CLOSE:
+    case JSSP_OBJECT_CLOSE:
+      if (1 == depth)
+        err = jssp_column_end_row (c);
+      break;
+    case JSSP_ARRAY_VAL:
+    case JSSP_OBJECT_VAL:
+      if (1 == depth)
+        {
+          err = JSSP_ERROR_INVAL;
+          break;
+        }
+      if (!c->in_value)
+        {
+          m = JSSP_OBJECT_VAL == type
+            ? jssp_column_members (c, depth, key, key_len, 1) & ~c->set : 0;
+          if (JSSP_SUCCESS == c->parser->last_err)
+            {
+              err = jssp_column_store_all (c, m, data, data_size);
+              break;
+            }
+          c->pending = m;
+          c->scratch_len = 0;
+          c->in_value = 1;
+        }
+      /* only a projected value split across chunks is joined */
+      if (0 != c->pending && 0 != data_size)
+        {
+          if (data_size > c->scratch_size - c->scratch_len)
+            {
+              jssp_column_debug("Split value longer than %zu bytes", c->scratch_size);
+              err = JSSP_ERROR_NOMEM;
+              break;
+            }
+          memcpy (c->scratch + c->scratch_len, data, data_size);
+          c->scratch_len += data_size;
+        }
+      if (JSSP_SUCCESS == c->parser->last_err)
+        {
+          c->in_value = 0;
+          err = jssp_column_store_all (c, c->pending, c->scratch, c->scratch_len);
+        }
+      break;
+    default:
+      err = JSSP_ERROR_INVAL;
+    }
+  if (JSSP_SUCCESS != err)
+    c->last_err = err;
+  return err;
+}
+
+int
+jssp_columnizer_callback (void *cls,
+                          jssptype_t type,
+                          size_t depth,
+                          size_t index,
+                          const char *key,
+                          size_t key_len,
+                          const char *data,
+                          size_t data_size,
+                          uint64_t stream_offset)
+{
+  return JSSP_SUCCESS != jssp_columnizer_event (cls, type, depth, key, key_len,
+                                                data, data_size);
+}
@@ -0,0 +1,547 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_filter_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_filter_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+/* How common a byte is in JSON text, the rarest byte of a needle is the
+ * one memchr looks for */
+static int
+jssp_filter_rank (unsigned char c)
+{
+  if (c == '"' || c == ' ' || c == ':' || c == ',' || c == '\n'
+    || c == '{' || c == '}' || c == '[' || c == ']')
+    return 3;
+  if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9'))
+    return 2;
+  if (c >= 'A' && c <= 'Z')
+    return 1;
+  return 0;
+}
+
+/* First occurrence of needle i starting in [p, end - needle_len] */
+static const char *
+jssp_filter_find (const jssp_filter *f,
+                  size_t i,
+                  const char *p,
+                  const char *end)
+{
+  const char *n = f->needle[i], *q, *last;
+  size_t len = f->needle_len[i], k = f->pivot[i];
+
+  if ((size_t) (end - p) < len)
+    return NULL;
+  last = end - len + k; /* last place the pivot can be */
+  for (q = p + k; q <= last; q++)
+    {
+      q = memchr (q, n[k], last + 1 - q);
+      if (NULL == q)
+        return NULL;
+      if (0 == memcmp (q - k, n, len))
+        return q - k;
+    }
+  return NULL;
+}
+
+/* A candidate record, without its delimiter */
+static jssperr_t
+jssp_filter_emit (jssp_filter *f,
+                  const char *record,
+                  size_t len,
+                  uint64_t offset)
+{
+  jssperr_t err;
+
+  f->candidates++;
+  if (NULL != f->parser)
+    {
+      err = jssp_parse_chunk (f->parser, record, len, f->buf, f->buf_size,
+                              f->max_key_len, f->cb, f->cls);
+      /* a scalar record only ends with a delimiter the parser knows */
+      if (JSSP_ERROR_PART == err || JSSP_ERROR_BROKEN == err)
+        err = jssp_parse_chunk (f->parser, "\n", 1, f->buf, f->buf_size,
+                                f->max_key_len, f->cb, f->cls);
+      if (JSSP_SUCCESS != err)
+        {
+          jssp_filter_debug("Record at %llu does not parse.", (unsigned long long) offset);
+          f->last_err = JSSP_ERROR_PART == err ? JSSP_ERROR_INVAL : err;
+          return f->last_err;
+        }
+    }
+  if (NULL != f->record && 0 != f->record (f->record_cls, record, len, offset))
+    {
+      f->last_err = JSSP_TERMINATE;
+      return JSSP_TERMINATE;
+    }
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_filter_init (jssp_filter *f,
+                  const char *const *needles,
+                  size_t count,
+                  char delimiter,
+                  char *carry,
+                  size_t carry_size,
+                  jssp_record_callback record,
+                  void *cls)
+{
+  size_t i, k;
+
+  if (0 == count || count > JSSP_FILTER_NEEDLES)
+    return JSSP_ERROR_INVAL;
+  for (i = 0; i < count; i++)
+    {
+      f->needle[i] = needles[i];
+      f->needle_len[i] = strlen (needles[i]);
+      if (0 == f->needle_len[i])
+        return JSSP_ERROR_INVAL;
+      f->pivot[i] = 0;
+      for (k = 1; k < f->needle_len[i]; k++)
+        if (jssp_filter_rank (needles[i][k])
+          < jssp_filter_rank (needles[i][f->pivot[i]]))
+          f->pivot[i] = k;
+    }
+  f->count = count;
+  f->delimiter = delimiter;
+  f->carry = carry;
+  f->carry_size = carry_size;
+  f->carry_len = 0;
+  f->offset = 0;
+  f->parser = NULL;
+  f->record = record;
+  f->record_cls = cls;
+  f->candidates = 0;
+  f->last_err = JSSP_SUCCESS;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_filter_set_parser (jssp_filter *f,
+                        jssp_parser *parser,
+                        void *buf,
+                        size_t buf_size,
+                        size_t max_key_len,
+                        jssp_process_callback cb,
+                        void *cls)
+{
+  f->parser = parser;
+  f->buf = buf;
+  f->buf_size = buf_size;
+  f->max_key_len = max_key_len;
+  f->cb = cb;
+  f->cls = cls;
+}
+
+/* The carried record, complete or at the end of the stream */
+static jssperr_t
+jssp_filter_carried (jssp_filter *f)
+{
+  size_t i, n = f->carry_len;
+  uint64_t offset = f->offset - n;
+
+  f->carry_len = 0;
+  if (n > 0 && f->carry[n - 1] == f->delimiter)
+    n--;
+  for (i = 0; i < f->count; i++)
+    if (NULL != jssp_filter_find (f, i, f->carry, f->carry + n))
+      return jssp_filter_emit (f, f->carry, n, offset);
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_filter_feed (jssp_filter *f,
+                  const char *data,
+                  size_t len)
+{
+  const char *p = data, *end = data + len, *tail, *hit, *start, *stop;
+  const char *next[JSSP_FILTER_NEEDLES];
+  uint64_t base = f->offset; /* stream offset of data */
+  size_t i, n;
+
+  if (JSSP_SUCCESS != f->last_err)
+    return f->last_err;
+
+  /* finish the record the last chunk ended in */
+  if (f->carry_len > 0)
+    {
+      stop = memchr (p, f->delimiter, len);
+      n = NULL != stop ? (size_t) (stop + 1 - p) : len;
+      if (f->carry_len + n > f->carry_size)
+        {
+          jssp_filter_debug("Record exceeds %zu carry bytes.", f->carry_size);
+          f->last_err = JSSP_ERROR_NOMEM;
+          return JSSP_ERROR_NOMEM;
+        }
+      memcpy (f->carry + f->carry_len, p, n);
+      f->carry_len += n;
+      f->offset = base + n;
+      p += n;
+      if (NULL == stop)
+        return JSSP_SUCCESS;
+      if (JSSP_SUCCESS != jssp_filter_carried (f))
+        return f->last_err;
+    }
+
+  /* whole records end at the last delimiter */
+  for (tail = end; tail > p && tail[-1] != f->delimiter; tail--)
+    ;
+
+  /* jump from hit to hit, the records in between are never looked at */
+  for (i = 0; i < f->count; i++)
+    next[i] = jssp_filter_find (f, i, p, end);
+  for (;;)
+    {
+      hit = NULL;
+      for (i = 0; i < f->count; i++)
+        if (NULL != next[i] && next[i] < tail && (NULL == hit || next[i] < hit))
+          hit = next[i];
+      if (NULL == hit)
+        break;
+      for (start = hit; start > p && start[-1] != f->delimiter; start--)
+        ;
+      stop = memchr (hit, f->delimiter, tail - hit);
+      if (JSSP_SUCCESS != jssp_filter_emit (f, start, stop - start,
+                                            base + (start - data)))
+        return f->last_err;
+      p = stop + 1;
+      for (i = 0; i < f->count; i++)
+        if (NULL != next[i] && next[i] < p)
+          next[i] = jssp_filter_find (f, i, p, end);
+    }
+
+  n = end - tail;
+  if (n > f->carry_size)
+    {
+      jssp_filter_debug("Record exceeds %zu carry bytes.", f->carry_size);
+      f->last_err = JSSP_ERROR_NOMEM;
+      return JSSP_ERROR_NOMEM;
+    }
+  memcpy (f->carry, tail, n);
+  f->carry_len = n;
+  f->offset = base + len;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_filter_finish (jssp_filter *f)
+{
+  if (JSSP_SUCCESS != f->last_err)
+    return f->last_err;
+  return jssp_filter_carried (f);
+}
+
+/* splitmix64, seeded runs are reproducible */
+static uint64_t
+jssp_sampler_random (jssp_sampler *s)
+{
+  uint64_t z = (s->rng += UINT64_C(0x9E3779B97F4A7C15));
+
+  z = (z ^ (z >> 30)) * UINT64_C(0xBF58476D1CE4E5B9);
+  z = (z ^ (z >> 27)) * UINT64_C(0x94D049BB133111EB);
+  return z ^ (z >> 31);
+}
+
+/* Header of a reservoir slot, the record follows */
+typedef struct
+{
+  uint64_t offset;
+  size_t len;
+} jssp_sampler_slot;
+
+#define jssp_sampler_slot_at(s, i) \
+  ((jssp_sampler_slot *) ((s)->slots + (i) * (s)->slot_size))
+
+/* Start over after a record that did not parse, keeping the settings */
+static void
+jssp_sampler_reset (jssp_parser *parser)
+{
+  const jssp_allocator *allocator = parser->allocator;
+  jssp_limits *limits = parser->limits;
+  jssp_fingerprint *fingerprint = parser->fingerprint;
+  unsigned int options = parser->options;
+
+  jssp_release (parser);
+  jssp_init (parser);
+  jssp_set_allocator (parser, allocator);
+  jssp_set_options (parser, options);
+  jssp_set_limits (parser, limits);
+  jssp_set_fingerprint (parser, fingerprint);
+}
+
+/* Parse a piece of the current record, the last piece with done set */
+static jssperr_t
+jssp_sampler_parse (jssp_sampler *s,
+                    const char *data,
+                    size_t len,
+                    int done)
+{
+  jssperr_t err = JSSP_ERROR_PART;
+
+  if (len > 0 || !done)
+    err = jssp_parse_chunk (s->parser, data, len, s->buf, s->buf_size,
+                            s->max_key_len, s->cb, s->cls);
+  if (done && (JSSP_ERROR_PART == err || JSSP_ERROR_BROKEN == err))
+    err = jssp_parse_chunk (s->parser, "\n", 1, s->buf, s->buf_size,
+                            s->max_key_len, s->cb, s->cls);
+  switch (err)
+    {
+    case JSSP_SUCCESS:
+      return JSSP_SUCCESS;
+    case JSSP_ERROR_PART:
+    case JSSP_ERROR_BROKEN:
+      if (!done)
+        return JSSP_SUCCESS;
+      /* no break */
+    case JSSP_ERROR_INVAL:
+    case JSSP_ERROR_LIMIT:
+      /* a broken or oversized record costs only itself */
+      jssp_filter_debug("Sampled record does not parse.");
+      s->errors++;
+      s->take = 0;
+      jssp_sampler_reset (s->parser);
+      return JSSP_SUCCESS;
+    default:
+      s->last_err = err;
+      return err;
+    }
+}
+
+/* Whether the record starting now is in the sample */
+static void
+jssp_sampler_pick (jssp_sampler *s)
+{
+  uint64_t j;
+
+  s->records++;
+  switch (s->mode)
+    {
+    case JSSP_SAMPLE_STRIDE:
+      s->take = 0 == (s->records - 1) % s->stride;
+      break;
+    case JSSP_SAMPLE_RATE:
+      s->take = UINT64_MAX == s->threshold
+        || jssp_sampler_random (s) < s->threshold;
+      break;
+    case JSSP_SAMPLE_RESERVOIR:
+      /* algorithm R over the records that fit, the record goes to the
+       * spare slot and replaces a random one once it is complete */
+      s->take = 1;
+      if (s->records - s->skipped > s->k)
+        {
+          j = jssp_sampler_random (s) % (s->records - s->skipped);
+          s->take = j < s->k;
+          s->victim = j < s->spare ? j : j + 1;
+        }
+      if (s->take)
+        jssp_sampler_slot_at(s, s->spare)->len = 0;
+      break;
+    }
+  /* a reservoir record may still be replaced */
+  if (s->take && JSSP_SAMPLE_RESERVOIR != s->mode)
+    s->selected++;
+}
+
+/* Copy a piece of the current record to the spare slot */
+static jssperr_t
+jssp_sampler_keep (jssp_sampler *s,
+                   const char *data,
+                   size_t len,
+                   int done)
+{
+  jssp_sampler_slot *slot = jssp_sampler_slot_at(s, s->spare);
+
+  if (len > s->slot_size - sizeof(*slot) - slot->len)
+    {
+      /* the spare slot stays spare and the sample as it was */
+      jssp_filter_debug("Record exceeds a %zu byte slot.", s->slot_size);
+      s->skipped++;
+      s->take = 0;
+      return JSSP_SUCCESS;
+    }
+  memcpy ((char *) (slot + 1) + slot->len, data, len);
+  slot->len += len;
+  if (done)
+    {
+      slot->offset = s->record_offset;
+      /* slots fill up in order, then the replaced record's slot is the
+       * spare one */
+      s->spare = s->records - s->skipped <= s->k ? s->records - s->skipped : s->victim;
+    }
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_sampler_init (jssp_sampler *s,
+                   jssp_parser *parser,
+                   void *buf,
+                   size_t buf_size,
+                   size_t max_key_len,
+                   jssp_process_callback cb,
+                   void *cls)
+{
+  s->mode = JSSP_SAMPLE_STRIDE;
+  s->delimiter = '\n';
+  s->stride = 1;
+  s->threshold = 0;
+  s->rng = 0;
+  s->slots = NULL;
+  s->slot_size = 0;
+  s->k = 0;
+  s->spare = 0;
+  s->victim = 0;
+  s->records = 0;
+  s->selected = 0;
+  s->errors = 0;
+  s->skipped = 0;
+  s->offset = 0;
+  s->record_offset = 0;
+  s->in_record = 0;
+  s->take = 0;
+  s->parser = parser;
+  s->buf = buf;
+  s->buf_size = buf_size;
+  s->max_key_len = max_key_len;
+  s->cb = cb;
+  s->cls = cls;
+  s->last_err = JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_sampler_set_stride (jssp_sampler *s,
+                         uint64_t stride)
+{
+  if (0 == stride)
+    return JSSP_ERROR_INVAL;
+  s->mode = JSSP_SAMPLE_STRIDE;
+  s->stride = stride;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_sampler_set_rate (jssp_sampler *s,
+                       double rate,
+                       uint64_t seed)
+{
+  if (!(rate >= 0 && rate <= 1))
+    return JSSP_ERROR_INVAL;
+  s->mode = JSSP_SAMPLE_RATE;
+  /* a record is taken when a draw is below rate * 2^64 */
+  s->threshold = rate >= 1 ? UINT64_MAX
+    : (uint64_t) (rate * 18446744073709551616.0);
+  s->rng = seed;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_sampler_set_reservoir (jssp_sampler *s,
+                            size_t k,
+                            void *storage,
+                            size_t size,
+                            uint64_t seed)
+{
+  /* one slot more than k takes the incoming record */
+  if (0 == k || size / (k + 1) <= sizeof(jssp_sampler_slot))
+    return JSSP_ERROR_INVAL;
+  s->mode = JSSP_SAMPLE_RESERVOIR;
+  s->slots = storage;
+  s->slot_size = size / (k + 1) / sizeof(uint64_t) * sizeof(uint64_t);
+  s->k = k;
+  s->spare = 0;
+  s->rng = seed;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_sampler_feed (jssp_sampler *s,
+                   const char *data,
+                   size_t len)
+{
+  const char *p = data, *end = data + len, *stop;
+  uint64_t base = s->offset; /* stream offset of data */
+  jssperr_t err;
+  int done;
+
+  if (JSSP_SUCCESS != s->last_err)
+    return s->last_err;
+  while (p < end)
+    {
+      if (!s->in_record)
+        {
+          /* empty lines are no records */
+          if (*p == s->delimiter)
+            {
+              p++;
+              continue;
+            }
+          s->in_record = 1;
+          s->record_offset = base + (p - data);
+          jssp_sampler_pick (s);
+        }
+      /* records not taken cost a memchr */
+      stop = memchr (p, s->delimiter, end - p);
+      done = NULL != stop;
+      if (!done)
+        stop = end;
+      if (s->take)
+        {
+          if (JSSP_SAMPLE_RESERVOIR == s->mode)
+            err = jssp_sampler_keep (s, p, stop - p, done);
+          else
+            err = jssp_sampler_parse (s, p, stop - p, done);
+          if (JSSP_SUCCESS != err)
+            return err;
+        }
+      if (!done)
+        break;
+      s->in_record = 0;
+      p = stop + 1;
+    }
+  s->offset = base + len;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_sampler_finish (jssp_sampler *s)
+{
+  jssp_sampler_slot *slot;
+  jssperr_t err = JSSP_SUCCESS;
+  size_t i, n;
+
+  if (JSSP_SUCCESS != s->last_err)
+    return s->last_err;
+  /* the last record did not end in a delimiter */
+  if (s->in_record && s->take)
+    {
+      if (JSSP_SAMPLE_RESERVOIR == s->mode)
+        err = jssp_sampler_keep (s, "", 0, 1);
+      else
+        err = jssp_sampler_parse (s, "", 0, 1);
+      if (JSSP_SUCCESS != err)
+        return err;
+    }
+  s->in_record = 0;
+  if (JSSP_SAMPLE_RESERVOIR != s->mode)
+    return JSSP_SUCCESS;
+
+  /* every slot but the spare one holds a sampled record */
+  n = s->records - s->skipped < s->k ? s->records - s->skipped : s->k;
+  s->selected = n;
+  for (i = 0; i <= s->k && n > 0; i++)
+    {
+      if (i == s->spare)
+        continue;
+      slot = jssp_sampler_slot_at(s, i);
+      s->take = 1;
+      err = jssp_sampler_parse (s, (const char *) (slot + 1), slot->len, 1);
+      if (JSSP_SUCCESS != err)
+        return err;
+      n--;
+    }
+  return JSSP_SUCCESS;
+}
@@ -0,0 +1,239 @@
+#include <string.h>
+
+#include "jssp.h"
+
+/* XXH64 */
+#define JSSP_HASH_P1 UINT64_C(0x9E3779B185EBCA87)
+#define JSSP_HASH_P2 UINT64_C(0xC2B2AE3D27D4EB4F)
+#define JSSP_HASH_P3 UINT64_C(0x165667B19E3779F9)
+#define JSSP_HASH_P4 UINT64_C(0x85EBCA77C2B2AE63)
+#define JSSP_HASH_P5 UINT64_C(0x27D4EB2F165667C5)
+
+#define jssp_hash_rotl(x, r) (((x) << (r)) | ((x) >> (64 - (r))))
+
+static inline uint64_t
+jssp_hash_read64 (const unsigned char *p)
+{
+  uint64_t v;
+
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  memcpy (&v, p, 8);
+#else
+  int i;
+
+  for (v = 0, i = 7; i >= 0; i--)
+    v = v << 8 | p[i];
+#endif
+  return v;
+}
+
+static inline uint64_t
+jssp_hash_round (uint64_t acc,
+                 uint64_t input)
+{
+  acc += input * JSSP_HASH_P2;
+  acc = jssp_hash_rotl(acc, 31);
+  return acc * JSSP_HASH_P1;
+}
+
+static inline uint64_t
+jssp_hash_merge (uint64_t acc,
+                 uint64_t v)
+{
+  acc ^= jssp_hash_round (0, v);
+  return acc * JSSP_HASH_P1 + JSSP_HASH_P4;
+}
+
+/* Whole 32 byte stripes of p, returns the bytes consumed */
+static size_t
+jssp_hash_stripes (jssp_hash *h,
+                   const unsigned char *p,
+                   size_t len)
+{
+  const unsigned char *s = p;
+  uint64_t v1 = h->v[0], v2 = h->v[1], v3 = h->v[2], v4 = h->v[3];
+
+  for (; len >= 32; p += 32, len -= 32)
+    {
+      v1 = jssp_hash_round (v1, jssp_hash_read64 (p));
+      v2 = jssp_hash_round (v2, jssp_hash_read64 (p + 8));
+      v3 = jssp_hash_round (v3, jssp_hash_read64 (p + 16));
+      v4 = jssp_hash_round (v4, jssp_hash_read64 (p + 24));
+    }
+  h->v[0] = v1;
+  h->v[1] = v2;
+  h->v[2] = v3;
+  h->v[3] = v4;
+  return p - s;
+}
+
+void
+jssp_hash_init (jssp_hash *h,
+                uint64_t seed)
+{
+  h->v[0] = seed + JSSP_HASH_P1 + JSSP_HASH_P2;
+  h->v[1] = seed + JSSP_HASH_P2;
+  h->v[2] = seed;
+  h->v[3] = seed - JSSP_HASH_P1;
+  h->seed = seed;
+  h->total = 0;
+  h->mem_len = 0;
+}
+
+void
+jssp_hash_update (jssp_hash *h,
+                  const void *data,
+                  size_t len)
+{
+  const unsigned char *p = data;
+  size_t n;
+
+  h->total += len;
+  if (h->mem_len + len < 32)
+    {
+      if (len > 0)
+        memcpy (h->mem + h->mem_len, p, len);
+      h->mem_len += len;
+      return;
+    }
+  if (h->mem_len > 0)
+    {
+      n = 32 - h->mem_len;
+      memcpy (h->mem + h->mem_len, p, n);
+      jssp_hash_stripes (h, h->mem, 32);
+      p += n;
+      len -= n;
+      h->mem_len = 0;
+    }
+  n = jssp_hash_stripes (h, p, len);
+  memcpy (h->mem, p + n, len - n);
+  h->mem_len = len - n;
+}
+
+uint64_t
+jssp_hash_digest (const jssp_hash *h)
+{
+  const unsigned char *p = h->mem, *end = h->mem + h->mem_len;
+  uint64_t d, k;
+  uint32_t w;
+
+  if (h->total >= 32)
+    {
+      d = jssp_hash_rotl(h->v[0], 1) + jssp_hash_rotl(h->v[1], 7)
+        + jssp_hash_rotl(h->v[2], 12) + jssp_hash_rotl(h->v[3], 18);
+      d = jssp_hash_merge (d, h->v[0]);
+      d = jssp_hash_merge (d, h->v[1]);
+      d = jssp_hash_merge (d, h->v[2]);
+      d = jssp_hash_merge (d, h->v[3]);
+    }
+  else
+    d = h->seed + JSSP_HASH_P5;
+  d += h->total;
+
+  for (; p + 8 <= end; p += 8)
+    {
+      k = jssp_hash_round (0, jssp_hash_read64 (p));
+      d ^= k;
+      d = jssp_hash_rotl(d, 27) * JSSP_HASH_P1 + JSSP_HASH_P4;
+    }
+  if (p + 4 <= end)
+    {
+      w = (uint32_t) p[0] | (uint32_t) p[1] << 8 | (uint32_t) p[2] << 16
+        | (uint32_t) p[3] << 24;
+      d ^= w * JSSP_HASH_P1;
+      d = jssp_hash_rotl(d, 23) * JSSP_HASH_P2 + JSSP_HASH_P3;
+      p += 4;
+    }
+  for (; p < end; p++)
+    {
+      d ^= *p * JSSP_HASH_P5;
+      d = jssp_hash_rotl(d, 11) * JSSP_HASH_P1;
+    }
+
+  d ^= d >> 33;
+  d *= JSSP_HASH_P2;
+  d ^= d >> 29;
+  d *= JSSP_HASH_P3;
+  d ^= d >> 32;
+  return d;
+}
+
+void
+jssp_fingerprint_init (jssp_fingerprint *f,
+                       jsspfingerprint_t mode,
+                       uint64_t seed)
+{
+  f->seed = seed;
+  f->mode = mode;
+  jssp_fingerprint_begin (f, 0);
+}
+
+void
+jssp_fingerprint_begin (jssp_fingerprint *f,
+                        uint64_t offset)
+{
+  jssp_hash_init (&f->hash, f->seed);
+  f->start = offset;
+  f->end = offset;
+  f->digest = 0;
+  f->in_string = 0;
+  f->escape = 0;
+}
+
+void
+jssp_fingerprint_update (jssp_fingerprint *f,
+                         const char *data,
+                         size_t len)
+{
+  const char *p = data, *end = data + len, *run;
+
+  f->end += len;
+  if (JSSP_FINGERPRINT_RAW == f->mode)
+    {
+      jssp_hash_update (&f->hash, data, len);
+      return;
+    }
+  /* only whitespace between tokens is dropped, strings are kept whole */
+  while (p < end)
+    {
+      run = p;
+      if (f->in_string)
+        {
+          for (; p < end; p++)
+            {
+              if (f->escape)
+                f->escape = 0;
+              else if (*p == '\\')
+                f->escape = 1;
+              else if (*p == '"')
+                {
+                  f->in_string = 0;
+                  p++;
+                  break;
+                }
+            }
+          jssp_hash_update (&f->hash, run, p - run);
+          continue;
+        }
+      while (p < end && *p != '"' && *p != ' ' && *p != '\n'
+        && *p != '\r' && *p != '\t')
+        p++;
+      if (p < end && *p == '"')
+        {
+          f->in_string = 1;
+          p++;
+          jssp_hash_update (&f->hash, run, p - run);
+          continue;
+        }
+      if (p > run)
+        jssp_hash_update (&f->hash, run, p - run);
+      while (p < end && (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t'))
+        p++;
+    }
+}
+
+void
+jssp_fingerprint_end (jssp_fingerprint *f)
+{
+  f->digest = jssp_hash_digest (&f->hash);
+}
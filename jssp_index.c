@@ -0,0 +1,324 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_index_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_index_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+#define JSSP_INDEX_ONES 0x0101010101010101ULL
+#define JSSP_INDEX_HIGHS 0x8080808080808080ULL
+/* Exact per byte, no borrow between bytes */
+#define jssp_index_iszero(v) \
+  (~((((v) & ~JSSP_INDEX_HIGHS) + ~JSSP_INDEX_HIGHS) | (v)) & JSSP_INDEX_HIGHS)
+
+#define jssp_index_is_space(c) \
+  ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+#define jssp_index_is_delimiter(c) \
+  (jssp_index_is_space(c) || (c) == ',' || (c) == ':' || (c) == ']' || (c) == '}')
+
+#define JSSP_INDEX_NONE UINT64_MAX
+
+/* Closing quote of the string whose body starts at pos, or end */
+static const char *
+jssp_index_string_end (const char *pos,
+                       const char *end)
+{
+  for (;;)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint64_t v, m;
+
+      while (pos + 8 <= end)
+        {
+          memcpy (&v, pos, 8);
+          m = jssp_index_iszero(v ^ (JSSP_INDEX_ONES * '"'))
+            | jssp_index_iszero(v ^ (JSSP_INDEX_ONES * '\\'));
+          if (0 != m)
+            {
+              pos += __builtin_ctzll (m) / 8;
+              break;
+            }
+          pos += 8;
+        }
+#endif
+      while (pos < end && *pos != '"' && *pos != '\\')
+        pos++;
+      if (pos >= end || *pos == '"')
+        return pos;
+      /* skip the escaped byte */
+      pos += 2;
+      if (pos > end)
+        return end;
+    }
+}
+
+/* Room for one more entry */
+static jssperr_t
+jssp_index_reserve (jssp_index *idx)
+{
+  size_t cap;
+  jsspindexentry_t *entries;
+
+  if (idx->len < idx->cap)
+    return JSSP_SUCCESS;
+  if (NULL == idx->allocator)
+    {
+      jssp_index_debug("Index of %zu entries is full.", idx->cap);
+      return JSSP_ERROR_NOMEM;
+    }
+  cap = idx->cap > 0 ? idx->cap * 2 : 64;
+  if (0 != idx->allocator->max_size
+    && cap * sizeof(jsspindexentry_t) > idx->allocator->max_size)
+    return JSSP_ERROR_NOMEM;
+  /* the caller's buffer is never handed to realloc */
+  entries = idx->allocator->realloc (idx->allocator->cls,
+                                     idx->heap ? idx->entries : NULL,
+                                     cap * sizeof(jsspindexentry_t));
+  if (NULL == entries)
+    return JSSP_ERROR_NOMEM;
+  if (!idx->heap && idx->len > 0)
+    memcpy (entries, idx->entries, idx->len * sizeof(jsspindexentry_t));
+  idx->entries = entries;
+  idx->cap = cap;
+  idx->heap = 1;
+  return JSSP_SUCCESS;
+}
+
+#define jssp_index_add(idx, off, nxt) do { \
+  if (JSSP_SUCCESS != jssp_index_reserve (idx)) \
+    return JSSP_ERROR_NOMEM; \
+  (idx)->entries[(idx)->len].offset = (off); \
+  (idx)->entries[(idx)->len].next = (nxt); \
+  (idx)->len++; \
+} while (0)
+
+void
+jssp_index_init (jssp_index *idx,
+                 void *buf,
+                 size_t size,
+                 const jssp_allocator *allocator)
+{
+  idx->entries = buf;
+  idx->cap = size / sizeof(jsspindexentry_t);
+  idx->len = 0;
+  idx->js = NULL;
+  idx->js_len = 0;
+  idx->allocator = allocator;
+  idx->heap = 0;
+  idx->map = NULL;
+  idx->map_size = 0;
+  idx->unmap = NULL;
+}
+
+void
+jssp_index_release (jssp_index *idx)
+{
+  if (idx->heap)
+    idx->allocator->free (idx->allocator->cls, idx->entries);
+  if (NULL != idx->map)
+    idx->unmap (idx->map, idx->map_size);
+  idx->map = NULL;
+  idx->heap = 0;
+  idx->entries = NULL;
+  idx->cap = 0;
+  idx->len = 0;
+}
+
+jssperr_t
+jssp_index_build (jssp_index *idx,
+                  const char *js,
+                  size_t len)
+{
+  const char *pos = js, *end = js + len;
+  uint64_t open = JSSP_INDEX_NONE, o;
+
+  idx->js = js;
+  idx->js_len = len;
+  idx->len = 0;
+  if (len >= 3 && memcmp (js, "\xEF\xBB\xBF", 3) == 0)
+    pos += 3;
+
+  while (pos < end)
+    {
+      switch (*pos)
+        {
+        case ' ': case '\n': case '\r': case '\t':
+        case ',': case ':':
+          pos++;
+          continue;
+        case '[':
+        case '{':
+          /* next links to the enclosing container until this one closes */
+          jssp_index_add(idx, pos - js, open);
+          open = idx->len - 1;
+          pos++;
+          continue;
+        case ']':
+        case '}':
+          if (JSSP_INDEX_NONE == open)
+            {
+              jssp_index_debug("Unbalanced %c at %zu", *pos, (size_t) (pos - js));
+              return JSSP_ERROR_INVAL;
+            }
+          jssp_index_add(idx, pos - js, idx->len + 1);
+          o = open;
+          open = idx->entries[o].next;
+          idx->entries[o].next = idx->len;
+          pos++;
+          continue;
+        case '"':
+          jssp_index_add(idx, pos - js, idx->len + 1);
+          pos = jssp_index_string_end (pos + 1, end);
+          if (pos >= end)
+            return JSSP_ERROR_PART;
+          pos++;
+          continue;
+        default:
+          jssp_index_add(idx, pos - js, idx->len + 1);
+          while (pos < end && !jssp_index_is_delimiter(*pos))
+            pos++;
+          continue;
+        }
+    }
+  return JSSP_INDEX_NONE == open ? JSSP_SUCCESS : JSSP_ERROR_PART;
+}
+
+/* Text of entry i, NULL when a damaged table points outside js */
+static const char *
+jssp_index_at (const jssp_index *idx,
+               size_t i)
+{
+  if (i >= idx->len || idx->entries[i].offset >= idx->js_len)
+    return NULL;
+  return idx->js + idx->entries[i].offset;
+}
+
+/* Entry after the value at k, SIZE_MAX unless it moves forward within
+ * the table, which ends every walk over a damaged one */
+#define jssp_index_next(idx, k) \
+  ((idx)->entries[k].next > (k) && (idx)->entries[k].next <= (idx)->len \
+   ? (size_t) (idx)->entries[k].next : SIZE_MAX)
+
+/* Type of the value starting at v */
+static jssptapetype_t
+jssp_index_type (const char *v)
+{
+  switch (*v)
+    {
+    case '[': return JSSP_TAPE_ARRAY;
+    case '{': return JSSP_TAPE_OBJECT;
+    case '"': return JSSP_TAPE_STRING;
+    case 't': return JSSP_TAPE_TRUE;
+    case 'f': return JSSP_TAPE_FALSE;
+    case 'n': return JSSP_TAPE_NULL;
+    default: return JSSP_TAPE_NUMBER;
+    }
+}
+
+const char *
+jssp_index_lookup (const jssp_index *idx,
+                   const char *pointer,
+                   size_t *value_len,
+                   jssptapetype_t *type)
+{
+  char seg[256];
+  const char *p = pointer, *key, *v, *close, *end = idx->js + idx->js_len;
+  size_t i = 0, k, stop, n, index;
+  jssptapetype_t t;
+
+  if (0 == idx->len)
+    return NULL;
+  /* RFC 6901: "/a/0/b", with ~1 for '/' and ~0 for '~' in keys */
+  while (*p == '/')
+    {
+      for (p++, n = 0; *p != '\0' && *p != '/'; p++, n++)
+        {
+          if (n >= sizeof(seg))
+            return NULL;
+          seg[n] = *p;
+          if (*p == '~' && (p[1] == '0' || p[1] == '1'))
+            seg[n] = *++p == '0' ? '~' : '/';
+        }
+
+      v = jssp_index_at (idx, i);
+      stop = jssp_index_next(idx, i);
+      if (NULL == v || SIZE_MAX == stop)
+        return NULL;
+      t = jssp_index_type (v);
+      stop--; /* the closing bracket */
+      k = i + 1;
+      if (JSSP_TAPE_OBJECT == t)
+        {
+          /* keys are compared raw, a member is a key and a value entry */
+          for (; k < stop; k = jssp_index_next(idx, k + 1))
+            {
+              key = jssp_index_at (idx, k);
+              if (NULL == key)
+                return NULL;
+              key++;
+              if (key + n < end && key[n] == '"' && 0 == memcmp (key, seg, n))
+                break;
+            }
+          if (k >= stop)
+            return NULL;
+          i = k + 1;
+        }
+      else if (JSSP_TAPE_ARRAY == t)
+        {
+          /* decimal index without leading zeros */
+          if (0 == n || (seg[0] == '0' && n > 1))
+            return NULL;
+          for (index = 0, k = 0; k < n; k++)
+            {
+              if (seg[k] < '0' || seg[k] > '9' || index >= SIZE_MAX / 10)
+                return NULL;
+              index = index * 10 + (seg[k] - '0');
+            }
+          for (k = i + 1; k < stop && index > 0; index--)
+            k = jssp_index_next(idx, k);
+          if (k >= stop)
+            return NULL;
+          i = k;
+        }
+      else
+        return NULL;
+    }
+  if (*p != '\0')
+    return NULL;
+
+  /* decode the value's extent only now */
+  v = jssp_index_at (idx, i);
+  if (NULL == v)
+    return NULL;
+  t = jssp_index_type (v);
+  switch (t)
+    {
+    case JSSP_TAPE_ARRAY:
+    case JSSP_TAPE_OBJECT:
+      k = jssp_index_next(idx, i);
+      close = SIZE_MAX == k ? NULL : jssp_index_at (idx, k - 1);
+      if (NULL == close || close < v)
+        return NULL;
+      *value_len = close + 1 - v;
+      break;
+    case JSSP_TAPE_STRING:
+      close = jssp_index_string_end (v + 1, end);
+      if (close >= end)
+        return NULL;
+      *value_len = close + 1 - v;
+      break;
+    default:
+      for (k = 0; v + k < end && !jssp_index_is_delimiter(v[k]); k++)
+        ;
+      *value_len = k;
+      break;
+    }
+  if (NULL != type)
+    *type = t;
+  return v;
+}
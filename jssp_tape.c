@@ -0,0 +1,349 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_tape_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_tape_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+#define jssp_tape_word(type, payload) \
+  ((uint64_t) (type) << 56 | ((uint64_t) (payload) & JSSP_TAPE_PAYLOAD))
+
+/* Words holding n bytes of inline text */
+#define jssp_tape_text_words(n) (((n) + 7) / 8)
+
+/* While a container is open its word links to the enclosing open one and
+ * counts the elements so far; both are final once it closes */
+#define jssp_tape_open_word(type, prev, count) \
+  jssp_tape_word(type, ((uint64_t) (prev) & 0xFFFFFFFFU) | (uint64_t) (count) << 32)
+#define jssp_tape_open_prev(w) ((size_t) ((w) & 0xFFFFFFFFU))
+#define jssp_tape_open_count(w) ((size_t) (((w) & JSSP_TAPE_PAYLOAD) >> 32))
+#define JSSP_TAPE_MAX_COUNT ((1U << 24) - 1)
+
+/* Room for n more words, grown through the allocator if there is one */
+static jssperr_t
+jssp_tape_reserve (jssp_tape *t,
+                   size_t n)
+{
+  size_t cap;
+  uint64_t *words;
+
+  if (t->len + n <= t->cap)
+    return JSSP_SUCCESS;
+  if (NULL == t->allocator)
+    {
+      jssp_tape_debug("Tape of %zu words is full.", t->cap);
+      return JSSP_ERROR_NOMEM;
+    }
+  cap = t->cap > 0 ? t->cap : 64;
+  while (cap < t->len + n)
+    cap *= 2;
+  if (0 != t->allocator->max_size && cap * sizeof(uint64_t) > t->allocator->max_size)
+    return JSSP_ERROR_NOMEM;
+  /* the caller's buffer is never handed to realloc */
+  words = t->allocator->realloc (t->allocator->cls, t->heap ? t->words : NULL,
+                                 cap * sizeof(uint64_t));
+  if (NULL == words)
+    return JSSP_ERROR_NOMEM;
+  if (!t->heap)
+    memcpy (words, t->words, t->len * sizeof(uint64_t));
+  t->words = words;
+  t->cap = cap;
+  t->heap = 1;
+  return JSSP_SUCCESS;
+}
+
+/* Append bytes to the text that starts at word t->text */
+static jssperr_t
+jssp_tape_append (jssp_tape *t,
+                  const char *data,
+                  size_t len)
+{
+  size_t have = t->words[t->text] & JSSP_TAPE_PAYLOAD;
+  size_t need = jssp_tape_text_words(have + len) - jssp_tape_text_words(have);
+
+  if (JSSP_SUCCESS != jssp_tape_reserve (t, need))
+    return JSSP_ERROR_NOMEM;
+  /* no stale bytes after the text, equal documents give equal tapes */
+  memset (t->words + t->len, 0, need * sizeof(uint64_t));
+  memcpy ((char *) (t->words + t->text + 1) + have, data, len);
+  t->len += need;
+  t->words[t->text] += len;
+  return JSSP_SUCCESS;
+}
+
+/* Start a text word of the given type. Complete text lying in the source
+ * is referenced where it is, anything else is copied inline. */
+static jssperr_t
+jssp_tape_text (jssp_tape *t,
+                jssptapetype_t type,
+                const char *data,
+                size_t len,
+                int complete)
+{
+  if (JSSP_SUCCESS != jssp_tape_reserve (t, 1))
+    return JSSP_ERROR_NOMEM;
+  t->text = t->len;
+  if (complete && data >= t->source && data + len <= t->source + t->source_len
+    && len <= JSSP_TAPE_MAX_COUNT && NULL != data)
+    {
+      t->words[t->len++] = jssp_tape_word(type | JSSP_TAPE_REF,
+                                          (uint64_t) (data - t->source) << 24 | len);
+      return JSSP_SUCCESS;
+    }
+  t->words[t->len++] = jssp_tape_word(type, 0);
+  return jssp_tape_append (t, data, len);
+}
+
+/* One more element in the open container */
+#define jssp_tape_count(t) do { \
+  if (SIZE_MAX != (t)->open \
+    && jssp_tape_open_count((t)->words[(t)->open]) < JSSP_TAPE_MAX_COUNT) \
+    (t)->words[(t)->open] += (uint64_t) 1 << 32; \
+} while (0)
+
+void
+jssp_tape_init (jssp_tape *t,
+                const jssp_parser *parser,
+                void *buf,
+                size_t size,
+                const jssp_allocator *allocator)
+{
+  t->words = buf;
+  t->cap = size / sizeof(uint64_t);
+  t->len = 0;
+  t->open = SIZE_MAX;
+  t->text = 0;
+  t->parser = parser;
+  t->source = NULL;
+  t->source_len = 0;
+  t->allocator = allocator;
+  t->heap = 0;
+  t->in_value = 0;
+  t->last_err = JSSP_SUCCESS;
+}
+
+void
+jssp_tape_set_source (jssp_tape *t,
+                      const char *js,
+                      size_t len)
+{
+  t->source = js;
+  t->source_len = len < (UINT64_C(1) << 32) ? len : (UINT64_C(1) << 32) - 1;
+}
+
+const char *
+jssp_tape_string (const jssp_tape *t,
+                  size_t i,
+                  size_t *len)
+{
+  uint64_t w = t->words[i];
+
+  if (w >> 56 & JSSP_TAPE_REF)
+    {
+      *len = (size_t) (w & JSSP_TAPE_MAX_COUNT);
+      return t->source + ((w & JSSP_TAPE_PAYLOAD) >> 24);
+    }
+  *len = (size_t) (w & JSSP_TAPE_PAYLOAD);
+  return (const char *) (t->words + i + 1);
+}
+
+void
+jssp_tape_release (jssp_tape *t)
+{
+  if (t->heap)
+    t->allocator->free (t->allocator->cls, t->words);
+  t->heap = 0;
+  t->words = NULL;
+  t->cap = 0;
+  t->len = 0;
+}
+
+jssperr_t
+jssp_tape_event (jssp_tape *t,
+                 jssptype_t type,
+                 const char *key,
+                 size_t key_len,
+                 const char *data,
+                 size_t data_size)
+{
+  jssperr_t err = JSSP_SUCCESS;
+  size_t open;
+  uint64_t w;
+  int object = SIZE_MAX != t->open
+    && JSSP_TAPE_OBJECT == jssp_tape_type(t, t->open);
+
+  switch (type)
+    {
+    case JSSP_ARRAY_OPEN:
+    case JSSP_OBJECT_OPEN:
+      if (object && JSSP_SUCCESS != (err = jssp_tape_text (t, JSSP_TAPE_STRING, key, key_len, 1)))
+        break;
+      if (JSSP_SUCCESS != (err = jssp_tape_reserve (t, 1)))
+        break;
+      jssp_tape_count(t);
+      t->words[t->len] = jssp_tape_open_word(JSSP_ARRAY_OPEN == type
+                                             ? JSSP_TAPE_ARRAY : JSSP_TAPE_OBJECT,
+                                             t->open, 0);
+      t->open = t->len++;
+      break;
+    case JSSP_ARRAY_CLOSE:
+    case JSSP_OBJECT_CLOSE:
+      if (SIZE_MAX == t->open || JSSP_SUCCESS != (err = jssp_tape_reserve (t, 1)))
+        {
+          err = SIZE_MAX == t->open ? JSSP_ERROR_INVAL : err;
+          break;
+        }
+      open = t->open;
+      w = t->words[open];
+      t->words[t->len++] = jssp_tape_word(JSSP_TAPE_END, jssp_tape_open_count(w));
+      t->words[open] = jssp_tape_word(w >> 56, t->len);
+      t->open = jssp_tape_open_prev(w) == 0xFFFFFFFFU ? SIZE_MAX : jssp_tape_open_prev(w);
+      break;
+    case JSSP_ARRAY_VAL:
+    case JSSP_OBJECT_VAL:
+      /* the first fragment of a value split across chunks opens it */
+      if (!t->in_value)
+        {
+          if (object && JSSP_SUCCESS != (err = jssp_tape_text (t, JSSP_TAPE_STRING, key, key_len, 1)))
+            break;
+          jssp_tape_count(t);
+          err = jssp_tape_text (t,
+                                JSSP_STRING == t->parser->literal_type
+                                ? JSSP_TAPE_STRING : JSSP_TAPE_NUMBER,
+                                data, data_size,
+                                JSSP_SUCCESS == t->parser->last_err);
+          t->in_value = 1;
+        }
+      else
+        err = jssp_tape_append (t, data, data_size);
+      if (JSSP_SUCCESS != err || JSSP_SUCCESS != t->parser->last_err)
+        break;
+      t->in_value = 0;
+      /* true, false and null need no text */
+      if (JSSP_TAPE_NUMBER == jssp_tape_type(t, t->text))
+        {
+          const char *s = jssp_tape_string (t, t->text, &data_size);
+          jssptapetype_t literal = JSSP_TAPE_NUMBER;
+
+          if (4 == data_size && 0 == memcmp (s, "true", 4))
+            literal = JSSP_TAPE_TRUE;
+          else if (5 == data_size && 0 == memcmp (s, "false", 5))
+            literal = JSSP_TAPE_FALSE;
+          else if (4 == data_size && 0 == memcmp (s, "null", 4))
+            literal = JSSP_TAPE_NULL;
+          if (JSSP_TAPE_NUMBER != literal)
+            {
+              t->words[t->text] = jssp_tape_word(literal, 0);
+              t->len = t->text + 1;
+            }
+        }
+      break;
+    default:
+      err = JSSP_ERROR_INVAL;
+    }
+  if (JSSP_SUCCESS != err)
+    t->last_err = err;
+  return err;
+}
+
+int
+jssp_tape_callback (void *cls,
+                    jssptype_t type,
+                    size_t depth,
+                    size_t index,
+                    const char *key,
+                    size_t key_len,
+                    const char *data,
+                    size_t data_size,
+                    uint64_t stream_offset)
+{
+  return JSSP_SUCCESS != jssp_tape_event (cls, type, key, key_len, data, data_size);
+}
+
+size_t
+jssp_tape_next (const jssp_tape *t,
+                size_t i)
+{
+  switch (jssp_tape_type(t, i))
+    {
+    case JSSP_TAPE_ARRAY:
+    case JSSP_TAPE_OBJECT:
+      return (size_t) (t->words[i] & JSSP_TAPE_PAYLOAD);
+    case JSSP_TAPE_STRING:
+    case JSSP_TAPE_NUMBER:
+      if (t->words[i] >> 56 & JSSP_TAPE_REF)
+        return i + 1;
+      return i + 1 + jssp_tape_text_words(t->words[i] & JSSP_TAPE_PAYLOAD);
+    default:
+      return i + 1;
+    }
+}
+
+size_t
+jssp_tape_at (const jssp_tape *t,
+              size_t array,
+              size_t index)
+{
+  size_t i;
+
+  if (JSSP_TAPE_ARRAY != jssp_tape_type(t, array))
+    return SIZE_MAX;
+  for (i = array + 1; JSSP_TAPE_END != jssp_tape_type(t, i); i = jssp_tape_next (t, i))
+    if (0 == index--)
+      return i;
+  return SIZE_MAX;
+}
+
+size_t
+jssp_tape_find (const jssp_tape *t,
+                size_t object,
+                const char *key,
+                size_t key_len)
+{
+  const char *s;
+  size_t i, len;
+
+  if (JSSP_TAPE_OBJECT != jssp_tape_type(t, object))
+    return SIZE_MAX;
+  for (i = object + 1; JSSP_TAPE_END != jssp_tape_type(t, i);)
+    {
+      s = jssp_tape_string (t, i, &len);
+      i = jssp_tape_next (t, i);
+      if (len == key_len && 0 == memcmp (s, key, len))
+        return i;
+      i = jssp_tape_next (t, i);
+    }
+  return SIZE_MAX;
+}
+
+jssperr_t
+jssp_tape_int (const jssp_tape *t,
+               size_t i,
+               int64_t *value)
+{
+  const char *s;
+  size_t len;
+
+  if (JSSP_TAPE_NUMBER != jssp_tape_type(t, i))
+    return JSSP_ERROR_INVAL;
+  s = jssp_tape_string (t, i, &len);
+  return jssp_number_int (s, len, value);
+}
+
+jssperr_t
+jssp_tape_double (const jssp_tape *t,
+                  size_t i,
+                  double *value)
+{
+  const char *s;
+  size_t len;
+
+  if (JSSP_TAPE_NUMBER != jssp_tape_type(t, i))
+    return JSSP_ERROR_INVAL;
+  s = jssp_tape_string (t, i, &len);
+  return jssp_number_double (s, len, value);
+}
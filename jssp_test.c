@@ -1,3 +1,4 @@
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,6 +10,16 @@ static char null_reg[1] =
     { '\0' };
 
 #include "jssp.c"
+#include "jssp_utf.c"
+#include "jssp_write.c"
+#include "jssp_tape.c"
+#include "jssp_index.c"
+#include "jssp_cache.c"
+#include "jssp_bin.c"
+#include "jssp_column.c"
+#include "jssp_base64.c"
+#include "jssp_hash.c"
+#include "jssp_filter.c"
 
 typedef struct
 {
@@ -665,6 +676,51 @@ test_part_json_parser ()
   return 0;
 }
 
+#define test_json_string_bytes(s,t,max_key_len) do { \
+    testjson_t jt; \
+    size_t b; \
+    jt.buf = malloc(1000); \
+    jt.js = s; \
+    jt.cbt = t; \
+    jt.cbt_index = 0; \
+    jssp_init(&jt.p); \
+    for (b = 1; b <= strlen(jt.js); b++) \
+      jt.err = jssp_parse(&jt.p,jt.js,b,jt.buf,1000,max_key_len,&test_jssp_parser_cb,&jt); \
+} while(0)
+
+int
+test_split_key ()
+{
+  testjsoncb_t cbt[10];
+  int i;
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 2;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_OBJECT_VAL;
+  cbt[i].key = "a-key-that-arrives-one-byte-at-a-time";
+  cbt[i].data = "1";
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 1;
+  test_json_string_bytes("{\"a-key-that-arrives-one-byte-at-a-time\":1}", cbt, 100);
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 2;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_OBJECT_VAL;
+  cbt[i].key = "a-key";
+  cbt[i].data = "1";
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 1;
+  test_json_string_bytes("{\"a-key-that-arrives-one-byte-at-a-time\":1}", cbt, 5);
+
+  return 0;
+}
+
 #define test_json_nomem(s,t,max_node,max_key_len) do { \
   size_t bufsize= sizeof(jsspnode_t)*(max_node + 1) + max_key_len; \
   testjson_t jt; \
@@ -727,11 +783,2747 @@ test_nomem ()
   return 0;
 }
 
-void
+#define test_json_grow(s,t,bufsize,alloc,e) do { \
+  testjson_t jt; \
+  char inline_buf[bufsize]; \
+  size_t b; \
+  jt.js = s; \
+  jt.cbt = t; \
+  jt.cbt_index = 0; \
+  jssp_init(&jt.p); \
+  jssp_set_allocator(&jt.p, alloc); \
+  for (b = 1; b <= strlen(jt.js); b++) \
+    jt.err = jssp_parse(&jt.p,jt.js,b,inline_buf,bufsize,100,&test_jssp_parser_cb,&jt); \
+  jssp_release(&jt.p); \
+  if (jt.err != e) \
+    { \
+      printf("Test failed: Returned code %d does not match %d.\n", jt.err, e); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_grow ()
+{
+  testjsoncb_t cbt[30];
+  jssp_allocator capped = jssp_default_allocator;
+  int i;
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 2;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_ARRAY_OPEN;
+  cbt[i].key = "a";
+  cbt[i].data = NULL;
+  for (; i < 10;)
+    cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 12;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_ARRAY_VAL;
+  cbt[i].key = NULL;
+  cbt[i].data = "1";
+  for (; i < 29;)
+    cbt[++i].enable = 1;
+  test_json_grow("{\"a\":[[[[[[[[[[1]]]]]]]]]]}", cbt, 16, &jssp_default_allocator, JSSP_SUCCESS);
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 2;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_OBJECT_VAL;
+  cbt[i].key = "a-key-which-does-not-fit-into-the-inline-buffer";
+  cbt[i].data = "1";
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 1;
+  test_json_grow("{\"a-key-which-does-not-fit-into-the-inline-buffer\":1}", cbt, 48, &jssp_default_allocator, JSSP_SUCCESS);
+
+  i = -1;
+  for (; i < 29;)
+    cbt[++i].enable = 1;
+  capped.max_size = sizeof(jsspnode_t) * 8;
+  test_json_grow("{\"a\":[[[[[[[[[[1]]]]]]]]]]}", cbt, 16, &capped, JSSP_ERROR_NOMEM);
+
+  /* the heap stays with its allocator until it is released */
+  {
+    testjson_t jt;
+    jssp_parser *p = &jt.p;
+    char small[16];
+
+    jt.cbt = cbt;
+    jt.cbt_index = 0;
+    jssp_init (p);
+    jssp_set_allocator (p, &jssp_default_allocator);
+    jssp_parse (p, "[[[[[[[[1]]]]]]]]", 17, small, sizeof(small), 100, &test_jssp_parser_cb, &jt);
+    if (NULL == p->heap || JSSP_ERROR_INVAL != jssp_set_allocator (p, NULL)
+      || JSSP_SUCCESS != jssp_set_allocator (p, &jssp_default_allocator))
+      {
+        jssp_release (p);
+        printf("Test failed: Allocator swapped under a live heap.\n");
+        test_failed ++;
+        return 1;
+      }
+    jssp_release (p);
+    if (JSSP_SUCCESS != jssp_set_allocator (p, NULL))
+      {
+        printf("Test failed: Allocator not swapped after release.\n");
+        test_failed ++;
+        return 1;
+      }
+    printf("Test passed.\n");
+    test_passed ++;
+  }
+
+  return 0;
+}
+
+typedef struct
+{
+  jssp_parser p;
+  char **paths;
+  int index;
+} testpath_t;
+
+int
+test_path_cb (void *cls,
+              jssptype_t type,
+              size_t depth,
+              size_t index,
+              const char *key,
+              size_t key_len,
+              const char *data,
+              size_t data_size,
+              uint64_t stream_offset)
+{
+  testpath_t *tp = (testpath_t *) cls;
+  jssppath_t path;
+  char s[256];
+  size_t d, n = 0;
+
+  if (JSSP_SUCCESS != jssp_get_path (&tp->p, &path) || path.depth != depth)
+    {
+      printf("Test failed: Can not get path at depth %zu.\n", depth);
+      test_failed ++;
+      return 1;
+    }
+  /* only values are checked, the empty tail of a split one is skipped */
+  if ((JSSP_OBJECT_VAL != type && JSSP_ARRAY_VAL != type) || 0 == data_size)
+    return 0;
+  for (d = 1; d <= path.depth; d++)
+    n += sprintf (s + n, "/%.*s[%zu]",
+                  (int) jssp_path_key_len(&path, d),
+                  jssp_path_key(&path, d),
+                  jssp_path_index(&path, d));
+  if (strcmp (s, tp->paths[tp->index]) != 0)
+    {
+      printf("Test failed: Returned path %s does not match %s.\n", s, tp->paths[tp->index]);
+      test_failed ++;
+      return 1;
+    }
+  tp->index++;
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+#define test_json_path(s,t,bufsize,bytes) do { \
+  testpath_t tp; \
+  char inline_buf[bufsize]; \
+  size_t b; \
+  tp.paths = t; \
+  tp.index = 0; \
+  jssp_init(&tp.p); \
+  jssp_set_allocator(&tp.p, &jssp_default_allocator); \
+  jssp_set_options(&tp.p, JSSP_OPTION_PATH); \
+  for (b = bytes ? 1 : strlen(s); b <= strlen(s); b++) \
+    jssp_parse(&tp.p,s,b,inline_buf,bufsize,100,&test_path_cb,&tp); \
+  jssp_release(&tp.p); \
+}while(0)
+
+int
+test_path ()
+{
+  char *paths[] =
+    { "/[0]/a[0]/[0]",
+      "/[0]/a[0]/[1]/b[0]",
+      "/[0]/a[0]/[1]/c[1]/[0]",
+      "/[0]/a[0]/[1]/c[1]/[1]",
+      "/[0]/d[1]" };
+  char *js = "{\"a\":[1,{\"b\":2,\"c\":[3,4]}],\"d\":5}";
+
+  test_json_path(js, paths, 1000, 0);
+  test_json_path(js, paths, 1000, 1);
+  test_json_path(js, paths, 16, 1);
+  return 0;
+}
+
+static int test_allocs = 0;
+
+static void *
+test_count_realloc (void *cls, void *ptr, size_t size)
+{
+  test_allocs++;
+  return realloc (ptr, size);
+}
+
+static void
+test_count_free (void *cls, void *ptr)
+{
+  free (ptr);
+}
+
+#define test_json_inline(s,t,allocs) do { \
+  testjson_t jt; \
+  jssp_inline_parser ip; \
+  jssp_allocator counting = { &test_count_realloc, &test_count_free, NULL, 0 }; \
+  jt.js = s; \
+  jt.cbt = t; \
+  jt.cbt_index = 0; \
+  test_allocs = 0; \
+  jssp_inline_init(&ip, &counting); \
+  jt.err = jssp_inline_parse(&ip,jt.js,strlen(jt.js),100,&test_jssp_parser_cb,&jt); \
+  jssp_release(&ip.parser); \
+  if (jt.err != JSSP_SUCCESS || test_allocs != allocs) \
+    { \
+      printf("Test failed: Returned code %d, %d allocations.\n", jt.err, test_allocs); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_inline ()
+{
+  testjsoncb_t cbt[30];
+  int i;
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 3;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_OBJECT_VAL;
+  cbt[i].key = "method";
+  cbt[i].data = "ping";
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 1;
+  test_json_inline("[{\"method\":\"ping\"}]", cbt, 0);
+
+  i = -1;
+  cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 2;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_ARRAY_OPEN;
+  cbt[i].key = "a";
+  cbt[i].data = NULL;
+  for (; i < 10;)
+    cbt[++i].enable = 1;
+  cbt[++i].enable = 0;
+  cbt[i].depth = 12;
+  cbt[i].index = 0;
+  cbt[i].type = JSSP_ARRAY_VAL;
+  cbt[i].key = NULL;
+  cbt[i].data = "1";
+  for (; i < 29;)
+    cbt[++i].enable = 1;
+  test_json_inline("{\"a\":[[[[[[[[[[1]]]]]]]]]]}", cbt, 1);
+  return 0;
+}
+
+#define test_json_len(s,l,e) do { \
+  jssp_parser p; \
+  char buf[256]; \
+  size_t n = 0; \
+  jssperr_t err; \
+  jssp_init(&p); \
+  err = jssp_parse(&p,s,l,buf,sizeof(buf),100,&test_count_cb,&n); \
+  if (err != e) \
+    { \
+      printf("Test failed: Returned code %d does not match %d.\n", err, e); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_count_cb (void *cls,
+               jssptype_t type,
+               size_t depth,
+               size_t index,
+               const char *key,
+               size_t key_len,
+               const char *data,
+               size_t data_size,
+               uint64_t stream_offset)
+{
+  (*(size_t *) cls)++;
+  return 0;
+}
+
+int
+test_bounded ()
+{
+  /* a chunk may end in whitespace */
+  test_json_len("[1, ", 4, JSSP_ERROR_PART);
+  test_json_len("{\"a\":\"a long string value with no escapes\"} ", 44, JSSP_SUCCESS);
+#ifdef JSSP_BOUNDED
+  test_json_len("{\"a\":\"x\0y\"}", 11, JSSP_ERROR_INVAL);
+  test_json_len("[1,2]\0", 6, JSSP_ERROR_INVAL);
+#else
+  test_json_len("{\"a\":\"x\0y\"}", 11, JSSP_ERROR_BROKEN);
+  test_json_len("[1,2]\0", 6, JSSP_SUCCESS);
+#endif
+  return 0;
+}
+
+typedef struct
+{
+  jssp_parser p;
+  char data[256];
+  size_t data_len;
+} testcollect_t;
+
+int
+test_collect_cb (void *cls,
+                 jssptype_t type,
+                 size_t depth,
+                 size_t index,
+                 const char *key,
+                 size_t key_len,
+                 const char *data,
+                 size_t data_size,
+                 uint64_t stream_offset)
+{
+  testcollect_t *tc = (testcollect_t *) cls;
+
+  if (JSSP_OBJECT_VAL != type && JSSP_ARRAY_VAL != type)
+    return 0;
+  if (NULL != key && 0 == tc->data_len)
+    {
+      memcpy (tc->data, key, key_len);
+      tc->data[key_len] = '=';
+      tc->data_len = key_len + 1;
+    }
+  memcpy (tc->data + tc->data_len, data, data_size);
+  tc->data_len += data_size;
+  tc->data[tc->data_len] = '\0';
+  return 0;
+}
+
+/* UTF-8 to UTF-16/UTF-32 with a BOM, for the test input only */
+static size_t
+test_encode (const char *s, jsspencoding_t e, char *out)
+{
+  const unsigned char *u = (const unsigned char *) s;
+  size_t n = 0, i;
+  uint32_t cp, units[2];
+  int count, k, unit = (e == JSSP_ENCODING_UTF16LE || e == JSSP_ENCODING_UTF16BE) ? 2 : 4;
+  int be = (e == JSSP_ENCODING_UTF16BE || e == JSSP_ENCODING_UTF32BE);
+
+  for (i = 0; i == 0 || *u; i++)
+    {
+      if (i == 0)
+        cp = 0xFEFF;
+      else if (*u < 0x80)
+        cp = *u++;
+      else if (*u < 0xE0)
+        {
+          cp = (u[0] & 0x1F) << 6 | (u[1] & 0x3F);
+          u += 2;
+        }
+      else if (*u < 0xF0)
+        {
+          cp = (u[0] & 0x0F) << 12 | (u[1] & 0x3F) << 6 | (u[2] & 0x3F);
+          u += 3;
+        }
+      else
+        {
+          cp = (u[0] & 0x07) << 18 | (u[1] & 0x3F) << 12 | (u[2] & 0x3F) << 6 | (u[3] & 0x3F);
+          u += 4;
+        }
+      count = 1;
+      units[0] = cp;
+      if (unit == 2 && cp >= 0x10000)
+        {
+          units[0] = 0xD800 + ((cp - 0x10000) >> 10);
+          units[1] = 0xDC00 + ((cp - 0x10000) & 0x3FF);
+          count = 2;
+        }
+      for (k = 0; k < count; k++, n += unit)
+        for (i = 1, cp = units[k]; i <= unit; i++, cp >>= 8)
+          out[n + (be ? unit - i : i - 1)] = (char) (cp & 0xFF);
+      i = 1;
+    }
+  return n;
+}
+
+#define test_json_encoded(s,e,chunk,o) do { \
+  testcollect_t tc; \
+  jssp_transcoder t; \
+  char in[512], buf[256]; \
+  size_t n = test_encode(s, e, in), b; \
+  jssperr_t err = JSSP_ERROR_PART; \
+  tc.data_len = 0; \
+  jssp_init(&tc.p); \
+  jssp_transcoder_init(&t, JSSP_ENCODING_AUTO); \
+  for (b = 0; b < n; b += chunk) \
+    err = jssp_parse_encoded(&tc.p,&t,in + b,b + chunk < n ? chunk : n - b, \
+                             buf,sizeof(buf),100,&test_collect_cb,&tc); \
+  if (err != JSSP_SUCCESS || strcmp (tc.data, o) != 0) \
+    { \
+      printf("Test failed: Returned code %d, data %s does not match %s.\n", err, tc.data, o); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+/* Feed js to jssp_parse_chunk one byte at a time, then in three pieces
+ * cut at every i < j; the values must add up to o every time */
+static int
+test_chunk_cuts (const char *js, const char *o)
+{
+  testcollect_t tc;
+  char chunk[256], buf[256];
+  size_t n = strlen (js), i, j, l, k, cut[3];
+  jssperr_t err;
+
+  for (i = 0; i < n; i++)
+    for (j = i + 1; j <= n; j++)
+      {
+        /* i == 0 stands for the one byte feed */
+        cut[0] = i;
+        cut[1] = j;
+        cut[2] = n;
+        tc.data_len = 0;
+        tc.data[0] = '\0';
+        jssp_init(&tc.p);
+        err = JSSP_ERROR_PART;
+        for (l = 0; l < n; l += k)
+          {
+            if (0 == i)
+              k = 1;
+            else
+              k = (l < cut[0] ? cut[0] : l < cut[1] ? cut[1] : cut[2]) - l;
+            memcpy (chunk, js + l, k);
+            err = jssp_parse_chunk(&tc.p, chunk, k, buf, sizeof(buf), 100,
+                                   &test_collect_cb, &tc);
+            memset (chunk, 'x', sizeof(chunk));
+            if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err)
+              break;
+          }
+        if (JSSP_SUCCESS != err || strcmp (tc.data, o) != 0)
+          {
+            printf("Test failed: %s cut at %zu and %zu returned %d, data %s.\n",
+                   js, i, j, err, tc.data);
+            test_failed ++;
+            return 1;
+          }
+        if (0 == i)
+          break;
+      }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+int
+test_encoding ()
+{
+  size_t bom;
+  char *js = "{\"k\u00e9y\":\"plain ascii run, \u00e9 \u4e2d \U0001F600 end\"}";
+  char *o = "k\u00e9y=plain ascii run, \u00e9 \u4e2d \U0001F600 end";
+
+  if (jssp_detect_encoding ("\0{\0\"", 4, &bom) != JSSP_ENCODING_UTF16BE || bom != 0
+    || jssp_detect_encoding ("{\0\0\0", 4, &bom) != JSSP_ENCODING_UTF32LE
+    || jssp_detect_encoding ("\xFF\xFE{\0", 4, &bom) != JSSP_ENCODING_UTF16LE || bom != 2
+    || jssp_detect_encoding ("{\"a\"", 4, &bom) != JSSP_ENCODING_UTF8)
+    {
+      printf("Test failed: Encoding detection.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  test_json_encoded(js, JSSP_ENCODING_UTF16LE, 512, o);
+  test_json_encoded(js, JSSP_ENCODING_UTF16LE, 3, o);
+  test_json_encoded(js, JSSP_ENCODING_UTF16BE, 5, o);
+  test_json_encoded(js, JSSP_ENCODING_UTF32LE, 7, o);
+  test_json_encoded(js, JSSP_ENCODING_UTF32BE, 1, o);
+
+  /* escapes and UTF-8 sequences cut more than once stay whole */
+  if (0 != test_chunk_cuts (js, o)
+    || 0 != test_chunk_cuts ("[\"a\\u00e9b\\n\u4e2d\U0001F600\\\"\"]",
+                             "a\\u00e9b\\n\u4e2d\U0001F600\\\""))
+    return 1;
+  return 0;
+}
+
+#define test_json_valid(s,e,o) do { \
+  size_t off = (size_t) -1; \
+  jssperr_t err = jssp_validate(s,sizeof(s)-1,&off); \
+  if (err != e || (e != JSSP_SUCCESS && off != o)) \
+    { \
+      printf("Test failed: %s returned %d at %zu, expected %d at %d.\n", s, err, off, e, o); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_validate ()
+{
+  char deep[JSSP_VALIDATE_DEPTH + 2];
+
+  test_json_valid("{\"a\":[1,-0.5e+3,\"x\\u00e9\\n\"],\"b\":{},\"c\":[]}", JSSP_SUCCESS, 0);
+  test_json_valid(" [true, false, null] ", JSSP_SUCCESS, 0);
+  test_json_valid("{\"a\":1}\n{\"a\":2}\n", JSSP_SUCCESS, 0);
+  test_json_valid("\xEF\xBB\xBF\"caf\xC3\xA9 \xE2\x82\xAC \xF0\x9F\x98\x80\"", JSSP_SUCCESS, 0);
+  test_json_valid("[1,2", JSSP_ERROR_PART, 4);
+  test_json_valid("{\"abc", JSSP_ERROR_PART, 5);
+  test_json_valid("[tru", JSSP_ERROR_PART, 4);
+  test_json_valid("[1,]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("{\"a\":1,}", JSSP_ERROR_INVAL, 7);
+  test_json_valid("[01]", JSSP_ERROR_INVAL, 2);
+  test_json_valid("[1.]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("[1}", JSSP_ERROR_INVAL, 2);
+  test_json_valid("{1:2}", JSSP_ERROR_INVAL, 1);
+  test_json_valid("[trUe]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("[\"a\\x\"]", JSSP_ERROR_INVAL, 4);
+  test_json_valid("[\"a\\u12G4\"]", JSSP_ERROR_INVAL, 7);
+  test_json_valid("[\"a\tb\"]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("[\"0123456789\xC0\xAF\"]", JSSP_ERROR_INVAL, 12);
+  test_json_valid("[\"\xED\xA0\x80\"]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("[\"\xE2\x82\"]", JSSP_ERROR_INVAL, 4);
+  test_json_valid("0123", JSSP_ERROR_INVAL, 1);
+  test_json_valid("01", JSSP_ERROR_INVAL, 1);
+  test_json_valid("-01", JSSP_ERROR_INVAL, 2);
+  test_json_valid("1true", JSSP_ERROR_INVAL, 1);
+  test_json_valid("nullnull", JSSP_ERROR_INVAL, 4);
+  test_json_valid("{}{}", JSSP_ERROR_INVAL, 2);
+  test_json_valid("\"a\"\"b\"", JSSP_ERROR_INVAL, 3);
+  test_json_valid("[1][2]", JSSP_ERROR_INVAL, 3);
+  test_json_valid("1 true\t{}\r\n\"b\"", JSSP_SUCCESS, 0);
+
+  memset (deep, '[', sizeof(deep));
+  if (JSSP_ERROR_NOMEM != jssp_validate (deep, sizeof(deep), NULL))
+    {
+      printf("Test failed: Nesting limit not enforced.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+typedef struct
+{
+  char out[512];
+  size_t len;
+  jssp_parser *parser;
+  jssp_writer *writer;
+} testwrite_t;
+
+int
+test_flush_cb (void *cls,
+               const char *data,
+               size_t len)
+{
+  testwrite_t *t = cls;
+
+  if (t->len + len >= sizeof(t->out))
+    return 1;
+  memcpy (t->out + t->len, data, len);
+  t->len += len;
+  t->out[t->len] = '\0';
+  return 0;
+}
+
+int
+test_reemit_cb (void *cls,
+                jssptype_t type,
+                size_t depth,
+                size_t index,
+                const char *key,
+                size_t key_len,
+                const char *data,
+                size_t data_size,
+                uint64_t stream_offset)
+{
+  testwrite_t *t = cls;
+
+  return JSSP_SUCCESS != jssp_write_event (t->writer, t->parser, type, key,
+                                           key_len, data, data_size);
+}
+
+#define test_write_equal(t, e) do { \
+  if (0 != strcmp ((t)->out, e)) \
+    { \
+      printf("Test failed: Written %s does not match %s.\n", (t)->out, e); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+/* Parse s fed step bytes more per call and write every event back */
+#define test_json_reemit(s, step) do { \
+  testwrite_t t; \
+  jssp_parser p; \
+  jssp_writer w; \
+  char buf[256], wbuf[16]; \
+  size_t l = 0, n = strlen (s); \
+  jssperr_t err = JSSP_ERROR_PART; \
+  t.len = 0; \
+  t.out[0] = '\0'; \
+  t.parser = &p; \
+  t.writer = &w; \
+  jssp_init(&p); \
+  jssp_writer_init(&w, wbuf, sizeof(wbuf), &test_flush_cb, &t); \
+  while (l < n) \
+    { \
+      l = l + step < n ? l + step : n; \
+      err = jssp_parse(&p, s, l, buf, sizeof(buf), 100, &test_reemit_cb, &t); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_writer_flush(&w); \
+  if (JSSP_SUCCESS != err) \
+    { \
+      printf("Test failed: Re-emitting %s returned %d.\n", s, err); \
+      test_failed ++; \
+      return 1; \
+    } \
+  test_write_equal(&t, s); \
+}while(0)
+
+int
+test_write ()
+{
+  const char *js = "{\"s\":\"a\\\"b\\\\c\\u00e9\\n\",\"n\":[1,-2.5e3,true,null],\"o\":{}}";
+  double doubles[] =
+    { 0.1, 1.0 / 3, -2.5e-300, 1e22, 123456789.125, 5e-324, -0.05, 19.99 };
+  testwrite_t t;
+  jssp_writer w;
+  char wbuf[16];
+  size_t i;
+
+  t.len = 0;
+  jssp_writer_init (&w, wbuf, sizeof(wbuf), &test_flush_cb, &t);
+  jssp_write_begin_object (&w);
+  jssp_write_key (&w, "name", 4);
+  jssp_write_string (&w, "tab\there \"quoted\" \x01 caf\xC3\xA9", 25);
+  jssp_write_key (&w, "list", 4);
+  jssp_write_begin_array (&w);
+  jssp_write_int (&w, 0);
+  jssp_write_int (&w, -9223372036854775807LL - 1);
+  jssp_write_double (&w, 2.0);
+  jssp_write_double (&w, 0.1);
+  jssp_write_bool (&w, 0);
+  jssp_write_null (&w);
+  jssp_write_end_array (&w);
+  jssp_write_raw_key (&w, "raw\\n", 5);
+  jssp_write_raw_string (&w, "\\u0041", 6);
+  jssp_write_end_object (&w);
+  jssp_write_begin_array (&w);
+  jssp_write_end_array (&w);
+  if (JSSP_SUCCESS != jssp_writer_flush (&w))
+    {
+      printf("Test failed: Writer flush.\n");
+      test_failed ++;
+      return 1;
+    }
+  test_write_equal(&t, "{\"name\":\"tab\\there \\\"quoted\\\" \\u0001 caf\xC3\xA9\","
+                   "\"list\":[0,-9223372036854775808,2,0.1,false,null],"
+                   "\"raw\\n\":\"\\u0041\"}\n[]");
+  if (JSSP_SUCCESS != jssp_validate (t.out, t.len, NULL))
+    {
+      printf("Test failed: Written JSON does not validate.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  /* without a flush callback the document stays in the buffer */
+  jssp_writer_init (&w, t.out, sizeof(t.out), NULL, NULL);
+  jssp_write_begin_array (&w);
+  jssp_write_int (&w, 1);
+  jssp_write_end_array (&w);
+  if (JSSP_SUCCESS != jssp_writer_flush (&w) || 3 != w.len || 0 != memcmp (t.out, "[1]", 3))
+    {
+      printf("Test failed: Writer without flush callback.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  /* misuse is refused */
+  jssp_writer_init (&w, wbuf, sizeof(wbuf), NULL, NULL);
+  jssp_write_begin_object (&w);
+  if (JSSP_ERROR_INVAL != jssp_write_int (&w, 1)
+    || JSSP_ERROR_INVAL != jssp_write_end_array (&w)
+    || JSSP_ERROR_INVAL != jssp_write_double (&w, 0.0 / 0.0)
+    || JSSP_ERROR_NOMEM != jssp_write_key (&w, "longer than the buffer", 22))
+    {
+      printf("Test failed: Invalid writer call accepted.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  /* shortest form that reads back exactly */
+  for (i = 0; i < sizeof(doubles) / sizeof(doubles[0]); i++)
+    {
+      t.len = 0;
+      jssp_writer_init (&w, wbuf, sizeof(wbuf), &test_flush_cb, &t);
+      jssp_write_double (&w, doubles[i]);
+      if (JSSP_SUCCESS != jssp_writer_flush (&w) || strtod (t.out, NULL) != doubles[i] || t.len > 24)
+        {
+          printf("Test failed: %s does not read back as %.17g.\n", t.out, doubles[i]);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+  t.len = 0;
+  jssp_writer_init (&w, wbuf, sizeof(wbuf), &test_flush_cb, &t);
+  jssp_write_begin_array (&w);
+  jssp_write_double (&w, 0.1);
+  jssp_write_double (&w, -0.05);
+  jssp_write_double (&w, 1e100);
+  jssp_write_end_array (&w);
+  if (JSSP_SUCCESS != jssp_writer_flush (&w))
+    {
+      printf("Test failed: Writer flush.\n");
+      test_failed ++;
+      return 1;
+    }
+  test_write_equal(&t, "[0.1,-0.05,1e+100]");
+
+  /* parser events round trip, also when values are split across calls */
+  test_json_reemit(js, 1024);
+  test_json_reemit(js, 1);
+  test_json_reemit(js, 5);
+  test_json_reemit("[[1,[2,[]]],{\"k\":{\"k\":[\"v\"]}}]", 3);
+  return 0;
+}
+
+typedef struct
+{
+  const char *key; /* value to act on, by key or data */
+  jssptransform_t action;
+  const char *json;
+  const char *insert;
+  int finish;
+} testrule_t;
+
+int
+test_transform_cb (void *cls,
+                   jssptype_t type,
+                   size_t depth,
+                   size_t index,
+                   const char *key,
+                   size_t key_len,
+                   const char *data,
+                   size_t data_size,
+                   uint64_t stream_offset)
+{
+  jssp_transformer *t = cls;
+  testrule_t *r;
+
+  for (r = t->cls; NULL != r->key; r++)
+    {
+      if (!((NULL != key && strlen (r->key) == key_len && 0 == memcmp (r->key, key, key_len)
+             && JSSP_ARRAY_CLOSE != type && JSSP_OBJECT_CLOSE != type)
+            || (NULL != data && strlen (r->key) == data_size && 0 == memcmp (r->key, data, data_size))
+            || (JSSP_ARRAY_CLOSE == type && 0 == strcmp (r->key, "]"))))
+        continue;
+      if (JSSP_TRANSFORM_REPLACE == r->action)
+        jssp_transform_replace (t, r->json, strlen (r->json));
+      if (JSSP_TRANSFORM_DROP == r->action)
+        jssp_transform_drop (t);
+      if (NULL != r->insert)
+        jssp_transform_insert (t, r->insert, strlen (r->insert));
+      if (r->finish)
+        jssp_transform_finish (t);
+    }
+  return 0;
+}
+
+#define test_json_transform(s, rules, e) do { \
+  testwrite_t o; \
+  jssp_transformer t; \
+  jssp_writer w; \
+  char buf[256], wbuf[8]; \
+  jssperr_t err; \
+  o.len = 0; \
+  o.out[0] = '\0'; \
+  jssp_writer_init(&w, wbuf, sizeof(wbuf), &test_flush_cb, &o); \
+  jssp_transformer_init(&t, &w, &test_transform_cb, rules); \
+  err = jssp_transform(&t, s, strlen(s), buf, sizeof(buf), 100); \
+  if (JSSP_SUCCESS != err) \
+    { \
+      printf("Test failed: Transforming %s returned %d.\n", s, err); \
+      test_failed ++; \
+      return 1; \
+    } \
+  test_write_equal(&o, e); \
+}while(0)
+
+int
+test_transform ()
+{
+  const char *js = "{\"a\": 1, \"b\": \"text\", \"c\": {\"x\": [1, 2]}, \"d\": [3, 4]}";
+  testrule_t none[] =
+    { { NULL } };
+  testrule_t replace[] =
+    { { "b", JSSP_TRANSFORM_REPLACE, "42" },
+      { "c", JSSP_TRANSFORM_REPLACE, "null" },
+      { NULL } };
+  testrule_t drop_first[] =
+    { { "a", JSSP_TRANSFORM_DROP },
+      { NULL } };
+  testrule_t drop[] =
+    { { "b", JSSP_TRANSFORM_DROP },
+      { "d", JSSP_TRANSFORM_DROP },
+      { NULL } };
+  testrule_t drop_all[] =
+    { { "a", JSSP_TRANSFORM_DROP },
+      { "b", JSSP_TRANSFORM_DROP },
+      { "c", JSSP_TRANSFORM_DROP },
+      { "d", JSSP_TRANSFORM_DROP },
+      { NULL } };
+  testrule_t finish[] =
+    { { "c", JSSP_TRANSFORM_REPLACE, "[]", NULL, 1 },
+      { "d", JSSP_TRANSFORM_DROP },
+      { NULL } };
+  testrule_t insert[] =
+    { { "a", JSSP_TRANSFORM_KEEP, NULL, "\"n\":true" },
+      { "4", JSSP_TRANSFORM_KEEP, NULL, "5" },
+      { NULL } };
+  testrule_t insert_close[] =
+    { { "]", JSSP_TRANSFORM_KEEP, NULL, "0" },
+      { NULL } };
+  testrule_t swap_first[] =
+    { { "1", JSSP_TRANSFORM_DROP, NULL, "0" },
+      { NULL } };
+
+  test_json_transform(js, none, js);
+  test_json_transform(js, replace, "{\"a\": 1, \"b\": 42, \"c\": null, \"d\": [3, 4]}");
+  test_json_transform(js, drop_first, "{ \"b\": \"text\", \"c\": {\"x\": [1, 2]}, \"d\": [3, 4]}");
+  test_json_transform(js, drop, "{\"a\": 1, \"c\": {\"x\": [1, 2]}}");
+  test_json_transform(js, drop_all, "{}");
+  test_json_transform(js, finish, "{\"a\": 1, \"b\": \"text\", \"c\": [], \"d\": [3, 4]}");
+  test_json_transform(js, insert,
+                      "{\"a\": 1,\"n\":true, \"b\": \"text\", \"c\": {\"x\": [1, 2]}, \"d\": [3, 4,5]}");
+  test_json_transform("[[1], [2]] ", insert_close, "[[1],0, [2],0]\n0 ");
+  test_json_transform("[1, 2, 1]", swap_first, "[0, 2,0]");
+
+  /* the whole output in a writer without a flush callback */
+  {
+    jssp_transformer t;
+    jssp_writer w;
+    char out[128], buf[256];
+
+    jssp_writer_init (&w, out, sizeof(out), NULL, NULL);
+    jssp_transformer_init (&t, &w, &test_transform_cb, replace);
+    if (JSSP_SUCCESS != jssp_transform (&t, js, strlen (js), buf, sizeof(buf), 100)
+      || w.len != strlen ("{\"a\": 1, \"b\": 42, \"c\": null, \"d\": [3, 4]}")
+      || 0 != memcmp (out, "{\"a\": 1, \"b\": 42, \"c\": null, \"d\": [3, 4]}", w.len))
+      {
+        printf("Test failed: Transform into a writer without flush callback.\n");
+        test_failed ++;
+        return 1;
+      }
+    printf("Test passed.\n");
+    test_passed ++;
+  }
+  return 0;
+}
+
+/* Reformat s fed step bytes per call */
+#define test_json_reformat(s, indent, step, e) do { \
+  testwrite_t o; \
+  jssp_reformatter r; \
+  jssp_writer w; \
+  char wbuf[8]; \
+  size_t l, n = strlen (s); \
+  jssperr_t err = JSSP_SUCCESS; \
+  o.len = 0; \
+  o.out[0] = '\0'; \
+  jssp_writer_init(&w, wbuf, sizeof(wbuf), &test_flush_cb, &o); \
+  jssp_reformatter_init(&r, &w, indent); \
+  for (l = 0; l < n; l += step) \
+    err = jssp_reformat(&r, s + l, l + step < n ? step : n - l); \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_writer_flush(&w); \
+  if (JSSP_SUCCESS != err) \
+    { \
+      printf("Test failed: Reformatting %s returned %d.\n", s, err); \
+      test_failed ++; \
+      return 1; \
+    } \
+  test_write_equal(&o, e); \
+}while(0)
+
+int
+test_reformat ()
+{
+  const char *pretty = "{\n  \"a\": [\n    1,\n    \"x \\\" y\\\\\"\n  ],\n  \"b\": {},\n  \"c\": []\n}";
+  const char *minified = "{\"a\":[1,\"x \\\" y\\\\\"],\"b\":{},\"c\":[]}";
+  jssp_reformatter r;
+  jssp_writer w;
+  char wbuf[8];
+
+  test_json_reformat(pretty, 0, 1024, minified);
+  test_json_reformat(pretty, 0, 1, minified);
+  test_json_reformat(minified, 2, 1024, pretty);
+  test_json_reformat(minified, 2, 3, pretty);
+  test_json_reformat(" {\"a\" : \"  spaced  \" ,\t\"b\":\r\n[ ]}  ", 0, 7, "{\"a\":\"  spaced  \",\"b\":[]}");
+  test_json_reformat("{\"a\":1} \n\n{\"a\":2}\n", 0, 1024, "{\"a\":1}\n{\"a\":2}");
+  test_json_reformat("1 2\ttrue", 0, 1, "1\n2\ntrue");
+
+  jssp_writer_init (&w, wbuf, sizeof(wbuf), NULL, NULL);
+  jssp_reformatter_init (&r, &w, 0);
+  if (JSSP_ERROR_PART != jssp_reformat (&r, "[\"a", 3)
+    || JSSP_ERROR_INVAL != jssp_reformat (&r, "\"]]", 3))
+    {
+      printf("Test failed: Unfinished or unbalanced input accepted.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+#define test_tape_check(c, m) do { \
+  if (!(c)) \
+    { \
+      printf("Test failed: %s.\n", m); \
+      test_failed ++; \
+      jssp_tape_release (&t); \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_tape ()
+{
+  const char *js = "{\"id\": 42, \"name\": \"a \\\"quoted\\\" name\", \"tags\": [\"x\", \"y\", \"z\"],"
+    " \"pos\": {\"x\": 1.5, \"y\": -2}, \"ok\": true, \"no\": false, \"nil\": null, \"e\": {}} [7]";
+  uint64_t words[64], split[64];
+  char buf[256];
+  jssp_parser p;
+  jssp_tape t;
+  const char *s;
+  size_t i, len, l, n = strlen (js), tlen;
+  int64_t v;
+  double d;
+  jssperr_t err = JSSP_ERROR_PART;
+
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, words, sizeof(words), NULL);
+  test_tape_check(JSSP_SUCCESS == jssp_parse (&p, js, n, buf, sizeof(buf), 100, &jssp_tape_callback, &t),
+                  "Tape build failed");
+  test_tape_check(JSSP_TAPE_OBJECT == jssp_tape_type(&t, 0) && 8 == jssp_tape_size(&t, 0),
+                  "Root object not found");
+  i = jssp_tape_find (&t, 0, "id", 2);
+  test_tape_check(SIZE_MAX != i && JSSP_SUCCESS == jssp_tape_int (&t, i, &v) && 42 == v,
+                  "Member id not found");
+  s = jssp_tape_string (&t, jssp_tape_find (&t, 0, "name", 4), &len);
+  test_tape_check(len == 17 && 0 == memcmp (s, "a \\\"quoted\\\" name", len), "Member name not found");
+  i = jssp_tape_find (&t, 0, "tags", 4);
+  test_tape_check(3 == jssp_tape_size(&t, i) && SIZE_MAX == jssp_tape_at (&t, i, 3), "Wrong array size");
+  s = jssp_tape_string (&t, jssp_tape_at (&t, i, 2), &len);
+  test_tape_check(1 == len && 'z' == *s, "Element not found");
+  i = jssp_tape_find (&t, jssp_tape_find (&t, 0, "pos", 3), "x", 1);
+  test_tape_check(JSSP_SUCCESS == jssp_tape_double (&t, i, &d) && 1.5 == d, "Nested member not found");
+  test_tape_check(JSSP_TAPE_TRUE == jssp_tape_type(&t, jssp_tape_find (&t, 0, "ok", 2))
+                  && JSSP_TAPE_FALSE == jssp_tape_type(&t, jssp_tape_find (&t, 0, "no", 2))
+                  && JSSP_TAPE_NULL == jssp_tape_type(&t, jssp_tape_find (&t, 0, "nil", 3))
+                  && 0 == jssp_tape_size(&t, jssp_tape_find (&t, 0, "e", 1))
+                  && SIZE_MAX == jssp_tape_find (&t, 0, "missing", 7),
+                  "Literal members wrong");
+  /* the second top level value follows the first */
+  i = jssp_tape_next (&t, 0);
+  test_tape_check(JSSP_TAPE_ARRAY == jssp_tape_type(&t, i) && jssp_tape_next (&t, i) == t.len,
+                  "Second top level value not found");
+
+  /* fed byte by byte, split values give the same tape */
+  tlen = t.len;
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, split, sizeof(split), NULL);
+  for (l = 1; l <= n; l++)
+    {
+      err = jssp_parse (&p, js, l, buf, sizeof(buf), 100, &jssp_tape_callback, &t);
+      if (JSSP_SUCCESS != err && JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err)
+        break;
+    }
+  test_tape_check(JSSP_SUCCESS == err && t.len == tlen && 0 == memcmp (words, split, tlen * sizeof(uint64_t)),
+                  "Split input built another tape");
+
+  /* too small a buffer grows through the allocator */
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, words, 16, NULL);
+  test_tape_check(JSSP_TERMINATE == jssp_parse (&p, js, n, buf, sizeof(buf), 100, &jssp_tape_callback, &t)
+                  && JSSP_ERROR_NOMEM == t.last_err,
+                  "Full tape not reported");
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, words, 16, &jssp_default_allocator);
+  test_tape_check(JSSP_SUCCESS == jssp_parse (&p, js, n, buf, sizeof(buf), 100, &jssp_tape_callback, &t)
+                  && t.len == tlen && 0 == memcmp (t.words, split, tlen * sizeof(uint64_t)),
+                  "Grown tape differs");
+  jssp_tape_release (&t);
+
+  /* referencing the source keeps strings out of the tape */
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, split, sizeof(split), NULL);
+  jssp_tape_set_source (&t, js, n);
+  test_tape_check(JSSP_SUCCESS == jssp_parse (&p, js, n, buf, sizeof(buf), 100, &jssp_tape_callback, &t)
+                  && t.len < tlen,
+                  "Tape with source failed");
+  s = jssp_tape_string (&t, jssp_tape_find (&t, 0, "name", 4), &len);
+  test_tape_check(len == 17 && 0 == memcmp (s, "a \\\"quoted\\\" name", len)
+                  && s > js && s < js + n,
+                  "Referenced member not found");
+  i = jssp_tape_find (&t, jssp_tape_find (&t, 0, "pos", 3), "y", 1);
+  test_tape_check(JSSP_SUCCESS == jssp_tape_int (&t, i, &v) && -2 == v
+                  && JSSP_TAPE_TRUE == jssp_tape_type(&t, jssp_tape_find (&t, 0, "ok", 2)),
+                  "Referenced number not found");
+
+  /* integers beyond int64 are not clamped */
+  js = "[9223372036854775807, -9223372036854775808, 99999999999999999999, -99999999999999999999]";
+  n = strlen (js);
+  jssp_init (&p);
+  jssp_tape_init (&t, &p, split, sizeof(split), NULL);
+  test_tape_check(JSSP_SUCCESS == jssp_parse (&p, js, n, buf, sizeof(buf), 100, &jssp_tape_callback, &t)
+                  && JSSP_SUCCESS == jssp_tape_int (&t, jssp_tape_at (&t, 0, 0), &v) && INT64_MAX == v
+                  && JSSP_SUCCESS == jssp_tape_int (&t, jssp_tape_at (&t, 0, 1), &v) && INT64_MIN == v
+                  && JSSP_ERROR_INVAL == jssp_tape_int (&t, jssp_tape_at (&t, 0, 2), &v)
+                  && JSSP_ERROR_INVAL == jssp_tape_int (&t, jssp_tape_at (&t, 0, 3), &v),
+                  "Out of range integer converted");
+  return 0;
+}
+
+#define test_json_lookup(idx, ptr, e, t) do { \
+  size_t l = 0; \
+  jssptapetype_t ty = 0; \
+  const char *v = jssp_index_lookup(idx, ptr, &l, &ty); \
+  if ((NULL == e && NULL != v) \
+    || (NULL != e && (NULL == v || l != strlen (e) || 0 != memcmp (v, e, l) || ty != t))) \
+    { \
+      printf("Test failed: Lookup of %s gave %.*s.\n", ptr, v ? (int) l : 4, v ? v : "NULL"); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_index ()
+{
+  const char *js = " {\"id\": 42, \"name\": \"a \\\"b\\\"\", \"a/b\": 1, \"m~n\": 2,"
+    " \"items\": [{\"k\": [true, null]}, [], -1.5e3], \"e\": {}}\n[7]";
+  jsspindexentry_t entries[64];
+  jssp_index idx;
+
+  jssp_index_init (&idx, entries, sizeof(entries), NULL);
+  if (JSSP_SUCCESS != jssp_index_build (&idx, js, strlen (js)))
+    {
+      printf("Test failed: Index build failed.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  test_json_lookup(&idx, "/id", "42", JSSP_TAPE_NUMBER);
+  test_json_lookup(&idx, "/name", "\"a \\\"b\\\"\"", JSSP_TAPE_STRING);
+  test_json_lookup(&idx, "/a~1b", "1", JSSP_TAPE_NUMBER);
+  test_json_lookup(&idx, "/m~0n", "2", JSSP_TAPE_NUMBER);
+  test_json_lookup(&idx, "/items/0/k/1", "null", JSSP_TAPE_NULL);
+  test_json_lookup(&idx, "/items/0", "{\"k\": [true, null]}", JSSP_TAPE_OBJECT);
+  test_json_lookup(&idx, "/items/1", "[]", JSSP_TAPE_ARRAY);
+  test_json_lookup(&idx, "/items/2", "-1.5e3", JSSP_TAPE_NUMBER);
+  test_json_lookup(&idx, "/e", "{}", JSSP_TAPE_OBJECT);
+  test_json_lookup(&idx, "/items/3", NULL, 0);
+  test_json_lookup(&idx, "/items/01", NULL, 0);
+  test_json_lookup(&idx, "/nope", NULL, 0);
+  test_json_lookup(&idx, "/id/x", NULL, 0);
+  test_json_lookup(&idx, "/e/x", NULL, 0);
+
+  jssp_index_init (&idx, entries, sizeof(entries[0]) * 4, NULL);
+  if (JSSP_ERROR_NOMEM != jssp_index_build (&idx, js, strlen (js))
+    || JSSP_ERROR_PART != jssp_index_build (&idx, "[\"ab", 4)
+    || JSSP_ERROR_INVAL != jssp_index_build (&idx, "1]", 2))
+    {
+      printf("Test failed: Index errors not reported.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+int
+test_cache ()
+{
+#if defined(__unix__) || defined(__APPLE__)
+  const char *js = "{\"a\": [1, {\"b\": \"x\"}], \"c\": null}";
+  const char *js2 = "{\"a\": [2, {\"b\": \"y\"}], \"c\": true}";
+  char path[64], cache_path[64];
+  jssp_file_id id, id2;
+  jssp_index idx;
+  FILE *f;
+  int ok;
+
+  snprintf (path, sizeof(path), "/tmp/jssp_test_%ld.json", (long) getpid ());
+  snprintf (cache_path, sizeof(cache_path), "%s.idx", path);
+  unlink (cache_path);
+  f = fopen (path, "w");
+  if (NULL == f)
+    return 1;
+  fputs (js, f);
+  fclose (f);
+
+  /* cold: builds and writes the cache */
+  jssp_index_init (&idx, NULL, 0, &jssp_default_allocator);
+  ok = JSSP_SUCCESS == jssp_file_id_get (path, &id)
+    && JSSP_SUCCESS == jssp_index_build_cached (&idx, js, strlen (js), cache_path, &id)
+    && NULL == idx.map && 0 == access (cache_path, R_OK);
+  jssp_index_release (&idx);
+  /* warm: maps it */
+  ok = ok && JSSP_SUCCESS == jssp_index_build_cached (&idx, js, strlen (js), cache_path, &id)
+    && NULL != idx.map;
+  if (!ok)
+    {
+      printf("Test failed: Index cache not written or loaded.\n");
+      test_failed ++;
+      unlink (path);
+      unlink (cache_path);
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  test_json_lookup(&idx, "/a/1/b", "\"x\"", JSSP_TAPE_STRING);
+  test_json_lookup(&idx, "/c", "null", JSSP_TAPE_NULL);
+  jssp_index_release (&idx);
+
+  /* same size, other contents: the hash no longer matches */
+  f = fopen (path, "w");
+  if (NULL != f)
+    {
+      fputs (js2, f);
+      fclose (f);
+    }
+  ok = JSSP_SUCCESS == jssp_file_id_get (path, &id2)
+    && JSSP_ERROR_INVAL == jssp_index_load (&idx, cache_path, &id2, js2, strlen (js2))
+    && JSSP_SUCCESS == jssp_index_build_cached (&idx, js2, strlen (js2), cache_path, &id2)
+    && NULL == idx.map;
+  jssp_index_release (&idx);
+  ok = ok && JSSP_ERROR_INVAL == jssp_index_load (&idx, cache_path, &id, js, strlen (js))
+    && JSSP_SUCCESS == jssp_index_load (&idx, cache_path, &id2, js2, strlen (js2));
+  if (!ok)
+    {
+      printf("Test failed: Stale index cache used.\n");
+      test_failed ++;
+    }
+  else
+    {
+      printf("Test passed.\n");
+      test_passed ++;
+      test_json_lookup(&idx, "/c", "true", JSSP_TAPE_TRUE);
+    }
+  jssp_index_release (&idx);
+
+  /* a damaged entry table never leads a lookup outside js */
+  {
+    static const struct
+    {
+      int last; /* the entry counted from the end */
+      size_t i;
+      int next; /* the field changed */
+      uint64_t value;
+    } damage[] =
+      {
+        { 1, 0, 0, 0 },
+        { 1, 0, 1, 0 },
+        { 0, 0, 1, UINT64_MAX },
+        { 0, 0, 1, 0 },
+        { 0, 2, 1, 1 },
+        { 0, 3, 0, UINT64_MAX },
+        { 0, 4, 0, 33 },
+      };
+    static const char *pointers[] = { "", "/a", "/a/1", "/a/1/b", "/c", "/a/5" };
+    const char *v;
+    jsspindexentry_t e;
+    size_t d, i, l;
+
+    for (d = 0; ok && d < sizeof(damage) / sizeof(damage[0]); d++)
+      {
+        jssp_index_init (&idx, NULL, 0, &jssp_default_allocator);
+        ok = JSSP_SUCCESS == jssp_index_build (&idx, js2, strlen (js2))
+          && JSSP_SUCCESS == jssp_index_save (&idx, cache_path, &id2);
+        i = damage[d].last ? idx.len - 1 - damage[d].i : damage[d].i;
+        jssp_index_release (&idx);
+        f = fopen (cache_path, "r+b");
+        ok = ok && NULL != f
+          && 0 == fseek (f, (long) (sizeof(jssp_cache_header) + i * sizeof(e)), SEEK_SET)
+          && 1 == fread (&e, sizeof(e), 1, f);
+        if (damage[d].next)
+          e.next = damage[d].value;
+        else
+          e.offset = damage[d].value;
+        ok = ok && 0 == fseek (f, (long) (sizeof(jssp_cache_header) + i * sizeof(e)), SEEK_SET)
+          && 1 == fwrite (&e, sizeof(e), 1, f);
+        if (NULL != f)
+          fclose (f);
+        ok = ok && JSSP_SUCCESS == jssp_index_load (&idx, cache_path, &id2, js2, strlen (js2));
+        for (i = 0; ok && i < sizeof(pointers) / sizeof(pointers[0]); i++)
+          {
+            v = jssp_index_lookup (&idx, pointers[i], &l, NULL);
+            ok = NULL == v || (v >= js2 && l <= strlen (js2) - (size_t) (v - js2));
+          }
+        jssp_index_release (&idx);
+      }
+    /* and a damaged table is not written */
+    jssp_index_init (&idx, NULL, 0, &jssp_default_allocator);
+    ok = ok && JSSP_SUCCESS == jssp_index_build (&idx, js2, strlen (js2));
+    if (ok)
+      idx.entries[1].offset = 0;
+    ok = ok && JSSP_ERROR_INVAL == jssp_index_save (&idx, cache_path, &id2);
+    jssp_index_release (&idx);
+    if (!ok)
+      {
+        printf("Test failed: Damaged index cache %zu left the input.\n", d - 1);
+        test_failed ++;
+      }
+    else
+      {
+        printf("Test passed.\n");
+        test_passed ++;
+      }
+  }
+  jssp_index_release (&idx);
+  unlink (path);
+  unlink (cache_path);
+  return !ok;
+#else
+  return 0;
+#endif
+}
+
+/* Encode s fed step bytes more per call, compare with the expected bytes */
+#define test_json_encode(s, format, wsize, step, expect) do { \
+  testwrite_t t; \
+  jssp_parser p; \
+  jssp_encoder e; \
+  char buf[256], wbuf[wsize], scratch[64]; \
+  size_t l = 0, n = strlen (s); \
+  jssperr_t err = JSSP_ERROR_PART; \
+  t.len = 0; \
+  jssp_init(&p); \
+  jssp_encoder_init(&e, &p, format, wbuf, sizeof(wbuf), &test_flush_cb, &t); \
+  jssp_encoder_set_scratch(&e, scratch, sizeof(scratch)); \
+  while (l < n) \
+    { \
+      l = l + step < n ? l + step : n; \
+      err = jssp_parse(&p, s, l, buf, sizeof(buf), 100, &jssp_encoder_callback, &e); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_encoder_flush(&e); \
+  if (JSSP_SUCCESS != err || sizeof(expect) - 1 != t.len \
+    || 0 != memcmp (t.out, expect, t.len)) \
+    { \
+      printf("Test failed: Encoding %s returned %d, %d, %zu bytes.\n", s, err, \
+             e.last_err, t.len); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_binary ()
+{
+  const char *js = "{\"a\":[1,-1,500,1.5,1e300,\"\\u00e9x\"],\"b\":true,\"c\":null}";
+  const char *big = "[-18446744073709551616,-9223372036854775808,18446744073709551615,"
+    "-0,\"\\ud83d\\ude00\\\"\"]";
+  const char *sixteen = "[0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0]";
+  testwrite_t t;
+  jssp_parser p;
+  jssp_encoder e;
+  char buf[256], wbuf[16];
+
+  test_json_encode(js, JSSP_BIN_CBOR, 16, 1000,
+                   "\xbf" "\x61" "a" "\x9f" "\x01" "\x20" "\x19\x01\xf4" "\xf9\x3e\x00"
+                   "\xfb\x7e\x37\xe4\x3c\x88\x00\x75\x9c" "\x63\xc3\xa9" "x" "\xff"
+                   "\x61" "b" "\xf5" "\x61" "c" "\xf6" "\xff");
+  test_json_encode(js, JSSP_BIN_CBOR, 16, 1,
+                   "\xbf" "\x61" "a" "\x9f" "\x01" "\x20" "\x19\x01\xf4" "\xf9\x3e\x00"
+                   "\xfb\x7e\x37\xe4\x3c\x88\x00\x75\x9c" "\x63\xc3\xa9" "x" "\xff"
+                   "\x61" "b" "\xf5" "\x61" "c" "\xf6" "\xff");
+  test_json_encode(js, JSSP_BIN_MSGPACK, 64, 3,
+                   "\x83" "\xa1" "a" "\x96" "\x01" "\xff" "\xcd\x01\xf4" "\xca\x3f\xc0\x00\x00"
+                   "\xcb\x7e\x37\xe4\x3c\x88\x00\x75\x9c" "\xa3\xc3\xa9" "x"
+                   "\xa1" "b" "\xc3" "\xa1" "c" "\xc0");
+  test_json_encode(big, JSSP_BIN_CBOR, 16, 7,
+                   "\x9f" "\xfa\xdf\x80\x00\x00"
+                   "\x3b\x7f\xff\xff\xff\xff\xff\xff\xff"
+                   "\x1b\xff\xff\xff\xff\xff\xff\xff\xff" "\xf9\x80\x00"
+                   "\x65\xf0\x9f\x98\x80\"" "\xff");
+  test_json_encode(big, JSSP_BIN_MSGPACK, 64, 1000,
+                   "\x95" "\xca\xdf\x80\x00\x00"
+                   "\xd3\x80\x00\x00\x00\x00\x00\x00\x00"
+                   "\xcf\xff\xff\xff\xff\xff\xff\xff\xff" "\xca\x80\x00\x00\x00"
+                   "\xa5\xf0\x9f\x98\x80\"");
+  test_json_encode("[-0.1,123456789.125]", JSSP_BIN_CBOR, 16, 1000,
+                   "\x9f" "\xfb\xbf\xb9\x99\x99\x99\x99\x99\x9a"
+                   "\xfb\x41\x9d\x6f\x34\x54\x80\x00\x00" "\xff");
+  test_json_encode(sixteen, JSSP_BIN_MSGPACK, 32, 1000,
+                   "\xdc\x00\x10" "\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0\0");
+  /* an escaped string longer than the buffer is unescaped piece by piece */
+  test_json_encode("[\"\\u00e9\\u00e9\\u00e9\\u00e9\\u00e9\\u00e9\\ud83d\\ude00\\n\"]",
+                   JSSP_BIN_CBOR, 16, 1000,
+                   "\x9f" "\x71" "\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9\xc3\xa9"
+                   "\xf0\x9f\x98\x80" "\n" "\xff");
+
+  /* escapes are never split and a broken \u keeps its u */
+  {
+    const char *s = "\\u00e9\\u00e9", *q = s;
+    char out[8];
+
+    if (2 != jssp_unescape_part (out, 3, &q, s + 12) || q != s + 6
+      || 0 != memcmp (out, "\xc3\xa9", 2)
+      || 4 != jssp_unescape (out, "a\\uzz", 5) || 0 != memcmp (out, "auzz", 4))
+      {
+        printf("Test failed: Partial unescape.\n");
+        test_failed ++;
+        return 1;
+      }
+    printf("Test passed.\n");
+    test_passed ++;
+  }
+
+  /* an open MessagePack container cannot be flushed before it is counted */
+  t.len = 0;
+  jssp_init (&p);
+  jssp_encoder_init (&e, &p, JSSP_BIN_MSGPACK, wbuf, sizeof(wbuf), &test_flush_cb, &t);
+  if (JSSP_TERMINATE != jssp_parse (&p, sixteen, strlen (sixteen), buf, sizeof(buf), 100,
+                                    &jssp_encoder_callback, &e)
+    || JSSP_ERROR_NOMEM != e.last_err)
+    {
+      printf("Test failed: Oversized MessagePack container not reported.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+/* Batches printed column by column, null for missing values */
+int
+test_batch_cb (void *cls,
+               const jssp_column *columns,
+               size_t ncolumns,
+               size_t rows)
+{
+  testwrite_t *t = cls;
+  const jssp_column *col;
+  const int32_t *off;
+  size_t i, r;
+  int n;
+
+  n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "%zu rows", rows);
+  t->len += n;
+  for (i = 0; i < ncolumns; i++)
+    {
+      col = columns + i;
+      off = col->values;
+      t->len += snprintf (t->out + t->len, sizeof(t->out) - t->len, " %s:", col->path);
+      for (r = 0; r < rows; r++)
+        {
+          if (!jssp_column_bit(col->validity, r))
+            n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "null");
+          else if (JSSP_COLUMN_INT64 == col->type)
+            n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "%lld",
+                          (long long) ((int64_t *) col->values)[r]);
+          else if (JSSP_COLUMN_DOUBLE == col->type)
+            n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "%g",
+                          ((double *) col->values)[r]);
+          else if (JSSP_COLUMN_BOOL == col->type)
+            n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "%s",
+                          jssp_column_bit((uint8_t *) col->values, r) ? "true" : "false");
+          else
+            n = snprintf (t->out + t->len, sizeof(t->out) - t->len, "%.*s",
+                          (int) (off[r + 1] - off[r]), col->data + off[r]);
+          t->len += n;
+          if (r + 1 < rows)
+            t->out[t->len++] = ',';
+        }
+    }
+  t->out[t->len++] = ';';
+  t->out[t->len] = '\0';
+  return 0;
+}
+
+/* Columnize s fed step bytes more per call */
+#define test_json_columns(s, step, rows, bytes, expect) do { \
+  testwrite_t t; \
+  jssp_parser p; \
+  jssp_columnizer c; \
+  jssp_column cols[4]; \
+  uint8_t validity[4][2], bools[2]; \
+  int64_t ints[16]; \
+  double doubles[16]; \
+  int32_t offsets[17]; \
+  char buf[256], data[64], scratch[64]; \
+  size_t l = 0, n = strlen (s); \
+  jssperr_t err = JSSP_ERROR_PART; \
+  memset (cols, 0, sizeof(cols)); \
+  cols[0].path = "/id"; cols[0].type = JSSP_COLUMN_INT64; cols[0].values = ints; \
+  cols[1].path = "/user/name"; cols[1].type = JSSP_COLUMN_STRING; cols[1].values = offsets; \
+  cols[1].data = data; cols[1].data_size = bytes; \
+  cols[2].path = "/score"; cols[2].type = JSSP_COLUMN_DOUBLE; cols[2].values = doubles; \
+  cols[3].path = "/ok"; cols[3].type = JSSP_COLUMN_BOOL; cols[3].values = bools; \
+  for (l = 0; l < 4; l++) \
+    cols[l].validity = validity[l]; \
+  l = 0; \
+  t.len = 0; \
+  jssp_init(&p); \
+  jssp_columnizer_init(&c, &p, cols, 4, rows, &test_batch_cb, &t); \
+  jssp_columnizer_set_scratch(&c, scratch, sizeof(scratch)); \
+  while (l < n) \
+    { \
+      l = l + step < n ? l + step : n; \
+      err = jssp_parse(&p, s, l, buf, sizeof(buf), 100, &jssp_columnizer_callback, &c); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_columnizer_flush(&c); \
+  if (JSSP_SUCCESS != err) \
+    { \
+      printf("Test failed: Columnizing %s returned %d, %d.\n", s, err, c.last_err); \
+      test_failed ++; \
+      return 1; \
+    } \
+  test_write_equal(&t, expect); \
+}while(0)
+
+int
+test_columns ()
+{
+  const char *js =
+    "{\"id\":1,\"user\":{\"name\":\"a\\\"b\",\"tags\":[1]},\"score\":1.5,\"ok\":true,"
+    "\"skip\":{\"x\":[1,2,{\"id\":9}]}}\n"
+    "{\"id\":\"x\",\"user\":{\"name\":\"c\"},\"ok\":false,\"score\":[2]}\n"
+    "{\"score\":-2,\"id\":3,\"user\":{\"name\":\"\\u00e9\"},\"id\":4}\n";
+  jssp_columnizer c;
+  jssp_column col;
+
+  test_json_columns(js, 1000, 2, 64,
+                    "2 rows /id:1,null /user/name:a\"b,c /score:1.5,null /ok:true,false;"
+                    "1 rows /id:3 /user/name:\xc3\xa9 /score:-2 /ok:null;");
+  test_json_columns(js, 1, 2, 64,
+                    "2 rows /id:1,null /user/name:a\"b,c /score:1.5,null /ok:true,false;"
+                    "1 rows /id:3 /user/name:\xc3\xa9 /score:-2 /ok:null;");
+  /* the string data runs out while the third row is being filled */
+  test_json_columns(js, 7, 16, 4,
+                    "2 rows /id:1,null /user/name:a\"b,c /score:1.5,null /ok:true,false;"
+                    "1 rows /id:3 /user/name:\xc3\xa9 /score:-2 /ok:null;");
+
+  memset (&col, 0, sizeof(col));
+  col.path = "id";
+  if (JSSP_ERROR_INVAL != jssp_columnizer_init (&c, NULL, &col, 1, 16, &test_batch_cb, NULL))
+    {
+      printf("Test failed: Bad column path accepted.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+typedef struct
+{
+  jssp_parser *parser;
+  double d[16];
+  int64_t i[16];
+  size_t cap;
+  size_t count;
+  int after; /* values seen besides the bulk arrays */
+  jssp_bulk bulk;
+} testbulk_t;
+
+/* Arrays under "v" go to d, under "n" to i */
+int
+test_bulk_cb (void *cls,
+              jssptype_t type,
+              size_t depth,
+              size_t index,
+              const char *key,
+              size_t key_len,
+              const char *data,
+              size_t data_size,
+              uint64_t stream_offset)
+{
+  testbulk_t *t = cls;
+
+  if (JSSP_ARRAY_OPEN == type && (1 == depth || (1 == key_len && key[0] == 'v')))
+    return JSSP_SUCCESS != jssp_bulk_numbers (t->parser, &t->bulk, JSSP_BULK_DOUBLE, t->d, t->cap);
+  if (JSSP_ARRAY_OPEN == type && 1 == key_len && key[0] == 'n')
+    return JSSP_SUCCESS != jssp_bulk_numbers (t->parser, &t->bulk, JSSP_BULK_INT64, t->i, t->cap);
+  if (JSSP_ARRAY_CLOSE == type)
+    t->count += jssp_bulk_count (&t->bulk);
+  else if (JSSP_OBJECT_VAL == type && JSSP_SUCCESS == t->parser->last_err)
+    t->after++;
+  return 0;
+}
+
+/* Parse s in chunks of step bytes, each chunk dropped after the call */
+#define test_json_bulk(s, step, size, e, numbers, events) do { \
+  testbulk_t t; \
+  jssp_parser p; \
+  char buf[256], chunk[64]; \
+  size_t l, n = strlen (s), k; \
+  jssperr_t err = JSSP_ERROR_PART; \
+  memset (&t, 0, sizeof(t)); \
+  t.parser = &p; \
+  t.cap = size; \
+  jssp_init(&p); \
+  for (l = 0; l < n; l += k) \
+    { \
+      k = n - l < step ? n - l : step; \
+      memcpy (chunk, s + l, k); \
+      memset (chunk + k, 'x', sizeof(chunk) - k); \
+      err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, &test_bulk_cb, &t); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+  if (e != err || numbers != t.count || events != t.after) \
+    { \
+      printf("Test failed: Bulk parse of %s returned %d, %zu numbers, %d events.\n", \
+             s, err, t.count, t.after); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+  memcpy (d, t.d, sizeof(d)); \
+  memcpy (i, t.i, sizeof(i)); \
+}while(0)
+
+int
+test_bulk ()
+{
+  const char *js = "{\"v\": [1.5, -2, 3e2, 0.000123, 12345678901234567890,\n"
+    " 1.7976931348623157e308, -0.1, 2.5E-3], \"n\": [0, -9007199254740993,"
+    " 123456789012345678, 9223372036854775807], \"x\": true}";
+  const double dv[] = { 1.5, -2, 3e2, 0.000123, 12345678901234567890.0,
+    1.7976931348623157e308, -0.1, 2.5E-3 };
+  const int64_t iv[] = { 0, INT64_C(-9007199254740993), INT64_C(123456789012345678),
+    INT64_MAX };
+  double d[16];
+  int64_t i[16];
+  size_t step, k;
+
+  for (step = 1; step <= 64; step *= 4)
+    {
+      test_json_bulk(js, step, 16, JSSP_SUCCESS, 12, 1);
+      for (k = 0; k < 8; k++)
+        if (d[k] != dv[k] || (k < 4 && i[k] != iv[k]))
+          {
+            printf("Test failed: Bulk number %zu read in %zu byte chunks is %g, %lld.\n",
+                   k, step, d[k], (long long) i[k]);
+            test_failed ++;
+            return 1;
+          }
+    }
+  test_json_bulk("[[1, 2], [3, [4]], []]", 3, 16, JSSP_SUCCESS, 4, 0);
+  if (d[0] != 1 || d[3] != 4)
+    {
+      printf("Test failed: Nested bulk arrays not flattened.\n");
+      test_failed ++;
+      return 1;
+    }
+  /* a stale ERANGE does not reject the int64 bounds */
+  errno = ERANGE;
+  test_json_bulk("{\"n\": [9223372036854775807, -9223372036854775808]}", 64, 16,
+                 JSSP_SUCCESS, 2, 0);
+  if (i[0] != INT64_MAX || i[1] != INT64_MIN)
+    {
+      printf("Test failed: Bulk int64 bounds read as %lld, %lld.\n",
+             (long long) i[0], (long long) i[1]);
+      test_failed ++;
+      return 1;
+    }
+  test_json_bulk("{\"n\": [9223372036854775808]}", 64, 16, JSSP_ERROR_INVAL, 0, 0);
+  /* numbers up to JSSP_NUMBER_SIZE bytes, cut or not */
+  test_json_bulk("[1000000000000000000000000000000000000000000000000000000000000000000000]",
+                 16, 16, JSSP_SUCCESS, 1, 0);
+  if (d[0] != 1e69)
+    {
+      printf("Test failed: Long bulk number read as %g.\n", d[0]);
+      test_failed ++;
+      return 1;
+    }
+  test_json_bulk("[1, 2, 3]", 64, 2, JSSP_ERROR_NOMEM, 0, 0);
+  test_json_bulk("[1, \"a\"]", 64, 16, JSSP_ERROR_INVAL, 0, 0);
+  test_json_bulk("[1,, 2]", 64, 16, JSSP_ERROR_INVAL, 0, 0);
+  test_json_bulk("[1 2]", 64, 16, JSSP_ERROR_INVAL, 0, 0);
+  test_json_bulk("{\"n\": [1.5]}", 64, 16, JSSP_ERROR_INVAL, 0, 0);
+
+  /* a bulk array longer than the quantum yields, cut numbers and all */
+  {
+    static const size_t budgets[][2] = { { 16, 0 }, { 7, 0 }, { 0, 5 }, { 10, 3 } };
+    const char *big = "{\"v\": [0.5, 1.25, -3, 40, 5e-1, 600, 7.125, -8, 90, 10.5,"
+      " 11, 12.75, 13, 14e1, 15, 16.5]}";
+    testbulk_t t;
+    jssp_parser p;
+    jssp_budget budget;
+    char buf[256];
+    size_t b, yields;
+    jssperr_t err;
+
+    for (b = 0; b < sizeof(budgets) / sizeof(budgets[0]); b++)
+      {
+        memset (&t, 0, sizeof(t));
+        t.parser = &p;
+        t.cap = 16;
+        jssp_init (&p);
+        budget.max_bytes = budgets[b][0];
+        budget.max_events = budgets[b][1];
+        jssp_set_budget (&p, &budget);
+        for (yields = 0; JSSP_YIELD == (err = jssp_parse (&p, big, strlen (big), buf,
+                                                          sizeof(buf), 100, &test_bulk_cb,
+                                                          &t)); yields++)
+          ;
+        if (JSSP_SUCCESS != err || 16 != t.count || yields < 3
+          || 0.5 != t.d[0] || 0.5 != t.d[4] || 140 != t.d[13] || 16.5 != t.d[15])
+          {
+            printf("Test failed: Bulk array under budget %zu returned %d, %zu numbers, "
+                   "%zu yields.\n", b, err, t.count, yields);
+            test_failed ++;
+            return 1;
+          }
+        printf("Test passed.\n");
+        test_passed ++;
+      }
+  }
+
+  /* the conversions shared with the tape, the encoder and the columnizer */
+  {
+    int64_t v;
+    double x;
+
+    if (JSSP_SUCCESS != jssp_number_int ("-9223372036854775808", 20, &v) || INT64_MIN != v
+      || JSSP_ERROR_INVAL != jssp_number_int ("9223372036854775808", 19, &v)
+      || JSSP_ERROR_INVAL != jssp_number_int ("-", 1, &v)
+      || JSSP_ERROR_INVAL != jssp_number_int ("1e3", 3, &v)
+      || JSSP_SUCCESS != jssp_number_double ("1.5e3", 5, &x) || 1500 != x
+      || JSSP_SUCCESS != jssp_number_double ("12345678901234567890", 20, &x)
+      || 12345678901234567890.0 != x
+      || JSSP_ERROR_INVAL != jssp_number_double ("0x10", 4, &x)
+      || JSSP_ERROR_INVAL != jssp_number_double ("-inf", 4, &x)
+      || JSSP_ERROR_INVAL != jssp_number_double ("1e", 2, &x)
+      || JSSP_ERROR_INVAL != jssp_number_double ("", 0, &x))
+      {
+        printf("Test failed: Number conversion.\n");
+        test_failed ++;
+        return 1;
+      }
+    printf("Test passed.\n");
+    test_passed ++;
+  }
+  return 0;
+}
+
+typedef struct
+{
+  jssp_base64 b;
+  jssp_parser *parser;
+  char out[512];
+  size_t len;
+  int values; /* blobs finished */
+} testbase64_t;
+
+int
+test_base64_sink (void *cls,
+                  const char *data,
+                  size_t len)
+{
+  testbase64_t *t = cls;
+
+  if (t->len + len > sizeof(t->out))
+    return 1;
+  memcpy (t->out + t->len, data, len);
+  t->len += len;
+  return 0;
+}
+
+/* Only the values under "blob" are decoded */
+int
+test_base64_cb (void *cls,
+                jssptype_t type,
+                size_t depth,
+                size_t index,
+                const char *key,
+                size_t key_len,
+                const char *data,
+                size_t data_size,
+                uint64_t stream_offset)
+{
+  testbase64_t *t = cls;
+
+  if (JSSP_OBJECT_VAL != type || 4 != key_len || 0 != memcmp (key, "blob", 4))
+    return 0;
+  if (JSSP_SUCCESS != jssp_base64_event (&t->b, t->parser, data, data_size))
+    return 1;
+  if (JSSP_SUCCESS == t->parser->last_err)
+    t->values++;
+  return 0;
+}
+
+#define test_base64_decode(s, e, r) do { \
+  jssp_base64 b; \
+  char out[16]; \
+  jssperr_t err; \
+  jssp_base64_init (&b, out, sizeof(out), NULL, NULL); \
+  err = jssp_base64_update (&b, s, strlen (s)); \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_base64_finish (&b); \
+  if (e != err || (JSSP_SUCCESS == e \
+    && (b.len != strlen (r) || 0 != memcmp (out, r, b.len)))) \
+    { \
+      printf("Test failed: Base64 %s returned %d, %.*s.\n", s, err, (int) b.len, out); \
+      test_failed ++; \
+      return 1; \
+    } \
+  printf("Test passed.\n"); \
+  test_passed ++; \
+}while(0)
+
+int
+test_base64 ()
+{
+  static const char alphabet[] =
+    "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  unsigned char bin[301];
+  char js[1024], chunk[128], buf[256], dec[8];
+  testbase64_t t;
+  jssp_parser p;
+  jssperr_t err = JSSP_ERROR_PART;
+  size_t i, n, l, k, step, line = 0;
+  uint32_t v;
+
+  test_base64_decode("", JSSP_SUCCESS, "");
+  test_base64_decode("QQ", JSSP_SUCCESS, "A");
+  test_base64_decode("QQ==", JSSP_SUCCESS, "A");
+  test_base64_decode("QUI=", JSSP_SUCCESS, "AB");
+  test_base64_decode("QUJD", JSSP_SUCCESS, "ABC");
+  test_base64_decode("+/-_", JSSP_SUCCESS, "\xfb\xff\xbf");
+  test_base64_decode("QUJDREVGR0hJ\\/\\/8=", JSSP_SUCCESS, "ABCDEFGHI\xff\xff");
+  test_base64_decode("Q", JSSP_ERROR_INVAL, "");
+  test_base64_decode("Q===", JSSP_ERROR_INVAL, "");
+  test_base64_decode("QQ=A", JSSP_ERROR_INVAL, "");
+  test_base64_decode("QUJD*EVG", JSSP_ERROR_INVAL, "");
+  test_base64_decode("QUJD\\u0041", JSSP_ERROR_INVAL, "");
+
+  /* 301 bytes, '/' escaped and a line break every 76 chars as some
+   * writers do */
+  for (i = 0; i < sizeof(bin); i++)
+    bin[i] = (unsigned char) (i * 131 + 7);
+  n = snprintf (js, sizeof(js), "{\"id\": 1, \"blob\": \"");
+  for (i = 0; i < sizeof(bin); i += 3)
+    {
+      v = (uint32_t) bin[i] << 16;
+      if (i + 1 < sizeof(bin))
+        v |= (uint32_t) bin[i + 1] << 8;
+      if (i + 2 < sizeof(bin))
+        v |= bin[i + 2];
+      for (k = 0; k < 4; k++)
+        {
+          if (sizeof(bin) - i < 3 && k > sizeof(bin) - i)
+            js[n++] = '=';
+          else if (alphabet[(v >> (18 - 6 * k)) & 63] == '/')
+            n += snprintf (js + n, 3, "\\/");
+          else
+            js[n++] = alphabet[(v >> (18 - 6 * k)) & 63];
+          if (++line % 76 == 0)
+            n += snprintf (js + n, 3, "\\n");
+        }
+    }
+  n += snprintf (js + n, sizeof(js) - n, "\", \"s\": \"QUJD\"}");
+
+  for (step = 1; step <= 128; step *= 2)
+    {
+      memset (&t, 0, sizeof(t));
+      t.parser = &p;
+      jssp_base64_init (&t.b, dec, sizeof(dec), &test_base64_sink, &t);
+      jssp_init(&p);
+      for (l = 0; l < n; l += k)
+        {
+          k = n - l < step ? n - l : step;
+          memcpy (chunk, js + l, k);
+          err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, &test_base64_cb, &t);
+          if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err)
+            break;
+        }
+      if (JSSP_SUCCESS != err || 1 != t.values || sizeof(bin) != t.len
+        || sizeof(bin) != t.b.total || 0 != memcmp (t.out, bin, sizeof(bin)))
+        {
+          printf("Test failed: Base64 value read in %zu byte chunks returned %d, %zu bytes.\n",
+                 step, err, t.len);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+  return 0;
+}
+
+typedef struct
+{
+  jssp_parser *parser;
+  jssp_fingerprint *f;
+  uint64_t digest[8];
+  uint64_t start[8];
+  uint64_t end[8];
+  size_t count;
+} testfingerprint_t;
+
+/* Keep the fingerprint of each record as it closes */
+int
+test_fingerprint_cb (void *cls,
+                     jssptype_t type,
+                     size_t depth,
+                     size_t index,
+                     const char *key,
+                     size_t key_len,
+                     const char *data,
+                     size_t data_size,
+                     uint64_t stream_offset)
+{
+  testfingerprint_t *t = cls;
+
+  if (1 != depth || t->count >= 8
+    || !(JSSP_ARRAY_CLOSE == type || JSSP_OBJECT_CLOSE == type
+      || (JSSP_ARRAY_VAL == type && JSSP_SUCCESS == t->parser->last_err)))
+    return 0;
+  t->digest[t->count] = t->f->digest;
+  t->start[t->count] = t->f->start;
+  t->end[t->count] = t->f->end;
+  t->count++;
+  return 0;
+}
+
+/* Parse s in chunks of step bytes and fingerprint its records */
+#define test_json_fingerprint(s, step, mode) do { \
+  jssp_parser p; \
+  jssp_fingerprint f; \
+  char buf[256], chunk[64]; \
+  size_t l, n = strlen (s), k; \
+  jssperr_t err = JSSP_ERROR_PART; \
+  memset (&t, 0, sizeof(t)); \
+  t.parser = &p; \
+  t.f = &f; \
+  jssp_init(&p); \
+  jssp_fingerprint_init (&f, mode, 0); \
+  jssp_set_fingerprint (&p, &f); \
+  for (l = 0; l < n; l += k) \
+    { \
+      k = n - l < step ? n - l : step; \
+      memcpy (chunk, s + l, k); \
+      memset (chunk + k, 'x', sizeof(chunk) - k); \
+      err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, &test_fingerprint_cb, &t); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+  if (JSSP_SUCCESS != err || 4 != t.count) \
+    { \
+      printf("Test failed: Fingerprint of %s in %zu byte chunks returned %d, %zu records.\n", \
+             s, (size_t) step, err, t.count); \
+      test_failed ++; \
+      return 1; \
+    } \
+}while(0)
+
+uint64_t
+test_hash (const char *s,
+           size_t len,
+           uint64_t seed)
+{
+  jssp_hash h;
+
+  jssp_hash_init (&h, seed);
+  jssp_hash_update (&h, s, len);
+  return jssp_hash_digest (&h);
+}
+
+int
+test_fingerprint ()
+{
+  const char *js = "{\"a\": 1, \"b\": [1, 2]}\n{\"a\":1,\"b\":[1,2]}\n\"x y\"\n [ ]\n";
+  const char *raw[] = { "{\"a\": 1, \"b\": [1, 2]}", "{\"a\":1,\"b\":[1,2]}",
+    "\"x y\"", "[ ]" };
+  const char *tokens[] = { "{\"a\":1,\"b\":[1,2]}", "{\"a\":1,\"b\":[1,2]}",
+    "\"x y\"", "[]" };
+  const uint64_t start[] = { 0, 22, 40, 47 };
+  unsigned char data[100];
+  testfingerprint_t t;
+  jssp_hash h;
+  size_t i, step;
+
+  /* XXH64 reference values */
+  for (i = 0; i < sizeof(data); i++)
+    data[i] = (unsigned char) (i * 7 + 3);
+  if (UINT64_C(0xef46db3751d8e999) != test_hash ("", 0, 0)
+    || UINT64_C(0x44bc2cf5ad770999) != test_hash ("abc", 3, 0)
+    || UINT64_C(0xa61f8d4c170fe531) != test_hash ((char *) data, sizeof(data), 0)
+    || UINT64_C(0x7dd00be8513c25a2) != test_hash ((char *) data, sizeof(data), 42))
+    {
+      printf("Test failed: XXH64 reference values.\n");
+      test_failed ++;
+      return 1;
+    }
+  for (step = 1; step < sizeof(data); step += 7)
+    {
+      jssp_hash_init (&h, 42);
+      for (i = 0; i < sizeof(data); i += step)
+        jssp_hash_update (&h, data + i, sizeof(data) - i < step ? sizeof(data) - i : step);
+      if (UINT64_C(0x7dd00be8513c25a2) != jssp_hash_digest (&h))
+        {
+          printf("Test failed: XXH64 fed %zu bytes at a time.\n", step);
+          test_failed ++;
+          return 1;
+        }
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  for (step = 1; step <= 64; step *= 4)
+    {
+      test_json_fingerprint(js, step, JSSP_FINGERPRINT_RAW);
+      for (i = 0; i < 4; i++)
+        if (t.digest[i] != test_hash (raw[i], strlen (raw[i]), 0)
+          || t.start[i] != start[i] || t.end[i] != start[i] + strlen (raw[i]))
+          {
+            printf("Test failed: Record %zu read in %zu byte chunks hashed as %llx, %llu-%llu.\n",
+                   i, step, (unsigned long long) t.digest[i],
+                   (unsigned long long) t.start[i], (unsigned long long) t.end[i]);
+            test_failed ++;
+            return 1;
+          }
+      printf("Test passed.\n");
+      test_passed ++;
+
+      test_json_fingerprint(js, step, JSSP_FINGERPRINT_TOKENS);
+      for (i = 0; i < 4; i++)
+        if (t.digest[i] != test_hash (tokens[i], strlen (tokens[i]), 0))
+          {
+            printf("Test failed: Tokens of record %zu read in %zu byte chunks hashed as %llx.\n",
+                   i, step, (unsigned long long) t.digest[i]);
+            test_failed ++;
+            return 1;
+          }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+  return 0;
+}
+
+typedef struct
+{
+  int hit; /* the parsed record has a wanted service */
+  size_t matches;
+  uint64_t offset[8];
+} testfilter_t;
+
+int
+test_filter_cb (void *cls,
+                jssptype_t type,
+                size_t depth,
+                size_t index,
+                const char *key,
+                size_t key_len,
+                const char *data,
+                size_t data_size,
+                uint64_t stream_offset)
+{
+  testfilter_t *t = cls;
+
+  if (JSSP_OBJECT_VAL == type && 2 == depth && 7 == key_len
+    && 0 == memcmp (key, "service", 7)
+    && ((8 == data_size && 0 == memcmp (data, "payments", 8))
+      || (6 == data_size && 0 == memcmp (data, "refund", 6))))
+    t->hit = 1;
+  return 0;
+}
+
+/* Confirm the candidate from what the parser saw */
+int
+test_filter_record (void *cls,
+                    const char *record,
+                    size_t len,
+                    uint64_t offset)
+{
+  testfilter_t *t = cls;
+
+  if (t->hit && t->matches < 8)
+    t->offset[t->matches++] = offset;
+  t->hit = 0;
+  return 0;
+}
+
+int
+test_filter ()
+{
+  const char *js = "{\"service\": \"payments\", \"id\": 1}\n"
+    "{\"service\": \"search\", \"id\": 2}\n"
+    "{\"service\": \"search\", \"note\": \"payments\"}\n"
+    "42\n"
+    "{\"service\":\"refund\",\"id\":4}\n"
+    "\"payments\"\n"
+    "{\"service\": \"payments\", \"id\": 6}";
+  const char *needles[] = { "payments", "refund" };
+  const char *empty[] = { "" };
+  const uint64_t offset[] = { 0, 109, 148 };
+  char carry[64], buf[256];
+  testfilter_t t;
+  jssp_filter f;
+  jssp_parser p;
+  jssperr_t err = JSSP_SUCCESS;
+  size_t step, l, k, n = strlen (js);
+
+  for (step = 1; step <= 256; step *= 4)
+    {
+      memset (&t, 0, sizeof(t));
+      jssp_init(&p);
+      jssp_filter_init (&f, needles, 2, '\n', carry, sizeof(carry),
+                        &test_filter_record, &t);
+      jssp_filter_set_parser (&f, &p, buf, sizeof(buf), 100, &test_filter_cb, &t);
+      for (l = 0; l < n && JSSP_SUCCESS == err; l += k)
+        {
+          k = n - l < step ? n - l : step;
+          err = jssp_filter_feed (&f, js + l, k);
+        }
+      if (JSSP_SUCCESS == err)
+        err = jssp_filter_finish (&f);
+      if (JSSP_SUCCESS != err || 5 != f.candidates || 3 != t.matches
+        || 0 != memcmp (t.offset, offset, sizeof(offset)))
+        {
+          printf("Test failed: Filter in %zu byte chunks returned %d, %llu candidates, %zu matches at %llu, %llu, %llu.\n",
+                 step, err, (unsigned long long) f.candidates, t.matches,
+                 (unsigned long long) t.offset[0], (unsigned long long) t.offset[1],
+                 (unsigned long long) t.offset[2]);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+
+  /* a record longer than the carry buffer */
+  jssp_filter_init (&f, needles, 2, '\n', carry, 16, NULL, NULL);
+  for (l = 0, err = JSSP_SUCCESS; l < n && JSSP_SUCCESS == err; l += 8)
+    err = jssp_filter_feed (&f, js + l, n - l < 8 ? n - l : 8);
+  if (JSSP_ERROR_NOMEM != err
+    || JSSP_ERROR_INVAL != jssp_filter_init (&f, empty, 1, '\n', carry, 16, NULL, NULL)
+    || JSSP_ERROR_INVAL != jssp_filter_init (&f, needles, 0, '\n', carry, 16, NULL, NULL))
+    {
+      printf("Test failed: Filter limits returned %d.\n", err);
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+typedef struct
+{
+  jssp_parser *parser;
+  size_t id; /* digits of a split value so far */
+  size_t ids[128];
+  size_t count;
+} testsample_t;
+
+int
+test_sample_cb (void *cls,
+                jssptype_t type,
+                size_t depth,
+                size_t index,
+                const char *key,
+                size_t key_len,
+                const char *data,
+                size_t data_size,
+                uint64_t stream_offset)
+{
+  testsample_t *t = cls;
+  size_t i;
+
+  if (JSSP_OBJECT_VAL != type || 2 != key_len || 0 != memcmp (key, "id", 2))
+    return 0;
+  for (i = 0; i < data_size; i++)
+    t->id = t->id * 10 + (data[i] - '0');
+  if (JSSP_SUCCESS == t->parser->last_err && t->count < 128)
+    {
+      t->ids[t->count++] = t->id;
+      t->id = 0;
+    }
+  return 0;
+}
+
+/* Sample js read in step byte chunks, set up by the statement setup */
+#define test_json_sample(step, setup, e) do { \
+  jssp_parser p; \
+  char buf[256]; \
+  size_t l, k; \
+  jssperr_t err = JSSP_SUCCESS; \
+  memset (&t, 0, sizeof(t)); \
+  t.parser = &p; \
+  jssp_init(&p); \
+  jssp_sampler_init (&s, &p, buf, sizeof(buf), 100, &test_sample_cb, &t); \
+  setup; \
+  for (l = 0; l < n && JSSP_SUCCESS == err; l += k) \
+    { \
+      k = n - l < step ? n - l : step; \
+      err = jssp_sampler_feed (&s, js + l, k); \
+    } \
+  if (JSSP_SUCCESS == err) \
+    err = jssp_sampler_finish (&s); \
+  if (e != err || (JSSP_SUCCESS == err \
+    && (records != s.records || t.count + s.errors != s.selected))) \
+    { \
+      printf("Test failed: Sampling in %zu byte chunks returned %d, %llu of %llu records, %zu parsed.\n", \
+             (size_t) step, err, (unsigned long long) s.selected, \
+             (unsigned long long) s.records, t.count); \
+      test_failed ++; \
+      return 1; \
+    } \
+}while(0)
+
+int
+test_sample ()
+{
+  char js[2048];
+  uint64_t storage[6 * 8], small[6 * 3], slots[6 * 16];
+  testsample_t t, first;
+  jssp_sampler s;
+  size_t i, n = 0, step, records = 100;
+
+  /* 100 records, the one with id 50 broken, and some empty lines */
+  for (i = 0; i < 100; i++)
+    n += snprintf (js + n, sizeof(js) - n, i == 50 ? "{\"x\": %zu,\n" : i % 7 ? "{\"id\": %zu}\n"
+                   : "{\"id\": %zu}\n\n", i);
+  js[--n] = '\0';
+
+  for (step = 1; step <= 256; step *= 4)
+    {
+      test_json_sample(step, jssp_sampler_set_stride (&s, 10), JSSP_SUCCESS);
+      for (i = 0; i < t.count; i++)
+        if (t.ids[i] != (i < 5 ? i * 10 : i * 10 + 10))
+          break;
+      if (9 != t.count || 1 != s.errors || i != t.count)
+        {
+          printf("Test failed: Every 10th record read in %zu byte chunks.\n", step);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+
+      /* the same records for the same seed, however the input is cut */
+      test_json_sample(step, jssp_sampler_set_rate (&s, 0.25, 7), JSSP_SUCCESS);
+      if (1 == step)
+        first = t;
+      if (t.count != first.count || t.count < 10 || t.count > 40
+        || 0 != memcmp (t.ids, first.ids, t.count * sizeof(size_t)))
+        {
+          printf("Test failed: Sampling at a rate in %zu byte chunks took %zu records.\n",
+                 step, t.count);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+
+  for (step = 1; step <= 256; step *= 4)
+    {
+      test_json_sample(step, jssp_sampler_set_reservoir (&s, 5, storage, sizeof(storage), 3),
+                       JSSP_SUCCESS);
+      if (1 == step)
+        first = t;
+      if (5 != t.count + s.errors || t.count != first.count
+        || 0 != memcmp (t.ids, first.ids, t.count * sizeof(size_t)))
+        {
+          printf("Test failed: Reservoir in %zu byte chunks parsed %zu records.\n",
+                 step, t.count);
+          test_failed ++;
+          return 1;
+        }
+      for (i = 0; i + 1 < t.count; i++)
+        if (t.ids[i] == t.ids[i + 1] || t.ids[i] >= 100)
+          {
+            printf("Test failed: Reservoir holds record %zu.\n", t.ids[i]);
+            test_failed ++;
+            return 1;
+          }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+
+  test_json_sample(64, jssp_sampler_set_rate (&s, 0, 1), JSSP_SUCCESS);
+  if (0 != s.selected)
+    {
+      printf("Test failed: Sampling at rate 0 took %llu records.\n",
+             (unsigned long long) s.selected);
+      test_failed ++;
+      return 1;
+    }
+  /* slots too small for a record leave it out */
+  test_json_sample(64, jssp_sampler_set_reservoir (&s, 5, small, sizeof(small), 3),
+                   JSSP_SUCCESS);
+  if (100 != s.skipped || 0 != s.selected)
+    {
+      printf("Test failed: Reservoir kept %llu records too large for it.\n",
+             (unsigned long long) (100 - s.skipped));
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+
+  /* an oversized record does not cost the sample */
+  n = 0;
+  for (i = 0; i < 3; i++)
+    n += snprintf (js + n, sizeof(js) - n, "{\"id\": %zu}\n", i);
+  n += snprintf (js + n, sizeof(js) - n, "{\"id\": 3, \"pad\": \"%0380d\"}\n", 0);
+  records = 4;
+  for (step = 1; step <= 256; step *= 4)
+    {
+      test_json_sample(step, jssp_sampler_set_reservoir (&s, 5, slots, sizeof(slots), 3),
+                       JSSP_SUCCESS);
+      if (3 != t.count || 1 != s.skipped || 3 != s.selected)
+        {
+          printf("Test failed: Reservoir with an oversized record in %zu byte chunks parsed "
+                 "%zu records.\n", step, t.count);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+  if (JSSP_ERROR_INVAL != jssp_sampler_set_rate (&s, 1.5, 0)
+    || JSSP_ERROR_INVAL != jssp_sampler_set_stride (&s, 0)
+    || JSSP_ERROR_INVAL != jssp_sampler_set_reservoir (&s, 5, small, 64, 0))
+    {
+      printf("Test failed: Sampler limits.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+typedef struct
+{
+  char log[2048];
+  size_t len;
+  size_t every; /* pause after every n-th event, 0 never */
+  size_t events;
+} testpause_t;
+
+/* Log each event, asking to pause now and then */
+int
+test_pause_cb (void *cls,
+               jssptype_t type,
+               size_t depth,
+               size_t index,
+               const char *key,
+               size_t key_len,
+               const char *data,
+               size_t data_size,
+               uint64_t stream_offset)
+{
+  testpause_t *t = cls;
+
+  t->len += snprintf (t->log + t->len, sizeof(t->log) - t->len, "%d:%zu:%zu:%.*s=%.*s@%llu;",
+                      type, depth, index, (int) key_len, key, (int) data_size, data,
+                      (unsigned long long) stream_offset);
+  if (t->len >= sizeof(t->log))
+    t->len = sizeof(t->log) - 1;
+  t->events++;
+  return 0 != t->every && 0 == t->events % t->every ? JSSP_PAUSE : 0;
+}
+
+/* Parse js in chunks of step bytes into log, resuming every pause */
+#define test_json_pause(step, pause_every, log) do { \
+  memset ((log), 0, sizeof(*(log))); \
+  (log)->every = pause_every; \
+  jssp_init(&p); \
+  err = JSSP_ERROR_PART; \
+  for (l = 0; l < n; l += k) \
+    { \
+      k = n - l < step ? n - l : step; \
+      memcpy (chunk, js + l, k); \
+      while (JSSP_PAUSE == (err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, \
+                                                   &test_pause_cb, (log)))) \
+        ; \
+      memset (chunk, 'x', sizeof(chunk)); \
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err) \
+        break; \
+    } \
+}while(0)
+
+int
+test_pause ()
+{
+  const char *js = "{\"name\": \"a long string value\", \"list\": [1, 2.5, true, null,"
+    " {\"k\": \"v\"}], \"nested\": {\"deep\": [[]], \"x\": -3}}\n[\"second\"]\n";
+  testpause_t ref, cref, t;
+  jssp_parser p;
+  char buf[256], chunk[64];
+  size_t step, every, l, k, n = strlen (js), pauses;
+  jssperr_t err;
+
+  memset (&ref, 0, sizeof(ref));
+  jssp_init(&p);
+  if (JSSP_SUCCESS != jssp_parse (&p, js, n, buf, sizeof(buf), 100, &test_pause_cb, &ref))
+    {
+      printf("Test failed: Pause reference parse.\n");
+      test_failed ++;
+      return 1;
+    }
+
+  for (every = 1; every <= 3; every++)
+    {
+      /* the whole text at once */
+      memset (&t, 0, sizeof(t));
+      t.every = every;
+      jssp_init(&p);
+      pauses = 0;
+      while (JSSP_PAUSE == (err = jssp_parse (&p, js, n, buf, sizeof(buf), 100,
+                                              &test_pause_cb, &t)))
+        pauses++;
+      if (JSSP_SUCCESS != err || pauses != ref.events / every
+        || t.len != ref.len || 0 != memcmp (t.log, ref.log, t.len))
+        {
+          printf("Test failed: Pausing every %zu events returned %d after %zu pauses:\n%.*s\n",
+                 every, err, pauses, (int) t.len, t.log);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+
+      /* chunks dropped once a call is done, not when it paused; the
+       * events must be the ones of the same chunks without pauses */
+      for (step = 1; step <= 64; step *= 4)
+        {
+          test_json_pause(step, 0, &cref);
+          test_json_pause(step, every, &t);
+          if (JSSP_SUCCESS != err || t.len != cref.len || 0 != memcmp (t.log, cref.log, t.len))
+            {
+              printf("Test failed: Pausing every %zu events in %zu byte chunks returned %d:\n%.*s\n",
+                     every, step, err, (int) t.len, t.log);
+              test_failed ++;
+              return 1;
+            }
+          printf("Test passed.\n");
+          test_passed ++;
+        }
+    }
+  return 0;
+}
+
+int
+test_budget ()
+{
+  const char *js = "{\"name\": \"a long string value\", \"list\": [1, 2.5, true, null,"
+    " {\"k\": \"v\"}], \"nested\": {\"deep\": [[]], \"x\": -3}}\n[\"second\"]\n";
+  static const size_t bytes[] = { 0, 1, 8, 32, 0, 16 };
+  static const size_t events[] = { 1, 0, 0, 0, 3, 2 };
+  testpause_t ref, cref, t;
+  jssp_parser p;
+  jssp_budget budget;
+  char buf[256], chunk[64];
+  size_t i, step, l, k, n = strlen (js), yields;
+  jssperr_t err;
+
+  memset (&ref, 0, sizeof(ref));
+  jssp_init(&p);
+  if (JSSP_SUCCESS != jssp_parse (&p, js, n, buf, sizeof(buf), 100, &test_pause_cb, &ref))
+    {
+      printf("Test failed: Budget reference parse.\n");
+      test_failed ++;
+      return 1;
+    }
+
+  for (i = 0; i < sizeof(bytes) / sizeof(bytes[0]); i++)
+    {
+      budget.max_bytes = bytes[i];
+      budget.max_events = events[i];
+      /* the whole text at once, each call does at least its budget */
+      memset (&t, 0, sizeof(t));
+      jssp_init(&p);
+      jssp_set_budget (&p, &budget);
+      yields = 0;
+      while (JSSP_YIELD == (err = jssp_parse (&p, js, n, buf, sizeof(buf), 100,
+                                              &test_pause_cb, &t)))
+        yields++;
+      if (JSSP_SUCCESS != err || 0 == yields
+        || (0 != bytes[i] && 0 == events[i] && yields > n / bytes[i])
+        || (0 != events[i] && 0 == bytes[i] && yields > ref.events / events[i])
+        || t.len != ref.len || 0 != memcmp (t.log, ref.log, t.len))
+        {
+          printf("Test failed: Budget of %zu bytes, %zu events returned %d after %zu yields:\n%.*s\n",
+                 bytes[i], events[i], err, yields, (int) t.len, t.log);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+
+      /* chunks are kept until a call is done */
+      for (step = 1; step <= 64; step *= 4)
+        {
+          test_json_pause(step, 0, &cref);
+          memset (&t, 0, sizeof(t));
+          jssp_init(&p);
+          jssp_set_budget (&p, &budget);
+          for (l = 0; l < n; l += k)
+            {
+              k = n - l < step ? n - l : step;
+              memcpy (chunk, js + l, k);
+              while (JSSP_YIELD == (err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100,
+                                                           &test_pause_cb, &t)))
+                ;
+              memset (chunk, 'x', sizeof(chunk));
+              if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err)
+                break;
+            }
+          if (JSSP_SUCCESS != err || t.len != cref.len || 0 != memcmp (t.log, cref.log, t.len))
+            {
+              printf("Test failed: Budget of %zu bytes, %zu events in %zu byte chunks returned %d:\n%.*s\n",
+                     bytes[i], events[i], step, err, (int) t.len, t.log);
+              test_failed ++;
+              return 1;
+            }
+          printf("Test passed.\n");
+          test_passed ++;
+        }
+    }
+  return 0;
+}
+
+int
+test_limits ()
+{
+  static const struct
+  {
+    const char *js;
+    jssp_limits limits;
+    jssplimit_t limit;
+    uint64_t offset;
+  } cases[] =
+    {
+      { "[[1]]", { 2, 0, 0, 0, 0 }, JSSP_LIMIT_NONE, 0 },
+      { "[[[1]]]", { 2, 0, 0, 0, 0 }, JSSP_LIMIT_DEPTH, 2 },
+      { "{\"a\":{\"b\":{}}}", { 2, 0, 0, 0, 0 }, JSSP_LIMIT_DEPTH, 10 },
+      { "[\"abcd\"]", { 0, 4, 0, 0, 0 }, JSSP_LIMIT_NONE, 0 },
+      { "[\"abcde\"]", { 0, 4, 0, 0, 0 }, JSSP_LIMIT_STRING, 8 },
+      { "{\"abcde\":1}", { 0, 4, 0, 0, 0 }, JSSP_LIMIT_STRING, 8 },
+      { "{\"k\":\"a\\nbcd\"}", { 0, 4, 0, 0, 0 }, JSSP_LIMIT_STRING, 13 },
+      { "[123, true]", { 0, 0, 4, 0, 0 }, JSSP_LIMIT_NONE, 0 },
+      { "[1234, 12345]", { 0, 0, 4, 0, 0 }, JSSP_LIMIT_NUMBER, 12 },
+      { "[true,null,false,-1]", { 0, 0, 2, 0, 0 }, JSSP_LIMIT_NONE, 0 },
+      { "{\"a\":false,\"b\":123}", { 0, 0, 2, 0, 0 }, JSSP_LIMIT_NUMBER, 18 },
+      { "[1,2,3]", { 0, 0, 0, 4, 0 }, JSSP_LIMIT_NONE, 0 },
+      { "{\"a\":1,\"b\":2}", { 0, 0, 0, 4, 0 }, JSSP_LIMIT_TOKENS, 10 },
+      { "[1,2,3]\n[1,2,3]\n[1,2,[3]]", { 0, 0, 0, 4, 0 }, JSSP_LIMIT_TOKENS, 22 },
+      { "[1,2,3] [] {}", { 0, 0, 0, 0, 3 }, JSSP_LIMIT_NONE, 0 },
+      { "[1,2,3,4]", { 0, 0, 0, 0, 3 }, JSSP_LIMIT_ELEMENTS, 6 },
+      { "[[1],{\"a\":1,\"b\":2,\"c\":3,\"d\":4}]", { 0, 0, 0, 0, 3 }, JSSP_LIMIT_ELEMENTS, 23 },
+    };
+  testpause_t t;
+  jssp_parser p;
+  jssp_limits limits;
+  char buf[256], chunk[64];
+  size_t i, l, k, n;
+  jssperr_t err, want;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+      n = strlen (cases[i].js);
+      limits = cases[i].limits;
+      want = JSSP_LIMIT_NONE == cases[i].limit ? JSSP_SUCCESS : JSSP_ERROR_LIMIT;
+
+      /* the whole text, then once more after the failure */
+      memset (&t, 0, sizeof(t));
+      jssp_init(&p);
+      jssp_set_limits (&p, &limits);
+      err = jssp_parse (&p, cases[i].js, n, buf, sizeof(buf), 100, &test_pause_cb, &t);
+      if (want != err || cases[i].limit != limits.limit || cases[i].offset != limits.limit_offset
+        || want != jssp_parse (&p, cases[i].js, n, buf, sizeof(buf), 100, &test_pause_cb, &t))
+        {
+          printf("Test failed: Limits on %s returned %d, limit %d at %llu.\n",
+                 cases[i].js, err, limits.limit, (unsigned long long) limits.limit_offset);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+
+      /* one byte at a time the fragments of a literal add up */
+      memset (&t, 0, sizeof(t));
+      jssp_init(&p);
+      jssp_set_limits (&p, &limits);
+      for (l = 0; l < n; l += k)
+        {
+          k = 1;
+          memcpy (chunk, cases[i].js + l, k);
+          err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, &test_pause_cb, &t);
+          if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err)
+            break;
+        }
+      if (JSSP_ERROR_LIMIT != want && JSSP_ERROR_LIMIT != err)
+        err = jssp_parse_chunk(&p, "\n", 1, buf, sizeof(buf), 100, &test_pause_cb, &t);
+      if (want != err || cases[i].limit != limits.limit)
+        {
+          printf("Test failed: Limits on %s in 1 byte chunks returned %d, limit %d.\n",
+                 cases[i].js, err, limits.limit);
+          test_failed ++;
+          return 1;
+        }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+
+  /* no limits once they are removed */
+  jssp_init(&p);
+  limits = cases[1].limits;
+  jssp_set_limits (&p, &limits);
+  jssp_set_limits (&p, NULL);
+  if (JSSP_SUCCESS != jssp_parse (&p, cases[1].js, strlen (cases[1].js), buf, sizeof(buf),
+                                  100, &test_pause_cb, &t))
+    {
+      printf("Test failed: Removed limits still apply.\n");
+      test_failed ++;
+      return 1;
+    }
+  printf("Test passed.\n");
+  test_passed ++;
+  return 0;
+}
+
+typedef struct
+{
+  char log[1024];
+  size_t len;
+} testfast_t;
+
+/* Containers and the data of values joined, so the fragments of a value
+ * add up to it */
+int
+test_fast_cb (void *cls,
+              jssptype_t type,
+              size_t depth,
+              size_t index,
+              const char *key,
+              size_t key_len,
+              const char *data,
+              size_t data_size,
+              uint64_t stream_offset)
+{
+  testfast_t *t = cls;
+
+  if (JSSP_ARRAY_VAL != type && JSSP_OBJECT_VAL != type)
+    t->len += snprintf (t->log + t->len, sizeof(t->log) - t->len, "<%d>", type);
+  else
+    t->len += snprintf (t->log + t->len, sizeof(t->log) - t->len, "%.*s",
+                        (int) data_size, data);
+  if (t->len >= sizeof(t->log))
+    t->len = sizeof(t->log) - 1;
+  return 0;
+}
+
+/* Feed js through jssp_parse_chunk cut at a and b, or one byte at a time
+ * when b is 0, scribbling over each chunk after the call */
+static jssperr_t
+test_fast_feed (const char *js,
+                size_t n,
+                size_t a,
+                size_t b,
+                testfast_t *t)
+{
+  jssp_parser p;
+  char buf[256], chunk[128];
+  size_t l, k;
+  jssperr_t err = JSSP_ERROR_PART;
+
+  memset (t, 0, sizeof(*t));
+  jssp_init(&p);
+  for (l = 0; l < n; l += k)
+    {
+      k = 0 == b ? 1 : l < a ? a - l : l < b ? b - l : n - l;
+      memcpy (chunk, js + l, k);
+      err = jssp_parse_chunk(&p, chunk, k, buf, sizeof(buf), 100, &test_fast_cb, t);
+      memset (chunk, 'x', sizeof(chunk));
+      if (JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err && JSSP_SUCCESS != err)
+        break;
+    }
+  return err;
+}
+
+#define test_fast_same(w, c) \
+  ((w).len == (c).len && 0 == memcmp ((w).log, (c).log, (w).len))
+
+int
+test_fast_path ()
+{
+  /* complete literals take the fast path, a literal cut by the end of a
+   * chunk the resumable one from there; both must agree on valid and
+   * invalid input, wherever the cut is */
+  static const struct
+  {
+    const char *js;
+    jssperr_t ret;
+  } cases[] =
+    {
+      { "{\"s\":\"a\\\"b\\\\\\/\\b\\f\\n\\r\\t\\u00e9\\u20AC\",\"u\":\"\xc3\xa9\xe2\x82\xac"
+        "\xf0\x9f\x98\x80\",\"n\":[0,-1.5e+10,2E-3,true,false,null]}", JSSP_SUCCESS },
+      { "[\"\xf8\x88\x80\x80\x80\", \"x\xfc\x84\x80\x80\x80\x80y\"]", JSSP_SUCCESS },
+      { "[\"\x80\"]", JSSP_ERROR_INVAL },
+      { "[\"a\\qb\"]", JSSP_ERROR_INVAL },
+      { "[\"\\u12G4\"]", JSSP_ERROR_INVAL },
+      { "[\"\xc3(\"]", JSSP_ERROR_INVAL },
+      { "[\"\xe2\x82\"]", JSSP_ERROR_INVAL },
+      { "[\"\xfe\"]", JSSP_ERROR_INVAL },
+      { "[tru\"e]", JSSP_ERROR_INVAL },
+    };
+  testfast_t whole, cut;
+  jssp_parser p;
+  char buf[256];
+  size_t i, l, a, b, n;
+  jssperr_t err, err2;
+
+  for (i = 0; i < sizeof(cases) / sizeof(cases[0]); i++)
+    {
+      n = strlen (cases[i].js);
+      memset (&whole, 0, sizeof(whole));
+      jssp_init(&p);
+      err = jssp_parse (&p, cases[i].js, n, buf, sizeof(buf), 100, &test_fast_cb, &whole);
+      if (cases[i].ret != err)
+        {
+          printf("Test failed: Fast path case %zu returned %d.\n", i, err);
+          test_failed ++;
+          return 1;
+        }
+
+      /* a growing prefix of the same text, one more byte per call */
+      memset (&cut, 0, sizeof(cut));
+      jssp_init(&p);
+      for (l = 1, err2 = JSSP_ERROR_PART; l <= n; l++)
+        {
+          err2 = jssp_parse (&p, cases[i].js, l, buf, sizeof(buf), 100, &test_fast_cb, &cut);
+          if (JSSP_ERROR_PART != err2 && JSSP_ERROR_BROKEN != err2 && JSSP_SUCCESS != err2)
+            break;
+        }
+      if (err != err2 || (JSSP_SUCCESS == err && !test_fast_same(whole, cut)))
+        {
+          printf("Test failed: Fast path case %zu growing by a byte returned %d:\n%.*s\n%.*s\n",
+                 i, err2, (int) whole.len, whole.log, (int) cut.len, cut.log);
+          test_failed ++;
+          return 1;
+        }
+
+      /* chunks of one byte, then every split into up to three pieces */
+      for (b = 0; b <= n; b++)
+        for (a = 0; a < (0 == b ? 1 : b); a++)
+          {
+            err2 = test_fast_feed (cases[i].js, n, a, b, &cut);
+            if (err != err2 || (JSSP_SUCCESS == err && !test_fast_same(whole, cut)))
+              {
+                printf("Test failed: Fast path case %zu cut at %zu and %zu returned %d:\n"
+                       "%.*s\n%.*s\n", i, a, b, err2, (int) whole.len, whole.log,
+                       (int) cut.len, cut.log);
+                test_failed ++;
+                return 1;
+              }
+          }
+      printf("Test passed.\n");
+      test_passed ++;
+    }
+  return 0;
+}
+
+int
 main ()
 {
   test_literal_parser ();
   test_basic_json_parser ();
   test_part_json_parser ();
+  test_split_key ();
   test_nomem ();
+  test_grow ();
+  test_path ();
+  test_inline ();
+  test_bounded ();
+  test_encoding ();
+  test_validate ();
+  test_write ();
+  test_transform ();
+  test_reformat ();
+  test_tape ();
+  test_index ();
+  test_cache ();
+  test_binary ();
+  test_columns ();
+  test_bulk ();
+  test_base64 ();
+  test_fingerprint ();
+  test_filter ();
+  test_sample ();
+  test_pause ();
+  test_budget ();
+  test_limits ();
+  test_fast_path ();
+  return test_failed != 0;
 }
@@ -0,0 +1,274 @@
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_utf_debug(M, ...)
+#else
+#include <stdio.h>
+#define jssp_utf_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+#define jssp_utf_unit_size(e) \
+  (((e) == JSSP_ENCODING_UTF16LE || (e) == JSSP_ENCODING_UTF16BE) ? 2 : 4)
+
+#define jssp_utf_read_unit(e, u) \
+  ((e) == JSSP_ENCODING_UTF16LE ? (uint32_t) (u)[0] | (uint32_t) (u)[1] << 8 : \
+   (e) == JSSP_ENCODING_UTF16BE ? (uint32_t) (u)[1] | (uint32_t) (u)[0] << 8 : \
+   (e) == JSSP_ENCODING_UTF32LE ? (uint32_t) (u)[0] | (uint32_t) (u)[1] << 8 \
+                                  | (uint32_t) (u)[2] << 16 | (uint32_t) (u)[3] << 24 : \
+                                  (uint32_t) (u)[3] | (uint32_t) (u)[2] << 8 \
+                                  | (uint32_t) (u)[1] << 16 | (uint32_t) (u)[0] << 24)
+
+/* Mask of the bits which must be clear in a little endian 64-bit load of
+ * four UTF-16 or two UTF-32 code units for all of them to be ASCII */
+static const uint64_t jssp_utf_ascii_mask[] =
+  { 0,
+    0,
+    0xFF80FF80FF80FF80ULL, /* JSSP_ENCODING_UTF16LE */
+    0x80FF80FF80FF80FFULL, /* JSSP_ENCODING_UTF16BE */
+    0xFFFFFF80FFFFFF80ULL, /* JSSP_ENCODING_UTF32LE */
+    0x80FFFFFF80FFFFFFULL  /* JSSP_ENCODING_UTF32BE */
+  };
+
+/* Offset of the ASCII byte inside a code unit */
+static const int jssp_utf_ascii_byte[] =
+  { 0, 0, 0, 1, 0, 3 };
+
+jsspencoding_t
+jssp_detect_encoding (const char *data,
+                      size_t len,
+                      size_t *bom_len)
+{
+  const unsigned char *u = (const unsigned char *) data;
+  size_t bom = 0;
+  jsspencoding_t e = JSSP_ENCODING_UTF8;
+
+  if (len >= 4 && u[0] == 0xFF && u[1] == 0xFE && u[2] == 0 && u[3] == 0)
+    {
+      e = JSSP_ENCODING_UTF32LE;
+      bom = 4;
+    }
+  else if (len >= 4 && u[0] == 0 && u[1] == 0 && u[2] == 0xFE && u[3] == 0xFF)
+    {
+      e = JSSP_ENCODING_UTF32BE;
+      bom = 4;
+    }
+  else if (len >= 2 && u[0] == 0xFF && u[1] == 0xFE)
+    {
+      e = JSSP_ENCODING_UTF16LE;
+      bom = 2;
+    }
+  else if (len >= 2 && u[0] == 0xFE && u[1] == 0xFF)
+    {
+      e = JSSP_ENCODING_UTF16BE;
+      bom = 2;
+    }
+  else if (len >= 3 && u[0] == 0xEF && u[1] == 0xBB && u[2] == 0xBF)
+    bom = 3;
+  /* JSON text starts with two ASCII chars, the NUL pattern gives the
+   * encoding away (RFC 4627, section 3) */
+  else if (len >= 4 && u[0] == 0 && u[1] == 0 && u[2] == 0 && u[3] != 0)
+    e = JSSP_ENCODING_UTF32BE;
+  else if (len >= 4 && u[0] != 0 && u[1] == 0 && u[2] == 0 && u[3] == 0)
+    e = JSSP_ENCODING_UTF32LE;
+  else if (len >= 2 && u[0] == 0 && u[1] != 0)
+    e = JSSP_ENCODING_UTF16BE;
+  else if (len >= 2 && u[0] != 0 && u[1] == 0)
+    e = JSSP_ENCODING_UTF16LE;
+
+  if (NULL != bom_len)
+    *bom_len = bom;
+  return e;
+}
+
+void
+jssp_transcoder_init (jssp_transcoder *t,
+                      jsspencoding_t encoding)
+{
+  t->encoding = encoding;
+  t->surrogate = 0;
+  t->unit_len = 0;
+}
+
+jssperr_t
+jssp_transcode (jssp_transcoder *t,
+                const char *in,
+                size_t *in_len,
+                char *out,
+                size_t *out_len)
+{
+  const unsigned char *pos = (const unsigned char *) in;
+  const unsigned char *end = pos + *in_len;
+  unsigned char *o = (unsigned char *) out;
+  unsigned char *oend = o + *out_len;
+  size_t unit = jssp_utf_unit_size(t->encoding);
+  uint32_t cp;
+
+  if (JSSP_ENCODING_UTF8 == t->encoding)
+    {
+      size_t n = *in_len < *out_len ? *in_len : *out_len;
+      memcpy (out, in, n);
+      *in_len = n;
+      *out_len = n;
+      return JSSP_SUCCESS;
+    }
+  if (t->encoding < JSSP_ENCODING_UTF16LE || t->encoding > JSSP_ENCODING_UTF32BE)
+    return JSSP_ERROR_INVAL;
+
+  while (oend - o >= 4)
+    {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      /* ASCII runs: a word of code units at a time, one byte out per unit */
+      if (0 == t->unit_len && 0 == t->surrogate)
+        {
+          uint64_t mask = jssp_utf_ascii_mask[t->encoding];
+          int b = jssp_utf_ascii_byte[t->encoding];
+          uint64_t w;
+          size_t i;
+
+          while (end - pos >= 8 && (size_t) (oend - o) >= 8 / unit)
+            {
+              memcpy (&w, pos, 8);
+              if (0 != (w & mask))
+                break;
+              for (i = 0; i < 8 / unit; i++)
+                o[i] = pos[i * unit + b];
+              o += 8 / unit;
+              pos += 8;
+            }
+          if (oend - o < 4)
+            break;
+        }
+#endif
+      /* a code unit may be split across chunks */
+      if (t->unit_len > 0 || (size_t) (end - pos) < unit)
+        {
+          while (t->unit_len < unit && pos < end)
+            t->unit[t->unit_len++] = *pos++;
+          if (t->unit_len < unit)
+            break;
+          cp = jssp_utf_read_unit(t->encoding, t->unit);
+          t->unit_len = 0;
+        }
+      else
+        {
+          cp = jssp_utf_read_unit(t->encoding, pos);
+          pos += unit;
+        }
+
+      if (cp >= 0xD800 && cp < 0xDC00 && unit == 2)
+        {
+          if (0 != t->surrogate)
+            {
+              jssp_utf_debug("Unpaired high surrogate %X", t->surrogate);
+              return JSSP_ERROR_INVAL;
+            }
+          t->surrogate = cp;
+          continue;
+        }
+      if (cp >= 0xDC00 && cp < 0xE000 && unit == 2)
+        {
+          if (0 == t->surrogate)
+            {
+              jssp_utf_debug("Unpaired low surrogate %X", cp);
+              return JSSP_ERROR_INVAL;
+            }
+          cp = 0x10000 + ((t->surrogate - 0xD800) << 10) + (cp - 0xDC00);
+          t->surrogate = 0;
+        }
+      else if (0 != t->surrogate || cp > 0x10FFFF || (cp >= 0xD800 && cp < 0xE000))
+        {
+          jssp_utf_debug("Invalid code point %X", cp);
+          return JSSP_ERROR_INVAL;
+        }
+
+      if (cp < 0x80)
+        *o++ = (unsigned char) cp;
+      else if (cp < 0x800)
+        {
+          *o++ = 0xC0 | (cp >> 6);
+          *o++ = 0x80 | (cp & 0x3F);
+        }
+      else if (cp < 0x10000)
+        {
+          *o++ = 0xE0 | (cp >> 12);
+          *o++ = 0x80 | ((cp >> 6) & 0x3F);
+          *o++ = 0x80 | (cp & 0x3F);
+        }
+      else
+        {
+          *o++ = 0xF0 | (cp >> 18);
+          *o++ = 0x80 | ((cp >> 12) & 0x3F);
+          *o++ = 0x80 | ((cp >> 6) & 0x3F);
+          *o++ = 0x80 | (cp & 0x3F);
+        }
+    }
+
+  *in_len = (const char *) pos - in;
+  *out_len = (char *) o - out;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_parse_encoded (jssp_parser *parser,
+                    jssp_transcoder *t,
+                    const char *js,
+                    size_t len,
+                    void *buf,
+                    size_t buf_size,
+                    size_t max_key_len,
+                    jssp_process_callback cb,
+                    void *cls)
+{
+  char block[JSSP_TRANSCODE_BLOCK];
+  jssperr_t err;
+  size_t in, out;
+  int parsed = 0;
+
+  /* detection needs the first four bytes, keep them in the unit buffer */
+  if (JSSP_ENCODING_AUTO == t->encoding)
+    {
+      while (t->unit_len < 4 && len > 0)
+        {
+          t->unit[t->unit_len++] = *js++;
+          len--;
+        }
+      if (t->unit_len < 4)
+        return JSSP_ERROR_PART;
+      t->encoding = jssp_detect_encoding ((const char *) t->unit, 4, NULL);
+      jssp_utf_debug("Detected encoding %d", t->encoding);
+      in = t->unit_len;
+      t->unit_len = 0;
+      memcpy (block, t->unit, in);
+      err = jssp_parse_encoded (parser, t, block, in, buf, buf_size, max_key_len, cb, cls);
+      if (JSSP_SUCCESS != err && JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err)
+        return err;
+      if (0 == len)
+        return err;
+    }
+
+  /* UTF-8 needs no copy */
+  if (JSSP_ENCODING_UTF8 == t->encoding)
+    return jssp_parse_chunk (parser, js, len, buf, buf_size, max_key_len, cb, cls);
+
+  while (len > 0)
+    {
+      in = len;
+      out = sizeof(block);
+      err = jssp_transcode (t, js, &in, block, &out);
+      if (JSSP_SUCCESS != err)
+        return err;
+      js += in;
+      len -= in;
+      if (0 == out)
+        continue;
+      err = jssp_parse_chunk (parser, block, out, buf, buf_size, max_key_len, cb, cls);
+      if (JSSP_SUCCESS != err && JSSP_ERROR_PART != err && JSSP_ERROR_BROKEN != err)
+        return err;
+      parsed = 1;
+    }
+  if (!parsed)
+    return jssp_parse_chunk (parser, block, 0, buf, buf_size, max_key_len, cb, cls);
+  return err;
+}
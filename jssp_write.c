@@ -0,0 +1,980 @@
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "jssp.h"
+
+#ifndef JSSP_DEBUG
+#define jssp_write_debug(M, ...)
+#else
+#define jssp_write_debug(M, ...) do { fprintf(stderr, "DEBUG %s:%d: " M "\n", __FILE__, __LINE__, ##__VA_ARGS__); } while(0)
+#endif
+
+#define JSSP_WRITE_ONES 0x0101010101010101ULL
+#define JSSP_WRITE_HIGHS 0x8080808080808080ULL
+/* Exact per byte, no borrow between bytes */
+#define jssp_write_iszero(v) \
+  (~((((v) & ~JSSP_WRITE_HIGHS) + ~JSSP_WRITE_HIGHS) | (v)) & JSSP_WRITE_HIGHS)
+/* Exact per byte for n <= 0x80, bytes >= 0x80 never match */
+#define jssp_write_isless(v, n) \
+  (~(((v) & ~JSSP_WRITE_HIGHS) + JSSP_WRITE_ONES * (0x80 - (n))) \
+   & ~(v) & JSSP_WRITE_HIGHS)
+
+#define jssp_write_is_object(w) \
+  ((w)->depth > 0 \
+   && (((w)->stack[((w)->depth - 1) / 64] >> (((w)->depth - 1) % 64)) & 1))
+
+#define jssp_write_check(w, e) do { \
+  jssperr_t _e = (e); \
+  if (JSSP_SUCCESS != _e) \
+    { \
+      (w)->last_err = _e; \
+      return _e; \
+    } \
+} while (0)
+
+static const char jssp_write_digits[] =
+  "00010203040506070809101112131415161718192021222324252627282930313233343536373839"
+  "40414243444546474849505152535455565758596061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+
+static const char jssp_write_hex[] = "0123456789abcdef";
+
+/* Decimals tried before falling back to %g */
+#define JSSP_WRITE_DECIMALS 10
+
+/* Empty the buffer through the flush callback, a full buffer without one
+ * is out of memory */
+static jssperr_t
+jssp_write_drain (jssp_writer *w)
+{
+  if (0 == w->len)
+    return JSSP_SUCCESS;
+  if (NULL == w->flush)
+    {
+      w->last_err = JSSP_ERROR_NOMEM;
+      return JSSP_ERROR_NOMEM;
+    }
+  if (0 != w->flush (w->cls, w->buf, w->len))
+    {
+      jssp_write_debug("Terminated by user's flush function.");
+      w->last_err = JSSP_TERMINATE;
+      return JSSP_TERMINATE;
+    }
+  w->len = 0;
+  return JSSP_SUCCESS;
+}
+
+/* Make room for n bytes, flushing the buffer if needed */
+static jssperr_t
+jssp_write_reserve (jssp_writer *w,
+                    size_t n)
+{
+  if (w->len + n <= w->size)
+    return JSSP_SUCCESS;
+  if (JSSP_SUCCESS != jssp_write_drain (w))
+    return w->last_err;
+  if (n > w->size)
+    {
+      jssp_write_debug("%zu bytes do not fit the %zu byte buffer", n, w->size);
+      w->last_err = JSSP_ERROR_NOMEM;
+      return JSSP_ERROR_NOMEM;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Copy bytes of any length, flushing as the buffer fills */
+static jssperr_t
+jssp_write_bytes (jssp_writer *w,
+                  const char *data,
+                  size_t len)
+{
+  size_t n;
+
+  while (len > 0)
+    {
+      if (w->len == w->size && JSSP_SUCCESS != jssp_write_drain (w))
+        return w->last_err;
+      n = len < w->size - w->len ? len : w->size - w->len;
+      memcpy (w->buf + w->len, data, n);
+      w->len += n;
+      data += n;
+      len -= n;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Separator owed before the next key or value. A value after a key only
+ * needs the ':' already written with the key. */
+static jssperr_t
+jssp_write_separator (jssp_writer *w,
+                      int is_key)
+{
+  if (jssp_write_is_object(w) && is_key == w->after_key)
+    {
+      jssp_write_debug("%s where a %s is expected", is_key ? "Key" : "Value",
+                       is_key ? "value" : "key");
+      return JSSP_ERROR_INVAL;
+    }
+  if (w->after_key)
+    {
+      w->after_key = 0;
+      return JSSP_SUCCESS;
+    }
+  if (w->first)
+    {
+      w->first = 0;
+      return JSSP_SUCCESS;
+    }
+  /* top level values go one per line */
+  if (JSSP_SUCCESS != jssp_write_reserve (w, 1))
+    return w->last_err;
+  w->buf[w->len++] = 0 == w->depth ? '\n' : ',';
+  return JSSP_SUCCESS;
+}
+
+/* String body with '"', '\\' and control characters escaped. Runs of
+ * plain bytes are found a word at a time and copied in one go. */
+static jssperr_t
+jssp_write_escaped (jssp_writer *w,
+                    const char *s,
+                    size_t len)
+{
+  const char *end = s + len, *run;
+  unsigned char c;
+
+  while (s < end)
+    {
+      run = s;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      uint64_t v, m;
+
+      while (s + 8 <= end)
+        {
+          memcpy (&v, s, 8);
+          m = jssp_write_isless(v, 0x20)
+            | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '"'))
+            | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '\\'));
+          if (0 != m)
+            {
+              s += __builtin_ctzll (m) / 8;
+              goto special;
+            }
+          s += 8;
+        }
+#endif
+      while (s < end && (unsigned char) *s >= 0x20 && *s != '"' && *s != '\\')
+        s++;
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+      special:
+#endif
+      if (s > run && JSSP_SUCCESS != jssp_write_bytes (w, run, s - run))
+        return w->last_err;
+      if (s == end)
+        break;
+
+      c = (unsigned char) *s++;
+      if (JSSP_SUCCESS != jssp_write_reserve (w, 6))
+        return w->last_err;
+      w->buf[w->len++] = '\\';
+      switch (c)
+        {
+        case '"': w->buf[w->len++] = '"'; break;
+        case '\\': w->buf[w->len++] = '\\'; break;
+        case '\b': w->buf[w->len++] = 'b'; break;
+        case '\f': w->buf[w->len++] = 'f'; break;
+        case '\n': w->buf[w->len++] = 'n'; break;
+        case '\r': w->buf[w->len++] = 'r'; break;
+        case '\t': w->buf[w->len++] = 't'; break;
+        default:
+          w->buf[w->len++] = 'u';
+          w->buf[w->len++] = '0';
+          w->buf[w->len++] = '0';
+          w->buf[w->len++] = jssp_write_hex[c >> 4];
+          w->buf[w->len++] = jssp_write_hex[c & 0xF];
+          break;
+        }
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Quoted string, escaped unless raw */
+static jssperr_t
+jssp_write_quoted (jssp_writer *w,
+                   const char *s,
+                   size_t len,
+                   int raw)
+{
+  if (JSSP_SUCCESS != jssp_write_reserve (w, 1))
+    return w->last_err;
+  w->buf[w->len++] = '"';
+  if (raw)
+    {
+      if (JSSP_SUCCESS != jssp_write_bytes (w, s, len))
+        return w->last_err;
+    }
+  else if (JSSP_SUCCESS != jssp_write_escaped (w, s, len))
+    return w->last_err;
+  if (JSSP_SUCCESS != jssp_write_reserve (w, 1))
+    return w->last_err;
+  w->buf[w->len++] = '"';
+  return JSSP_SUCCESS;
+}
+
+static jssperr_t
+jssp_write_begin (jssp_writer *w,
+                  int object)
+{
+  if (w->depth >= JSSP_WRITE_DEPTH)
+    jssp_write_check(w, JSSP_ERROR_NOMEM);
+  jssp_write_check(w, jssp_write_separator (w, 0));
+  jssp_write_check(w, jssp_write_reserve (w, 1));
+  w->buf[w->len++] = object ? '{' : '[';
+  if (object)
+    w->stack[w->depth / 64] |= (uint64_t) 1 << (w->depth % 64);
+  else
+    w->stack[w->depth / 64] &= ~((uint64_t) 1 << (w->depth % 64));
+  w->depth++;
+  w->first = 1;
+  return JSSP_SUCCESS;
+}
+
+static jssperr_t
+jssp_write_end (jssp_writer *w,
+                int object)
+{
+  if (0 == w->depth || object != jssp_write_is_object(w) || w->after_key)
+    jssp_write_check(w, JSSP_ERROR_INVAL);
+  jssp_write_check(w, jssp_write_reserve (w, 1));
+  w->buf[w->len++] = object ? '}' : ']';
+  w->depth--;
+  w->first = 0;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_writer_init (jssp_writer *w,
+                  char *buf,
+                  size_t size,
+                  jssp_flush_callback flush,
+                  void *cls)
+{
+  w->buf = buf;
+  w->size = size;
+  w->len = 0;
+  w->flush = flush;
+  w->cls = cls;
+  w->depth = 0;
+  w->first = 1;
+  w->after_key = 0;
+  w->in_value = 0;
+  w->last_err = JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_writer_flush (jssp_writer *w)
+{
+  /* without a callback the document stays in buf */
+  if (NULL == w->flush)
+    return JSSP_SUCCESS;
+  return jssp_write_drain (w);
+}
+
+jssperr_t
+jssp_write_begin_object (jssp_writer *w)
+{
+  return jssp_write_begin (w, 1);
+}
+
+jssperr_t
+jssp_write_end_object (jssp_writer *w)
+{
+  return jssp_write_end (w, 1);
+}
+
+jssperr_t
+jssp_write_begin_array (jssp_writer *w)
+{
+  return jssp_write_begin (w, 0);
+}
+
+jssperr_t
+jssp_write_end_array (jssp_writer *w)
+{
+  return jssp_write_end (w, 0);
+}
+
+jssperr_t
+jssp_write_key (jssp_writer *w,
+                const char *key,
+                size_t len)
+{
+  if (!jssp_write_is_object(w))
+    jssp_write_check(w, JSSP_ERROR_INVAL);
+  jssp_write_check(w, jssp_write_separator (w, 1));
+  jssp_write_check(w, jssp_write_quoted (w, key, len, 0));
+  jssp_write_check(w, jssp_write_reserve (w, 1));
+  w->buf[w->len++] = ':';
+  w->after_key = 1;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_write_raw_key (jssp_writer *w,
+                    const char *key,
+                    size_t len)
+{
+  if (!jssp_write_is_object(w))
+    jssp_write_check(w, JSSP_ERROR_INVAL);
+  jssp_write_check(w, jssp_write_separator (w, 1));
+  jssp_write_check(w, jssp_write_quoted (w, key, len, 1));
+  jssp_write_check(w, jssp_write_reserve (w, 1));
+  w->buf[w->len++] = ':';
+  w->after_key = 1;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_write_string (jssp_writer *w,
+                   const char *s,
+                   size_t len)
+{
+  jssp_write_check(w, jssp_write_separator (w, 0));
+  jssp_write_check(w, jssp_write_quoted (w, s, len, 0));
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_write_raw_string (jssp_writer *w,
+                       const char *s,
+                       size_t len)
+{
+  jssp_write_check(w, jssp_write_separator (w, 0));
+  jssp_write_check(w, jssp_write_quoted (w, s, len, 1));
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_write_raw (jssp_writer *w,
+                const char *data,
+                size_t len)
+{
+  jssp_write_check(w, jssp_write_separator (w, 0));
+  jssp_write_check(w, jssp_write_bytes (w, data, len));
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_write_int (jssp_writer *w,
+                int64_t value)
+{
+  char tmp[20];
+  char *p = tmp + sizeof(tmp);
+  uint64_t u = value < 0 ? -(uint64_t) value : (uint64_t) value;
+
+  /* two digits per division */
+  while (u >= 100)
+    {
+      p -= 2;
+      memcpy (p, jssp_write_digits + (u % 100) * 2, 2);
+      u /= 100;
+    }
+  if (u >= 10)
+    {
+      p -= 2;
+      memcpy (p, jssp_write_digits + u * 2, 2);
+    }
+  else
+    *--p = '0' + u;
+  if (value < 0)
+    *--p = '-';
+  return jssp_write_raw (w, p, tmp + sizeof(tmp) - p);
+}
+
+jssperr_t
+jssp_write_double (jssp_writer *w,
+                   double value)
+{
+  char tmp[32];
+  char *p;
+  int n = 0, precision, k, i;
+  double scaled;
+  uint64_t m;
+
+  if (!isfinite (value))
+    jssp_write_check(w, JSSP_ERROR_INVAL);
+  if (value > -1e15 && value < 1e15 && value == (double) (int64_t) value)
+    return jssp_write_int (w, (int64_t) value);
+  /* Few decimals, e.g. prices: value is the correctly rounded m / 10^k,
+   * so does strtod of the decimal digits of m with k of them after the
+   * point. The first k found gives the fewest digits. */
+  for (k = 1; k < JSSP_WRITE_DECIMALS; k++)
+    {
+      scaled = value * jssp_pow10[k];
+      if (scaled <= -1e15 || scaled >= 1e15)
+        break;
+      if (scaled != (double) (int64_t) scaled
+        || (double) (int64_t) scaled / jssp_pow10[k] != value)
+        continue;
+      m = scaled < 0 ? (uint64_t) -(int64_t) scaled : (uint64_t) scaled;
+      p = tmp + sizeof(tmp);
+      for (i = 0; i < k; i++, m /= 10)
+        *--p = '0' + m % 10;
+      *--p = '.';
+      do
+        *--p = '0' + m % 10;
+      while ((m /= 10) > 0);
+      if (value < 0)
+        *--p = '-';
+      return jssp_write_raw (w, p, tmp + sizeof(tmp) - p);
+    }
+  /* fewest digits that read back to the same double, 17 always do */
+  for (precision = 15; precision <= 17; precision++)
+    {
+      n = snprintf (tmp, sizeof(tmp), "%.*g", precision, value);
+      if (strtod (tmp, NULL) == value)
+        break;
+    }
+  return jssp_write_raw (w, tmp, n);
+}
+
+jssperr_t
+jssp_write_bool (jssp_writer *w,
+                 int value)
+{
+  return value ? jssp_write_raw (w, "true", 4) : jssp_write_raw (w, "false", 5);
+}
+
+jssperr_t
+jssp_write_null (jssp_writer *w)
+{
+  return jssp_write_raw (w, "null", 4);
+}
+
+jssperr_t
+jssp_write_event (jssp_writer *w,
+                  const jssp_parser *parser,
+                  jssptype_t type,
+                  const char *key,
+                  size_t key_len,
+                  const char *data,
+                  size_t data_size)
+{
+  int string = JSSP_STRING == parser->literal_type;
+
+  switch (type)
+    {
+    case JSSP_ARRAY_OPEN:
+    case JSSP_OBJECT_OPEN:
+      if (jssp_write_is_object(w))
+        jssp_write_check(w, jssp_write_raw_key (w, key, key_len));
+      return jssp_write_begin (w, JSSP_OBJECT_OPEN == type);
+    case JSSP_ARRAY_CLOSE:
+      return jssp_write_end_array (w);
+    case JSSP_OBJECT_CLOSE:
+      return jssp_write_end_object (w);
+    case JSSP_ARRAY_VAL:
+    case JSSP_OBJECT_VAL:
+      /* the first fragment of a value split across chunks opens it */
+      if (!w->in_value)
+        {
+          if (jssp_write_is_object(w))
+            jssp_write_check(w, jssp_write_raw_key (w, key, key_len));
+          jssp_write_check(w, jssp_write_separator (w, 0));
+          if (string)
+            {
+              jssp_write_check(w, jssp_write_reserve (w, 1));
+              w->buf[w->len++] = '"';
+            }
+          w->in_value = 1;
+        }
+      jssp_write_check(w, jssp_write_bytes (w, data, data_size));
+      /* the parser reports BROKEN while more fragments follow */
+      if (JSSP_SUCCESS == parser->last_err)
+        {
+          if (string)
+            {
+              jssp_write_check(w, jssp_write_reserve (w, 1));
+              w->buf[w->len++] = '"';
+            }
+          w->in_value = 0;
+        }
+      return JSSP_SUCCESS;
+    default:
+      jssp_write_check(w, JSSP_ERROR_INVAL);
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Untouched input: straight to the flush callback when it would not fit
+ * the buffer anyway, so large spans are never copied by the writer */
+static jssperr_t
+jssp_write_span (jssp_writer *w,
+                 const char *data,
+                 size_t len)
+{
+  if (len <= w->size - w->len || NULL == w->flush)
+    return jssp_write_bytes (w, data, len);
+  if (JSSP_SUCCESS != jssp_write_drain (w))
+    return w->last_err;
+  if (0 != w->flush (w->cls, data, len))
+    {
+      w->last_err = JSSP_TERMINATE;
+      return JSSP_TERMINATE;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Emit the input up to offset, less the comma a dropped first element
+ * left behind */
+static jssperr_t
+jssp_transform_copy (jssp_transformer *t,
+                     size_t offset)
+{
+  const char *comma;
+
+  if (offset <= t->copied)
+    return JSSP_SUCCESS;
+  if (t->drop_comma)
+    {
+      comma = memchr (t->js + t->copied, ',', offset - t->copied);
+      if (NULL != comma)
+        {
+          if (JSSP_SUCCESS != jssp_write_span (t->writer, t->js + t->copied,
+                                               comma - t->js - t->copied))
+            return t->writer->last_err;
+          t->copied = comma - t->js + 1;
+          t->drop_comma = 0;
+        }
+    }
+  if (JSSP_SUCCESS != jssp_write_span (t->writer, t->js + t->copied,
+                                       offset - t->copied))
+    return t->writer->last_err;
+  t->copied = offset;
+  return JSSP_SUCCESS;
+}
+
+/* Carry out what the callback asked for on the value [start, end) */
+static jssperr_t
+jssp_transform_apply (jssp_transformer *t,
+                      size_t depth,
+                      size_t index,
+                      size_t start,
+                      size_t end)
+{
+  switch (t->action)
+    {
+    case JSSP_TRANSFORM_REPLACE:
+      if (JSSP_SUCCESS != jssp_transform_copy (t, start)
+        || JSSP_SUCCESS != jssp_write_span (t->writer, t->data, t->data_len))
+        return t->writer->last_err;
+      break;
+    case JSSP_TRANSFORM_DROP:
+      /* the key and the comma before it go too, or the one after it
+       * when there is none before */
+      if (JSSP_SUCCESS != jssp_transform_copy (t, t->prev_end))
+        return t->writer->last_err;
+      if (depth > 1 && 0 == index)
+        t->drop_comma = 1;
+      break;
+    default:
+      break;
+    }
+  if (JSSP_TRANSFORM_KEEP != t->action)
+    t->copied = end;
+  t->action = JSSP_TRANSFORM_KEEP;
+  t->prev_end = end;
+  return JSSP_SUCCESS;
+}
+
+static int
+jssp_transform_cb (void *cls,
+                   jssptype_t type,
+                   size_t depth,
+                   size_t index,
+                   const char *key,
+                   size_t key_len,
+                   const char *data,
+                   size_t data_size,
+                   uint64_t stream_offset)
+{
+  jssp_transformer *t = cls;
+  size_t offset = (size_t) stream_offset;
+  size_t start;
+
+  /* inside a replaced or dropped container */
+  if (0 != t->skip_depth)
+    {
+      if (depth == t->skip_depth
+        && (JSSP_ARRAY_CLOSE == type || JSSP_OBJECT_CLOSE == type))
+        {
+          t->skip_depth = 0;
+          if (JSSP_SUCCESS != jssp_transform_apply (t, depth, t->skip_index,
+                                                    t->skip_start, offset + 1))
+            return 1;
+          return t->finish;
+        }
+      return 0;
+    }
+
+  t->type = type;
+  if (0 != t->cb (t, type, depth, index, key, key_len, data, data_size, stream_offset))
+    {
+      t->writer->last_err = JSSP_TERMINATE;
+      return 1;
+    }
+
+  switch (type)
+    {
+    case JSSP_ARRAY_OPEN:
+    case JSSP_OBJECT_OPEN:
+      if (JSSP_TRANSFORM_KEEP != t->action)
+        {
+          t->skip_depth = depth;
+          t->skip_index = index;
+          t->skip_start = offset;
+        }
+      else
+        t->prev_end = offset + 1;
+      break;
+    case JSSP_ARRAY_CLOSE:
+    case JSSP_OBJECT_CLOSE:
+      if (JSSP_SUCCESS != jssp_transform_copy (t, offset))
+        return 1;
+      t->drop_comma = 0;
+      t->prev_end = offset + 1;
+      break;
+    default:
+      /* string values are quoted, the offset is past the closing quote */
+      start = offset - data_size
+        - (JSSP_STRING == t->parser.literal_type ? 2 : 0);
+      if (JSSP_SUCCESS != jssp_transform_apply (t, depth, index, start, offset))
+        return 1;
+      break;
+    }
+
+  if (NULL != t->insert)
+    {
+      if (JSSP_SUCCESS != jssp_transform_copy (t, t->prev_end)
+        || (!t->drop_comma
+          && JSSP_SUCCESS != jssp_write_span (t->writer, depth > 1 ? "," : "\n", 1))
+        || JSSP_SUCCESS != jssp_write_span (t->writer, t->insert, t->insert_len))
+        return 1;
+      /* took the place of a dropped first element, keep its comma */
+      t->drop_comma = 0;
+      t->insert = NULL;
+    }
+  /* stop parsing, the rest passes through as is */
+  return t->finish && 0 == t->skip_depth;
+}
+
+void
+jssp_transformer_init (jssp_transformer *t,
+                       jssp_writer *writer,
+                       jssp_process_callback cb,
+                       void *cls)
+{
+  t->writer = writer;
+  t->cb = cb;
+  t->cls = cls;
+}
+
+jssperr_t
+jssp_transform_replace (jssp_transformer *t,
+                        const char *json,
+                        size_t len)
+{
+  if (JSSP_ARRAY_CLOSE == t->type || JSSP_OBJECT_CLOSE == t->type)
+    return JSSP_ERROR_INVAL;
+  t->action = JSSP_TRANSFORM_REPLACE;
+  t->data = json;
+  t->data_len = len;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_transform_drop (jssp_transformer *t)
+{
+  if (JSSP_ARRAY_CLOSE == t->type || JSSP_OBJECT_CLOSE == t->type)
+    return JSSP_ERROR_INVAL;
+  t->action = JSSP_TRANSFORM_DROP;
+  return JSSP_SUCCESS;
+}
+
+jssperr_t
+jssp_transform_insert (jssp_transformer *t,
+                       const char *json,
+                       size_t len)
+{
+  if (JSSP_ARRAY_OPEN == t->type || JSSP_OBJECT_OPEN == t->type)
+    return JSSP_ERROR_INVAL;
+  t->insert = json;
+  t->insert_len = len;
+  return JSSP_SUCCESS;
+}
+
+void
+jssp_transform_finish (jssp_transformer *t)
+{
+  t->finish = 1;
+}
+
+jssperr_t
+jssp_transform (jssp_transformer *t,
+                const char *js,
+                size_t len,
+                void *buf,
+                size_t buf_size,
+                size_t max_buffered_key_size)
+{
+  jssperr_t err;
+
+  t->js = js;
+  t->copied = 0;
+  t->prev_end = 0;
+  t->skip_depth = 0;
+  t->action = JSSP_TRANSFORM_KEEP;
+  t->drop_comma = 0;
+  t->insert = NULL;
+  t->finish = 0;
+  t->writer->last_err = JSSP_SUCCESS;
+  jssp_init (&t->parser);
+  err = jssp_parse (&t->parser, js, len, buf, buf_size, max_buffered_key_size,
+                    &jssp_transform_cb, t);
+  if (JSSP_TERMINATE == err && JSSP_SUCCESS != t->writer->last_err)
+    return (jssperr_t) t->writer->last_err;
+  if (JSSP_SUCCESS != err && !(JSSP_TERMINATE == err && t->finish))
+    return err;
+  if (JSSP_SUCCESS != jssp_transform_copy (t, len))
+    return (jssperr_t) t->writer->last_err;
+  return jssp_writer_flush (t->writer);
+}
+
+/* First '"' or '\\' of a string body, or end */
+static const char *
+jssp_write_scan_quote (const char *pos,
+                       const char *end)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v, m;
+
+  while (pos + 8 <= end)
+    {
+      memcpy (&v, pos, 8);
+      m = jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '"'))
+        | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '\\'));
+      if (0 != m)
+        return pos + __builtin_ctzll (m) / 8;
+      pos += 8;
+    }
+#endif
+  while (pos < end && *pos != '"' && *pos != '\\')
+    pos++;
+  return pos;
+}
+
+#define jssp_write_is_space(c) \
+  ((c) == ' ' || (c) == '\n' || (c) == '\r' || (c) == '\t')
+
+/* First byte past a whitespace run, or end */
+static const char *
+jssp_write_skip_space (const char *pos,
+                       const char *end)
+{
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+  uint64_t v, m;
+
+  /* indentation comes in runs, a single blank is more common still */
+  if (pos + 1 < end && !jssp_write_is_space(pos[1]))
+    return pos + 1;
+  while (pos + 8 <= end)
+    {
+      memcpy (&v, pos, 8);
+      m = ~(jssp_write_iszero(v ^ (JSSP_WRITE_ONES * ' '))
+          | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '\n'))
+          | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '\r'))
+          | jssp_write_iszero(v ^ (JSSP_WRITE_ONES * '\t'))) & JSSP_WRITE_HIGHS;
+      if (0 != m)
+        return pos + __builtin_ctzll (m) / 8;
+      pos += 8;
+    }
+#endif
+  while (pos < end && jssp_write_is_space(*pos))
+    pos++;
+  return pos;
+}
+
+/* Line break and indentation for the given depth */
+static jssperr_t
+jssp_write_newline (jssp_writer *w,
+                    size_t spaces)
+{
+  static const char blanks[] = "\n                                ";
+  size_t n;
+
+  if (JSSP_SUCCESS != jssp_write_bytes (w, blanks, 1))
+    return w->last_err;
+  while (spaces > 0)
+    {
+      n = spaces < sizeof(blanks) - 2 ? spaces : sizeof(blanks) - 2;
+      if (JSSP_SUCCESS != jssp_write_bytes (w, blanks + 1, n))
+        return w->last_err;
+      spaces -= n;
+    }
+  return JSSP_SUCCESS;
+}
+
+/* Runs between whitespace are short, copy them inline while they fit */
+#define jssp_reformat_flush(r, run, pos) do { \
+  jssp_writer *_w = (r)->writer; \
+  size_t _n = (pos) - (run); \
+  if (_n <= _w->size - _w->len) \
+    { \
+      memcpy (_w->buf + _w->len, run, _n); \
+      _w->len += _n; \
+    } \
+  else if (JSSP_SUCCESS != jssp_write_bytes (_w, run, _n)) \
+    return (jssperr_t) _w->last_err; \
+} while (0)
+
+void
+jssp_reformatter_init (jssp_reformatter *r,
+                       jssp_writer *writer,
+                       unsigned int indent)
+{
+  r->writer = writer;
+  r->indent = indent;
+  r->depth = 0;
+  r->in_string = 0;
+  r->escape = 0;
+  r->open = 0;
+  r->top = 0;
+  r->sep = 0;
+}
+
+jssperr_t
+jssp_reformat (jssp_reformatter *r,
+               const char *js,
+               size_t len)
+{
+  const char *pos = js, *end = js + len, *run = js;
+  int was_open;
+  char c;
+
+  while (pos < end)
+    {
+      if (r->in_string)
+        {
+          /* string bodies are copied as they are, escapes included */
+          if (r->escape)
+            {
+              r->escape = 0;
+              pos++;
+              continue;
+            }
+          pos = jssp_write_scan_quote (pos, end);
+          if (pos == end)
+            break;
+          if (*pos == '\\')
+            r->escape = 1;
+          else
+            r->in_string = 0;
+          pos++;
+          continue;
+        }
+
+      c = *pos;
+      if (jssp_write_is_space(c))
+        {
+          jssp_reformat_flush(r, run, pos);
+          pos = jssp_write_skip_space (pos, end);
+          run = pos;
+          /* whitespace separated top level values stay one per line */
+          if (0 == r->depth && r->top)
+            r->sep = 1;
+          continue;
+        }
+      if (r->sep)
+        {
+          jssp_reformat_flush(r, run, pos);
+          run = pos;
+          if (JSSP_SUCCESS != jssp_write_bytes (r->writer, "\n", 1))
+            return (jssperr_t) r->writer->last_err;
+          r->sep = 0;
+        }
+      /* the line break after '[' or '{' waits, empty containers stay [] */
+      was_open = r->open;
+      if (r->open)
+        {
+          r->open = 0;
+          if (c != ']' && c != '}')
+            {
+              jssp_reformat_flush(r, run, pos);
+              run = pos;
+              if (JSSP_SUCCESS != jssp_write_newline (r->writer, r->depth * r->indent))
+                return (jssperr_t) r->writer->last_err;
+            }
+        }
+
+      switch (c)
+        {
+        case '"':
+          r->in_string = 1;
+          break;
+        case '[':
+        case '{':
+          r->depth++;
+          r->open = 0 != r->indent;
+          break;
+        case ']':
+        case '}':
+          if (0 == r->depth)
+            {
+              jssp_write_debug("Unbalanced %c", c);
+              return JSSP_ERROR_INVAL;
+            }
+          r->depth--;
+          if (r->indent && !was_open)
+            {
+              jssp_reformat_flush(r, run, pos);
+              run = pos;
+              if (JSSP_SUCCESS != jssp_write_newline (r->writer, r->depth * r->indent))
+                return (jssperr_t) r->writer->last_err;
+            }
+          break;
+        case ',':
+          if (r->indent)
+            {
+              pos++;
+              jssp_reformat_flush(r, run, pos);
+              run = pos;
+              if (JSSP_SUCCESS != jssp_write_newline (r->writer, r->depth * r->indent))
+                return (jssperr_t) r->writer->last_err;
+              continue;
+            }
+          break;
+        case ':':
+          if (r->indent)
+            {
+              pos++;
+              jssp_reformat_flush(r, run, pos);
+              run = pos;
+              if (JSSP_SUCCESS != jssp_write_bytes (r->writer, " ", 1))
+                return (jssperr_t) r->writer->last_err;
+              continue;
+            }
+          break;
+        default:
+          break;
+        }
+      if (0 == r->depth)
+        r->top = 1;
+      pos++;
+    }
+  jssp_reformat_flush(r, run, pos);
+
+  if (0 != r->depth || r->in_string)
+    return JSSP_ERROR_PART;
+  return JSSP_SUCCESS;
+}